@@ -0,0 +1,1389 @@
+#include "StdAfx.h"
+#include "RawParser.h"
+#include "RawDecoder.h"
+#include "NikonDecompressor.h"
+#include <algorithm>
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+/*
+  Synthetic raw file generator.
+
+  Writes raw files with generated content, in the containers and
+  compression formats the decoders support, so decoding can be
+  benchmarked and regression tested without camera files.
+  The content is a smooth scene with a configurable amount of noise,
+  generated from a seed, so the same options always give the same file.
+
+  Each encoder mirrors its decoder, so the decoded image is known in
+  advance - with -V the file is decoded again and compared with it.
+  ARW2 and RW2 are lossy by design, so the expected image is the
+  quantized one, and lossy DNG is compared approximately.
+
+  Build like RawSpeedBench.cpp, for instance:
+
+    g++ -O2 -IRawSpeed -I/usr/include/libxml2 Benchmark/RawGenerator.cpp \
+        `ls RawSpeed/[A-Z]*.cpp | grep -v RawSpeed.cpp` -lpthread -lxml2 -ljpeg
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+using namespace RawSpeed;
+
+int rawspeed_get_number_of_processor_cores() {
+#if defined(__unix__) || defined(__APPLE__)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#else
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#endif
+}
+
+static void fail(const char* fmt, ...) {
+  va_list val;
+  va_start(val, fmt);
+  vfprintf(stderr, fmt, val);
+  va_end(val);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static void putLE16(vector<uchar8>& v, uint32 x) {
+  v.push_back(x & 0xff);
+  v.push_back((x >> 8) & 0xff);
+}
+
+static void putLE32(vector<uchar8>& v, uint32 x) {
+  putLE16(v, x & 0xffff);
+  putLE16(v, x >> 16);
+}
+
+/*** Content ***/
+
+/* Samples of a generated image, row by row. */
+/* Before encoding the content, after encoding what the decoder should deliver. */
+class Image
+{
+public:
+  Image(uint32 _w, uint32 _h) : w(_w), h(_h), pix((size_t)_w * _h) {};
+  ushort16* getRow(uint32 y) { return &pix[(size_t)y * w]; }
+  uint32 w;   // Samples per row
+  uint32 h;
+  vector<ushort16> pix;
+};
+
+/* xorshift32, so the content is the same on all platforms */
+class Random
+{
+public:
+  Random(uint32 seed) : state(seed * 2654435761u + 1) { if (!state) state = 1; };
+  uint32 next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+private:
+  uint32 state;
+};
+
+/* Fills the image with a diagonal gradient, some flat rectangles for edges, */
+/* different gains on the four CFA positions, and noiseBits bits of uniform noise. */
+/* The noise decides how well the image compresses - 0 gives almost no entropy, */
+/* while noise close to the bit depth is practically incompressible. */
+static void generateContent(Image& img, uint32 bpp, uint32 noiseBits, uint32 seed) {
+  Random rnd(seed);
+  int maxval = (1 << bpp) - 1;
+  int black = max(16, 1 << (bpp - 6));
+  int range = maxval - black;
+  static const int gain[4] = {160, 256, 256, 120};  // In 1/256
+
+  const int nrects = 8;
+  uint32 rx0[nrects], ry0[nrects], rx1[nrects], ry1[nrects];
+  int level[nrects];
+  for (int i = 0; i < nrects; i++) {
+    rx0[i] = rnd.next() % img.w;
+    ry0[i] = rnd.next() % img.h;
+    rx1[i] = rx0[i] + rnd.next() % (img.w / 3 + 1);
+    ry1[i] = ry0[i] + rnd.next() % (img.h / 3 + 1);
+    level[i] = rnd.next() % (range + 1);
+  }
+
+  uint64 diag = (uint64)img.w + img.h;
+  for (uint32 y = 0; y < img.h; y++) {
+    ushort16* row = img.getRow(y);
+    for (uint32 x = 0; x < img.w; x++) {
+      int s = range / 4 + (int)((uint64)(range / 2) * (x + y) / diag);
+      for (int i = 0; i < nrects; i++) {
+        if (x >= rx0[i] && x < rx1[i] && y >= ry0[i] && y < ry1[i])
+          s = level[i];
+      }
+      s = s * gain[(y & 1) * 2 + (x & 1)] >> 8;
+      int v = black + s;
+      if (noiseBits)
+        v += (int)(rnd.next() & ((1u << noiseBits) - 1)) - (1 << (noiseBits - 1));
+      row[x] = min(max(v, 0), maxval);
+    }
+  }
+}
+
+/*** Bit writers, matching the bit pumps ***/
+
+/* MSB first, as read by BitPumpMSB, or BitPumpJPEG with stuffing enabled */
+class BitWriterMSB
+{
+public:
+  BitWriterMSB(vector<uchar8>& _out, bool _stuffing = false) : out(_out), stuffing(_stuffing), acc(0), nacc(0) {};
+  void putBits(uint32 value, uint32 nbits) {   // nbits <= 24
+    acc = (acc << nbits) | (value & ((1 << nbits) - 1));
+    nacc += nbits;
+    while (nacc >= 8) {
+      nacc -= 8;
+      uchar8 b = (uchar8)(acc >> nacc);
+      out.push_back(b);
+      if (stuffing && b == 0xff)
+        out.push_back(0);
+    }
+  }
+  // JPEG pads with ones, others with zeros
+  void flush() { if (nacc) putBits(stuffing ? 0xff : 0, 8 - nacc); }
+private:
+  vector<uchar8>& out;
+  bool stuffing;
+  uint32 acc;
+  uint32 nacc;
+};
+
+/* MSB first in 32 bit little endian words, as read by BitPumpMSB32 */
+class BitWriterMSB32
+{
+public:
+  BitWriterMSB32(vector<uchar8>& _out) : out(_out), acc(0), nacc(0) {};
+  void putBits(uint32 value, uint32 nbits) {   // nbits <= 24
+    acc = (acc << nbits) | (value & ((1 << nbits) - 1));
+    nacc += nbits;
+    if (nacc >= 32) {
+      nacc -= 32;
+      putLE32(out, (uint32)(acc >> nacc));
+    }
+  }
+  void flush() { if (nacc) putBits(0, 32 - nacc); }
+private:
+  vector<uchar8>& out;
+  uint64 acc;
+  uint32 nacc;
+};
+
+/* LSB first, as read by BitPumpPlain */
+class BitWriterPlain
+{
+public:
+  BitWriterPlain(vector<uchar8>& _out) : out(_out), acc(0), nacc(0) {};
+  void putBits(uint32 value, uint32 nbits) {   // nbits <= 24
+    acc |= (value & ((1 << nbits) - 1)) << nacc;
+    nacc += nbits;
+    while (nacc >= 8) {
+      out.push_back(acc & 0xff);
+      acc >>= 8;
+      nacc -= 8;
+    }
+  }
+  void flush() { if (nacc) putBits(0, 8 - nacc); }
+private:
+  vector<uchar8>& out;
+  uint32 acc;
+  uint32 nacc;
+};
+
+/*** Huffman coding of differences, as in lossless JPEG ***/
+
+class HuffmanEncoder
+{
+public:
+  /* Set the table from JPEG style BITS (number of codes of length 1 to 16) and HUFFVAL */
+  void setTable(const uchar8* _bits, const uchar8* _vals) {
+    nvals = 0;
+    for (int i = 0; i < 16; i++) {
+      bits[i] = _bits[i];
+      nvals += bits[i];
+    }
+    for (uint32 i = 0; i < nvals; i++)
+      vals[i] = _vals[i];
+    generateCodes();
+  }
+
+  /* Make an optimal table for the symbol counts, with no code longer than maxLength */
+  /* This is JPEG Annex K.2, with a configurable length limit. */
+  void createTable(const uint32* counts, uint32 maxLength) {
+    // Symbol 17 is reserved, so no code will be all ones.
+    int freq[18];
+    int codesize[18];
+    int others[18];
+    for (int i = 0; i < 17; i++)
+      freq[i] = counts[i];
+    freq[17] = 1;
+    for (int i = 0; i < 18; i++) {
+      codesize[i] = 0;
+      others[i] = -1;
+    }
+    while (true) {
+      int c1 = -1, c2 = -1;
+      for (int i = 0; i < 18; i++) {
+        if (freq[i] && (c1 < 0 || freq[i] <= freq[c1]))
+          c1 = i;
+      }
+      for (int i = 0; i < 18; i++) {
+        if (freq[i] && i != c1 && (c2 < 0 || freq[i] <= freq[c2]))
+          c2 = i;
+      }
+      if (c2 < 0)
+        break;
+      freq[c1] += freq[c2];
+      freq[c2] = 0;
+      codesize[c1]++;
+      while (others[c1] >= 0) {
+        c1 = others[c1];
+        codesize[c1]++;
+      }
+      others[c1] = c2;
+      codesize[c2]++;
+      while (others[c2] >= 0) {
+        c2 = others[c2];
+        codesize[c2]++;
+      }
+    }
+    int count[33];
+    memset(count, 0, sizeof(count));
+    for (int i = 0; i < 18; i++) {
+      if (codesize[i])
+        count[codesize[i]]++;
+    }
+    // Limit the code lengths (Figure K.3)
+    for (int i = 32; i > (int)maxLength; i--) {
+      while (count[i] > 0) {
+        int j = i - 2;
+        while (count[j] == 0)
+          j--;
+        count[i] -= 2;
+        count[i-1]++;
+        count[j+1] += 2;
+        count[j]--;
+      }
+    }
+    // Remove the reserved code
+    int longest = maxLength;
+    while (count[longest] == 0)
+      longest--;
+    count[longest]--;
+
+    for (int i = 0; i < 16; i++)
+      bits[i] = count[i+1];
+    nvals = 0;
+    for (int l = 1; l <= 32; l++) {
+      for (int i = 0; i < 17; i++) {
+        if (codesize[i] == l)
+          vals[nvals++] = i;
+      }
+    }
+    generateCodes();
+  }
+
+  /* Number of bits needed to code a difference */
+  static uint32 diffBits(int diff) {
+    uint32 a = diff < 0 ? -diff : diff;
+    uint32 n = 0;
+    while (a) {
+      n++;
+      a >>= 1;
+    }
+    return n;
+  }
+
+  template<class BitWriter> void encode(BitWriter& out, int diff) {
+    uint32 s = diffBits(diff);
+    if (s > 16 || !size[s])
+      fail("Huffman table has no code for a %u bit difference", s);
+    out.putBits(code[s], size[s]);
+    // 16 bits is always -32768, and has no extra bits.
+    if (s && s < 16)
+      out.putBits(diff < 0 ? diff + (1 << s) - 1 : diff, s);
+  }
+
+  /* Writes a DHT table (without the marker) */
+  void writeDHT(vector<uchar8>& out, uint32 id) {
+    out.push_back(id);
+    for (int i = 0; i < 16; i++)
+      out.push_back(bits[i]);
+    for (uint32 i = 0; i < nvals; i++)
+      out.push_back(vals[i]);
+  }
+
+  uchar8 bits[16];
+  uchar8 vals[17];
+  uint32 nvals;
+
+private:
+  /* Canonical codes, JPEG Annex C */
+  void generateCodes() {
+    memset(size, 0, sizeof(size));
+    uint32 c = 0;
+    uint32 k = 0;
+    for (uint32 l = 1; l <= 16; l++) {
+      for (uint32 i = 0; i < bits[l-1]; i++) {
+        if (vals[k] < 17) {
+          code[vals[k]] = c;
+          size[vals[k]] = l;
+        }
+        k++;
+        c++;
+      }
+      c <<= 1;
+    }
+  }
+  uint32 code[17];
+  uint32 size[17];
+};
+
+/* Lossless JPEG with predictor 1, as read by LJpegPlain. */
+/* "samples" is frameH rows of frameW * cps interleaved samples. */
+/* If restartRows is not 0, a restart marker is written every restartRows rows. */
+static void encodeLJpeg(vector<uchar8>& out, const ushort16* samples, uint32 frameW, uint32 frameH, uint32 cps, uint32 bpp, uint32 restartRows) {
+  uint32 rowSize = frameW * cps;
+  uint32 n = rowSize * frameH;
+  vector<int> diffs(n);
+  uint32 counts[4][17];
+  memset(counts, 0, sizeof(counts));
+  for (uint32 i = 0; i < n; i++) {
+    uint32 x = i % rowSize;
+    uint32 y = i / rowSize;
+    int pred;
+    if (x >= cps)
+      pred = samples[i - cps];
+    else if (y && !(restartRows && y % restartRows == 0))
+      pred = samples[i - rowSize];  // First pixel of the line above
+    else
+      pred = 1 << (bpp - 1);
+    // Differences are modulo 2^16
+    int d = ((int)samples[i] - pred) & 0xffff;
+    if (d >= 0x8000)
+      d -= 0x10000;
+    diffs[i] = d;
+    counts[x % cps][HuffmanEncoder::diffBits(d)]++;
+  }
+
+  HuffmanEncoder huff[4];
+  for (uint32 c = 0; c < cps; c++)
+    huff[c].createTable(counts[c], min(bpp, 16u));
+
+  putLE16(out, 0xd8ff);  // SOI
+  vector<uchar8> dht;
+  for (uint32 c = 0; c < cps; c++)
+    huff[c].writeDHT(dht, c);
+  putLE16(out, 0xc4ff);
+  out.push_back((dht.size() + 2) >> 8);
+  out.push_back((dht.size() + 2) & 0xff);
+  out.insert(out.end(), dht.begin(), dht.end());
+
+  uchar8 sof[] = {0xff, 0xc3, 0, (uchar8)(8 + 3 * cps), (uchar8)bpp,
+                  (uchar8)(frameH >> 8), (uchar8)frameH, (uchar8)(frameW >> 8), (uchar8)frameW, (uchar8)cps};
+  out.insert(out.end(), sof, sof + sizeof(sof));
+  for (uint32 c = 0; c < cps; c++) {
+    out.push_back(c + 1);   // Component id
+    out.push_back(0x11);    // No subsampling
+    out.push_back(0);       // No quantization
+  }
+
+  if (restartRows) {
+    uint32 ri = restartRows * frameW;
+    if (ri > 65535)
+      fail("Restart interval of %u rows is too large", restartRows);
+    uchar8 dri[] = {0xff, 0xdd, 0, 4, (uchar8)(ri >> 8), (uchar8)ri};
+    out.insert(out.end(), dri, dri + sizeof(dri));
+  }
+
+  uchar8 sos[] = {0xff, 0xda, 0, (uchar8)(6 + 2 * cps), (uchar8)cps};
+  out.insert(out.end(), sos, sos + sizeof(sos));
+  for (uint32 c = 0; c < cps; c++) {
+    out.push_back(c + 1);
+    out.push_back(c << 4);  // Huffman table
+  }
+  out.push_back(1);  // Predictor
+  out.push_back(0);
+  out.push_back(0);  // Point transform
+
+  BitWriterMSB bits(out, true);
+  uint32 interval = 0;
+  for (uint32 i = 0; i < n; i++) {
+    if (restartRows && i && i % (rowSize * restartRows) == 0) {
+      bits.flush();
+      out.push_back(0xff);
+      out.push_back(0xd0 + (interval++ & 7));  // RSTn
+    }
+    huff[(i % rowSize) % cps].encode(bits, diffs[i]);
+  }
+  bits.flush();
+  putLE16(out, 0xd9ff);  // EOI
+}
+
+/*** TIFF container ***/
+
+/* Little endian TIFF file, built in memory */
+class TiffWriter
+{
+public:
+  TiffWriter(ushort16 magic = 42) {
+    data.push_back('I');
+    data.push_back('I');
+    putLE16(data, magic);
+    putLE32(data, 0);
+  }
+  /* Appends data, word aligned, and returns the offset of it */
+  uint32 append(const uchar8* d, uint32 size) {
+    while (data.size() & 3)
+      data.push_back(0);
+    uint32 offset = (uint32)data.size();
+    data.insert(data.end(), d, d + size);
+    return offset;
+  }
+  uint32 append(const vector<uchar8>& d) {
+    return d.empty() ? (uint32)data.size() : append(&d[0], (uint32)d.size());
+  }
+  void setFirstIFD(uint32 offset) {
+    for (int i = 0; i < 4; i++)
+      data[4 + i] = (offset >> (i * 8)) & 0xff;
+  }
+  vector<uchar8> data;
+};
+
+class TiffDirectory
+{
+public:
+  void add(uint32 tag, TiffDataType type, uint32 count, const vector<uchar8>& d) {
+    TiffDirectoryEntry e;
+    e.tag = tag;
+    e.type = type;
+    e.count = count;
+    e.data = d;
+    entries.push_back(e);
+  }
+  void addShorts(uint32 tag, const ushort16* v, uint32 n) {
+    vector<uchar8> d;
+    for (uint32 i = 0; i < n; i++)
+      putLE16(d, v[i]);
+    add(tag, TIFF_SHORT, n, d);
+  }
+  void addLongs(uint32 tag, const uint32* v, uint32 n) {
+    vector<uchar8> d;
+    for (uint32 i = 0; i < n; i++)
+      putLE32(d, v[i]);
+    add(tag, TIFF_LONG, n, d);
+  }
+  void addShort(uint32 tag, ushort16 v) { addShorts(tag, &v, 1); }
+  void addLong(uint32 tag, uint32 v) { addLongs(tag, &v, 1); }
+  void addBytes(uint32 tag, TiffDataType type, const uchar8* v, uint32 n) {
+    add(tag, type, n, vector<uchar8>(v, v + n));
+  }
+  void addAscii(uint32 tag, const string& s) {
+    addBytes(tag, TIFF_ASCII, (const uchar8*)s.c_str(), (uint32)s.size() + 1);
+  }
+
+  /* Writes the data of the entries and the directory, and returns the offset of the directory */
+  uint32 write(TiffWriter& t, uint32 nextIFD = 0) {
+    sort(entries.begin(), entries.end());
+    vector<uint32> offsets(entries.size());
+    for (uint32 i = 0; i < entries.size(); i++) {
+      if (entries[i].data.size() > 4)
+        offsets[i] = t.append(entries[i].data);
+    }
+    vector<uchar8> dir;
+    putLE16(dir, (uint32)entries.size());
+    for (uint32 i = 0; i < entries.size(); i++) {
+      TiffDirectoryEntry& e = entries[i];
+      putLE16(dir, e.tag);
+      putLE16(dir, e.type);
+      putLE32(dir, e.count);
+      if (e.data.size() > 4) {
+        putLE32(dir, offsets[i]);
+      } else {
+        vector<uchar8> inl = e.data;
+        inl.resize(4, 0);
+        dir.insert(dir.end(), inl.begin(), inl.end());
+      }
+    }
+    putLE32(dir, nextIFD);
+    return t.append(dir);
+  }
+
+private:
+  struct TiffDirectoryEntry {
+    uint32 tag;
+    uint32 type;
+    uint32 count;
+    vector<uchar8> data;
+    bool operator<(const TiffDirectoryEntry& e) const { return tag < e.tag; }
+  };
+  vector<TiffDirectoryEntry> entries;
+};
+
+/*** Formats ***/
+
+struct GeneratorOptions
+{
+  uint32 width;
+  uint32 height;
+  uint32 bpp;
+  uint32 noiseBits;
+  uint32 seed;
+  uint32 tileSize;   // DNG tile size, or rows per strip
+  uint32 quality;    // Lossy DNG JPEG quality
+  uint32 restartRows;  // Rows per lossless JPEG restart interval, 0 for none
+  string make;
+  string model;
+};
+
+static const uchar8 cfa_rggb[4] = {0, 1, 1, 2};
+static const ushort16 cfa_dim[2] = {2, 2};
+
+/* Tags of the raw image in a single strip */
+static void addImageTags(TiffDirectory& d, const GeneratorOptions& o, uint32 w, uint32 h, uint32 compression, uint32 offset, uint32 count) {
+  d.addAscii(MAKE, o.make);
+  d.addAscii(MODEL, o.model);
+  d.addLong(NEWSUBFILETYPE, 0);
+  d.addLong(IMAGEWIDTH, w);
+  d.addLong(IMAGELENGTH, h);
+  d.addShort(BITSPERSAMPLE, o.bpp);
+  d.addShort(COMPRESSION, compression);
+  d.addShort(PHOTOMETRICINTERPRETATION, 32803);
+  d.addShort(SAMPLESPERPIXEL, 1);
+  d.addLong(ROWSPERSTRIP, h);
+  d.addLong(STRIPOFFSETS, offset);
+  d.addLong(STRIPBYTECOUNTS, count);
+  d.addShorts(CFAREPEATPATTERNDIM, cfa_dim, 2);
+  d.addBytes(CFAPATTERN, TIFF_BYTE, cfa_rggb, 4);
+}
+
+/* Canon CR2: lossless JPEG with 2 components, stored in vertical slices */
+static void writeCr2(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  const uint32 cps = 2;
+  const uint32 nslices = 3;
+  uint32 sliceW = (img.w / nslices) & ~(cps - 1);
+  uint32 lastW = img.w - sliceW * (nslices - 1);
+
+  // The JPEG contains the slices after each other, each from top to bottom.
+  vector<ushort16> samples;
+  samples.reserve(img.pix.size());
+  for (uint32 s = 0; s < nslices; s++) {
+    uint32 x0 = s * sliceW;
+    uint32 x1 = s == nslices - 1 ? img.w : x0 + sliceW;
+    for (uint32 y = 0; y < img.h; y++)
+      samples.insert(samples.end(), img.getRow(y) + x0, img.getRow(y) + x1);
+  }
+  vector<uchar8> jpeg;
+  encodeLJpeg(jpeg, &samples[0], img.w / cps, img.h, cps, o.bpp, o.restartRows);
+  uint32 offset = t.append(jpeg);
+
+  TiffDirectory d;
+  addImageTags(d, o, img.w, img.h, 6, offset, (uint32)jpeg.size());
+  d.addLong(0xc5d8, 1);   // Marks the raw IFD
+  ushort16 slices[3] = {(ushort16)(nslices - 1), (ushort16)sliceW, (ushort16)lastW};
+  d.addShorts(CANONCR2SLICE, slices, 3);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Left/up prediction and Huffman coding, shared by Nikon and Pentax */
+/* The first two pixels of a line are predicted from two lines above, the rest */
+/* from the pixel two to the left */
+static void encodeNikonStyle(Image& img, HuffmanEncoder& huff, int initialPred, vector<uchar8>& out) {
+  BitWriterMSB bits(out);
+  int pUp1[2] = {initialPred, initialPred};
+  int pUp2[2] = {initialPred, initialPred};
+  for (uint32 y = 0; y < img.h; y++) {
+    ushort16* row = img.getRow(y);
+    huff.encode(bits, row[0] - pUp1[y&1]);
+    huff.encode(bits, row[1] - pUp2[y&1]);
+    pUp1[y&1] = row[0];
+    pUp2[y&1] = row[1];
+    for (uint32 x = 2; x < img.w; x += 2) {
+      huff.encode(bits, row[x] - row[x-2]);
+      huff.encode(bits, row[x+1] - row[x-1]);
+    }
+  }
+  bits.flush();
+}
+
+/* Nikon NEF: lossless Huffman compression, with the tables of NikonDecompressor */
+static void writeNef(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  if (o.bpp != 12 && o.bpp != 14)
+    fail("NEF must be 12 or 14 bits");
+  // Version 70 selects the lossless table for the bit depth, and no curve.
+  uint32 huffSelect = o.bpp == 14 ? 5 : 2;
+  HuffmanEncoder huff;
+  huff.setTable(nikon_tree[huffSelect], &nikon_tree[huffSelect][16]);
+  int pred = 1 << (o.bpp - 1);
+  vector<uchar8> strip;
+  encodeNikonStyle(img, huff, pred, strip);
+  uint32 offset = t.append(strip);
+
+  // Makernote, a TIFF of its own after a 10 byte header.
+  // The decompression info is tag 0x96, in the IFD that has tag 0x8c.
+  vector<uchar8> info;
+  info.push_back(70);   // Version
+  info.push_back(0x30);
+  for (int i = 0; i < 4; i++)
+    putLE16(info, pred);  // Initial vertical predictors
+  putLE16(info, 0);       // Curve size
+  TiffWriter maker;
+  TiffDirectory md;
+  uchar8 zero[4] = {0, 0, 0, 0};
+  md.addBytes(0x8c, TIFF_UNDEFINED, zero, 4);
+  md.addBytes(0x96, TIFF_UNDEFINED, &info[0], (uint32)info.size());
+  maker.setFirstIFD(md.write(maker));
+  static const uchar8 nikon_header[10] = {'N', 'i', 'k', 'o', 'n', 0, 2, 0x10, 0, 0};
+  vector<uchar8> makernote(nikon_header, nikon_header + 10);
+  makernote.insert(makernote.end(), maker.data.begin(), maker.data.end());
+
+  TiffDirectory exif;
+  exif.addBytes(MAKERNOTE, TIFF_UNDEFINED, &makernote[0], (uint32)makernote.size());
+  uint32 exifOffset = exif.write(t);
+
+  TiffDirectory d;
+  addImageTags(d, o, img.w, img.h, 34713, offset, (uint32)strip.size());
+  d.addLong(EXIFIFDPOINTER, exifOffset);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Pentax PEF: Huffman compression with the default table of PentaxDecompressor */
+static void writePef(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  static const uchar8 pentax_tree[] =  { 0, 2, 3, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0,
+                                         3, 4, 2, 5, 1, 6, 0, 7, 8, 9, 10, 11, 12
+                                       };
+  HuffmanEncoder huff;
+  huff.setTable(pentax_tree, &pentax_tree[16]);
+  vector<uchar8> strip;
+  encodeNikonStyle(img, huff, 0, strip);
+  uint32 offset = t.append(strip);
+
+  TiffDirectory d;
+  addImageTags(d, o, img.w, img.h, 65535, offset, (uint32)strip.size());
+  t.setFirstIFD(d.write(t));
+}
+
+/* Sony ARW2: each line is coded in blocks of 16 pixels of the same color, */
+/* as 11 bit max and min, their positions, and 7 bit steps for the rest. */
+static void writeArw(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  vector<uchar8> strip;
+  strip.reserve(img.pix.size());
+  for (uint32 y = 0; y < img.h; y++) {
+    ushort16* row = img.getRow(y);
+    BitWriterPlain bits(strip);
+    for (uint32 x = 0; x < img.w; x += 32) {
+      for (uint32 c = 0; c < 2; c++) {
+        ushort16* p = &row[x + c];
+        int imax = 0, imin = 0;
+        for (int i = 1; i < 16; i++) {
+          if (p[i*2] > p[imax*2]) imax = i;
+          if (p[i*2] < p[imin*2]) imin = i;
+        }
+        if (imax == imin)
+          imin = (imax + 1) & 15;
+        int _max = p[imax*2];
+        int _min = p[imin*2];
+        int sh;
+        for (sh = 0; sh < 4 && 0x80 << sh <= _max - _min; sh++);
+        bits.putBits(_max, 11);
+        bits.putBits(_min, 11);
+        bits.putBits(imax, 4);
+        bits.putBits(imin, 4);
+        for (int i = 0; i < 16; i++) {
+          int v;
+          if (i == imax) {
+            v = _max;
+          } else if (i == imin) {
+            v = _min;
+          } else {
+            int q = min((p[i*2] - _min + ((1 << sh) >> 1)) >> sh, 127);
+            bits.putBits(q, 7);
+            v = min((q << sh) + _min, 0x7ff);
+          }
+          p[i*2] = v << 1;    // The decoder delivers 12 bits, through an identity curve
+        }
+      }
+    }
+    bits.flush();
+  }
+  uint32 offset = t.append(strip);
+
+  GeneratorOptions o8 = o;
+  o8.bpp = 8;   // Marks ARW2, when the byte count is width * height
+  TiffDirectory d;
+  addImageTags(d, o8, img.w, img.h, 32767, offset, (uint32)strip.size());
+  ushort16 curve[4] = {16380, 16380, 16380, 16380};
+  d.addShorts(SONY_CURVE, curve, 4);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Olympus ORF: adaptive Golomb-like coding of the difference to a gradient predictor, */
+/* the inverse of OrfDecoder::decodeCompressed */
+static void writeOrf(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  vector<uchar8> strip(7, 0);
+  BitWriterMSB bits(strip);
+  int left[2] = {0, 0};
+  int nw[2] = {0, 0};
+  for (uint32 y = 0; y < img.h; y++) {
+    int acarry[2][3];
+    memset(acarry, 0, sizeof(acarry));
+    ushort16* row = img.getRow(y);
+    ushort16* up2 = y >= 2 ? img.getRow(y - 2) : NULL;
+    for (uint32 x = 0; x < img.w; x++) {
+      uint32 c = x & 1;
+      int pred;
+      if (y < 2 || x < 2) {
+        if (y < 2 && x < 2) {
+          pred = 0;
+        } else if (y < 2) {
+          pred = left[c];
+        } else {
+          pred = up2[x];
+          nw[c] = pred;
+        }
+      } else {
+        int up = up2[x];
+        int leftMinusNw = left[c] - nw[c];
+        int upMinusNw = up - nw[c];
+        if (leftMinusNw * upMinusNw < 0) {
+          if (other_abs(leftMinusNw) > 32 || other_abs(upMinusNw) > 32)
+            pred = left[c] + upMinusNw;
+          else
+            pred = (left[c] + up) >> 1;
+        } else {
+          pred = other_abs(leftMinusNw) > other_abs(upMinusNw) ? left[c] : up;
+        }
+        nw[c] = up;
+      }
+      left[c] = row[x];
+
+      int* a = acarry[c];
+      int i = 2 * (a[2] < 3);
+      int nbits;
+      for (nbits = 2 + i; (ushort16) a[0] >> (nbits + i); nbits++);
+
+      int r = row[x] - pred;
+      int diff = r >> 2;
+      int m = diff - a[1];
+      int sign = m < 0;
+      int a0 = sign ? ~m : m;
+      int high = a0 >> nbits;
+      bits.putBits(sign, 1);
+      bits.putBits(r & 3, 2);
+      if (high < 12) {
+        bits.putBits(1, high + 1);    // "high" zeros and a one
+      } else {
+        if (high >= 1 << (15 - nbits))
+          fail("ORF: difference too large to code");
+        bits.putBits(0, 12);
+        bits.putBits(high << 1, 16 - nbits);
+      }
+      bits.putBits(a0, nbits);
+      a[0] = a0;
+      a[1] = (diff * 3 + a[1]) >> 5;
+      a[2] = a0 > 16 ? 0 : a[2] + 1;
+    }
+  }
+  bits.flush();
+  uint32 count = (uint32)strip.size();
+  strip.resize(count + 4, 0);   // The decoder reads a few bytes ahead
+  uint32 offset = t.append(strip);
+
+  // The Olympus makernote has "OLYMPUS", and an IFD with tag 0x2010 for compressed images
+  vector<uchar8> makernote;
+  const char* header = "OLYMPUS";
+  makernote.insert(makernote.end(), header, header + 8);
+  makernote.push_back('I');
+  makernote.push_back('I');
+  putLE16(makernote, 3);
+  putLE16(makernote, 1);
+  putLE16(makernote, 0x2010);
+  putLE16(makernote, TIFF_LONG);
+  putLE32(makernote, 1);
+  putLE32(makernote, 0);
+  putLE32(makernote, 0);
+  TiffDirectory exif;
+  exif.addBytes(MAKERNOTE, TIFF_UNDEFINED, &makernote[0], (uint32)makernote.size());
+  uint32 exifOffset = exif.write(t);
+
+  TiffDirectory d;
+  addImageTags(d, o, img.w, img.h, 1, offset, count);
+  d.addLong(EXIFIFDPOINTER, exifOffset);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Panasonic RW2 predictor update, as in Rw2Decoder::decodeThreaded */
+static void rw2Update(int& pred, int j, int sh) {
+  if (j) {
+    if ((pred -= 0x80 << sh) < 0 || sh == 4)
+      pred &= (1 << sh) - 1;
+    pred += j << sh;
+  }
+}
+
+/* The step that gets closest to v, 0 if keeping pred is better */
+static int rw2Step(int pred, int v, int sh) {
+  int base = pred - (0x80 << sh);
+  if (base < 0 || sh == 4)
+    base &= (1 << sh) - 1;
+  int j = v > base ? (v - base + ((1 << sh) >> 1)) >> sh : 1;
+  j = min(max(j, 1), 255);
+  int p = base + (j << sh);
+  return other_abs(p - v) < other_abs(pred - v) ? j : 0;
+}
+
+/* Panasonic RW2: blocks of 14 pixels, each coded in 128 bits. */
+/* The first pixel of each color is coded with 12 bits, the rest as 8 bit steps, */
+/* with a shift chosen for every 3 pixels. */
+static void writeRw2(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  const uint32 blockSize = 0x4000;
+  const uint32 loadFlags = 0x2008;
+  uint32 units = img.w / 14 * img.h;
+  vector<uchar8> buf;
+  buf.reserve((units * 16 + blockSize - 1) / blockSize * blockSize);
+  vector<uchar8> unit;
+  for (uint32 y = 0; y < img.h; y++) {
+    ushort16* row = img.getRow(y);
+    for (uint32 x = 0; x < img.w; x += 14) {
+      ushort16* p = &row[x];
+      unit.clear();
+      BitWriterMSB bits(unit);
+      int pred[2];
+      int sh = 0;
+      for (int i = 0; i < 14; i++) {
+        int c = i & 1;
+        if (i < 2) {
+          // Must be at least 16, or the decoder reads a different number of bits
+          pred[c] = min(max((int)p[i], 16), 4095);
+          bits.putBits(pred[c] >> 4, 8);
+          bits.putBits(pred[c] & 15, 4);
+          p[i] = pred[c];
+          continue;
+        }
+        if (i == 2 || i == 5 || i == 8 || i == 11) {
+          // Pick the shift with least error for the next 3 pixels
+          int best = 0, bestErr = 0;
+          for (int s = 0; s < 4; s++) {
+            int tsh = 4 >> (3 - s);
+            int tp[2] = {pred[0], pred[1]};
+            int err = 0;
+            for (int k = i; k < i + 3; k++) {
+              rw2Update(tp[k&1], rw2Step(tp[k&1], p[k], tsh), tsh);
+              err += other_abs(tp[k&1] - p[k]);
+            }
+            if (s == 0 || err < bestErr) {
+              best = s;
+              bestErr = err;
+            }
+          }
+          bits.putBits(best, 2);
+          sh = 4 >> (3 - best);
+        }
+        int j = rw2Step(pred[c], p[i], sh);
+        bits.putBits(j, 8);
+        rw2Update(pred[c], j, sh);
+        p[i] = pred[c];
+      }
+      // The decoder reads from the most significant end of a 128 bit little endian number
+      for (int i = 15; i >= 0; i--)
+        buf.push_back(unit[i]);
+    }
+  }
+  buf.resize((buf.size() + blockSize - 1) / blockSize * blockSize, 0);
+
+  // Each block is stored rotated by loadFlags bytes
+  vector<uchar8> strip;
+  strip.reserve(buf.size());
+  for (uint32 b = 0; b < buf.size(); b += blockSize) {
+    strip.insert(strip.end(), buf.begin() + b + loadFlags, buf.begin() + b + blockSize);
+    strip.insert(strip.end(), buf.begin() + b, buf.begin() + b + loadFlags);
+  }
+  uint32 offset = t.append(strip);
+
+  TiffDirectory d;
+  d.addAscii(MAKE, o.make);
+  d.addAscii(MODEL, o.model);
+  d.addShort(2, img.w);
+  d.addShort(3, img.h);
+  d.addLong(PANASONIC_STRIPOFFSET, offset);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Number of bits for a signed value */
+static uint32 signedBits(int v) {
+  uint32 b = 1;
+  while (v < -(1 << (b - 1)) || v >= (1 << (b - 1)))
+    b++;
+  return b;
+}
+
+/* Samsung SRW (compression 32770): groups of 16 pixels, predicted from the left */
+/* or from above, with adaptive bit lengths for each half of each color. */
+/* Each line starts at an offset given by a table. */
+static void writeSrw(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  vector<uchar8> strip;
+  vector<uchar8> lineOffsets;
+  for (uint32 y = 0; y < img.h; y++) {
+    putLE32(lineOffsets, (uint32)strip.size());
+    BitWriterMSB32 bits(strip);
+    int len[4];
+    for (int i = 0; i < 4; i++)
+      len[i] = y < 2 ? 7 : 4;
+    ushort16* row = img.getRow(y);
+    ushort16* up = y >= 2 ? img.getRow(y - 1) : NULL;
+    ushort16* up2 = y >= 2 ? img.getRow(y - 2) : NULL;
+    for (uint32 x = 0; x < img.w; x += 16) {
+      int left[16], upward[16];
+      uint32 needLeft[4] = {1, 1, 1, 1};
+      uint32 needUp[4] = {1, 1, 1, 1};
+      int predEven = x ? row[x-2] : 128;
+      int predOdd = x ? row[x-1] : 128;
+      for (int c = 0; c < 16; c++) {
+        int q = (c & 1) * 2 + (c >> 3);
+        left[c] = row[x+c] - ((c & 1) ? predOdd : predEven);
+        needLeft[q] = max(needLeft[q], signedBits(left[c]));
+        // Even pixels are predicted from the line above, odd from two lines above.
+        if (up) {
+          upward[c] = row[x+c] - ((c & 1) ? up2[x+c] : up[x+c]);
+          needUp[q] = max(needUp[q], signedBits(upward[c]));
+        }
+      }
+      bool dir = false;
+      if (up) {
+        uint32 costLeft = 0, costUp = 0;
+        for (int i = 0; i < 4; i++) {
+          costLeft += needLeft[i];
+          costUp += needUp[i];
+        }
+        dir = costUp < costLeft;
+      }
+      const int* r = dir ? upward : left;
+      const uint32* need = dir ? needUp : needLeft;
+
+      bits.putBits(dir, 1);
+      int op[4];
+      for (int i = 0; i < 4; i++) {
+        if (need[i] > 15)
+          fail("SRW: difference too large to code");
+        if ((int)need[i] == len[i])
+          op[i] = 0;
+        else if ((int)need[i] == len[i] + 1)
+          op[i] = 1;
+        else if ((int)need[i] == len[i] - 1)
+          op[i] = 2;
+        else
+          op[i] = 3;
+        bits.putBits(op[i], 2);
+        len[i] = need[i];
+      }
+      for (int i = 0; i < 4; i++) {
+        if (op[i] == 3)
+          bits.putBits(len[i], 4);
+      }
+      for (int c = 0; c < 16; c += 2)
+        bits.putBits(r[c], len[c >> 3]);
+      for (int c = 1; c < 16; c += 2)
+        bits.putBits(r[c], len[2 | (c >> 3)]);
+    }
+    bits.flush();
+  }
+  uint32 offset = t.append(strip);
+  uint32 tableOffset = t.append(lineOffsets);
+
+  TiffDirectory d;
+  addImageTags(d, o, img.w, img.h, 32770, offset, (uint32)strip.size());
+  d.addLong(40976, tableOffset);
+  t.setFirstIFD(d.write(t));
+}
+
+/* Tags common to all DNG images. The data layout tags are added by the caller. */
+static void addDngTags(TiffDirectory& d, const GeneratorOptions& o, uint32 w, uint32 h, uint32 compression) {
+  static const uchar8 version[4] = {1, 4, 0, 0};
+  static const uchar8 backward[4] = {1, 1, 0, 0};
+  d.addBytes(DNGVERSION, TIFF_BYTE, version, 4);
+  d.addBytes(DNGBACKWARDVERSION, TIFF_BYTE, backward, 4);
+  d.addAscii(UNIQUECAMERAMODEL, o.make + " " + o.model);
+  d.addAscii(MAKE, o.make);
+  d.addAscii(MODEL, o.model);
+  d.addLong(NEWSUBFILETYPE, 0);
+  d.addLong(IMAGEWIDTH, w);
+  d.addLong(IMAGELENGTH, h);
+  d.addShort(COMPRESSION, compression);
+  d.addLong(WHITELEVEL, (1 << o.bpp) - 1);
+}
+
+/* DNG, CFA image as lossless JPEG tiles, each with 2 components of half the tile width */
+static void writeDngTiles(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  uint32 ts = o.tileSize & ~1;
+  uint32 tilesX = (img.w + ts - 1) / ts;
+  uint32 tilesY = (img.h + ts - 1) / ts;
+  vector<uint32> offsets, counts;
+  vector<ushort16> tile(ts * ts);
+  for (uint32 ty = 0; ty < tilesY; ty++) {
+    for (uint32 tx = 0; tx < tilesX; tx++) {
+      // Tiles on the right and bottom edge are filled up with the last pixels
+      for (uint32 y = 0; y < ts; y++) {
+        ushort16* row = img.getRow(min(ty * ts + y, img.h - 1));
+        for (uint32 x = 0; x < ts; x++)
+          tile[y * ts + x] = row[min(tx * ts + x, img.w - 1)];
+      }
+      vector<uchar8> jpeg;
+      encodeLJpeg(jpeg, &tile[0], ts / 2, ts, 2, o.bpp, o.restartRows);
+      offsets.push_back(t.append(jpeg));
+      counts.push_back((uint32)jpeg.size());
+    }
+  }
+  TiffDirectory d;
+  addDngTags(d, o, img.w, img.h, 7);
+  d.addShort(BITSPERSAMPLE, o.bpp);
+  d.addShort(PHOTOMETRICINTERPRETATION, 32803);
+  d.addShort(SAMPLESPERPIXEL, 1);
+  d.addShorts(CFAREPEATPATTERNDIM, cfa_dim, 2);
+  d.addBytes(CFAPATTERN, TIFF_BYTE, cfa_rggb, 4);
+  d.addLong(TILEWIDTH, ts);
+  d.addLong(TILELENGTH, ts);
+  d.addLongs(TILEOFFSETS, &offsets[0], (uint32)offsets.size());
+  d.addLongs(TILEBYTECOUNTS, &counts[0], (uint32)counts.size());
+  t.setFirstIFD(d.write(t));
+}
+
+/* DNG, CFA image as lossless JPEG strips of tileSize lines */
+static void writeDngStrips(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  uint32 rows = min(o.tileSize, img.h);
+  vector<uint32> offsets, counts;
+  for (uint32 y = 0; y < img.h; y += rows) {
+    vector<uchar8> jpeg;
+    encodeLJpeg(jpeg, img.getRow(y), img.w / 2, min(rows, img.h - y), 2, o.bpp, o.restartRows);
+    offsets.push_back(t.append(jpeg));
+    counts.push_back((uint32)jpeg.size());
+  }
+  TiffDirectory d;
+  addDngTags(d, o, img.w, img.h, 7);
+  d.addShort(BITSPERSAMPLE, o.bpp);
+  d.addShort(PHOTOMETRICINTERPRETATION, 32803);
+  d.addShort(SAMPLESPERPIXEL, 1);
+  d.addShorts(CFAREPEATPATTERNDIM, cfa_dim, 2);
+  d.addBytes(CFAPATTERN, TIFF_BYTE, cfa_rggb, 4);
+  d.addLong(ROWSPERSTRIP, rows);
+  d.addLongs(STRIPOFFSETS, &offsets[0], (uint32)offsets.size());
+  d.addLongs(STRIPBYTECOUNTS, &counts[0], (uint32)counts.size());
+  t.setFirstIFD(d.write(t));
+}
+
+/* libjpeg destination, writing to a vector */
+struct VectorDestination {
+  struct jpeg_destination_mgr pub;
+  vector<uchar8>* out;
+  uchar8 buffer[4096];
+};
+
+static void vector_init_destination(j_compress_ptr cinfo) {
+  VectorDestination* dest = (VectorDestination*)cinfo->dest;
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = sizeof(dest->buffer);
+}
+
+static boolean vector_empty_output_buffer(j_compress_ptr cinfo) {
+  VectorDestination* dest = (VectorDestination*)cinfo->dest;
+  dest->out->insert(dest->out->end(), dest->buffer, dest->buffer + sizeof(dest->buffer));
+  vector_init_destination(cinfo);
+  return TRUE;
+}
+
+static void vector_term_destination(j_compress_ptr cinfo) {
+  VectorDestination* dest = (VectorDestination*)cinfo->dest;
+  dest->out->insert(dest->out->end(), dest->buffer, dest->buffer + sizeof(dest->buffer) - dest->pub.free_in_buffer);
+}
+
+/* DNG with lossy JPEG tiles (compression 0x884c), 8 bit RGB LinearRaw */
+static void writeDngLossy(const GeneratorOptions& o, Image& img, TiffWriter& t) {
+  uint32 w = img.w / 3;
+  uint32 ts = o.tileSize;
+  uint32 tilesX = (w + ts - 1) / ts;
+  uint32 tilesY = (img.h + ts - 1) / ts;
+  vector<uint32> offsets, counts;
+  vector<uchar8> line;
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  VectorDestination dest;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  dest.pub.init_destination = vector_init_destination;
+  dest.pub.empty_output_buffer = vector_empty_output_buffer;
+  dest.pub.term_destination = vector_term_destination;
+  cinfo.dest = &dest.pub;
+
+  for (uint32 ty = 0; ty < tilesY; ty++) {
+    for (uint32 tx = 0; tx < tilesX; tx++) {
+      // Tiles on the edges only contain the image part, the decoder allows that
+      uint32 tw = min(ts, w - tx * ts);
+      uint32 th = min(ts, img.h - ty * ts);
+      vector<uchar8> jpeg;
+      dest.out = &jpeg;
+      cinfo.image_width = tw;
+      cinfo.image_height = th;
+      cinfo.input_components = 3;
+      cinfo.in_color_space = JCS_RGB;
+      jpeg_set_defaults(&cinfo);
+      // Keep the components as they are, like DNG expects
+      jpeg_set_colorspace(&cinfo, JCS_RGB);
+      jpeg_set_quality(&cinfo, o.quality, TRUE);
+      jpeg_start_compress(&cinfo, TRUE);
+      line.resize(tw * 3);
+      for (uint32 y = 0; y < th; y++) {
+        ushort16* row = img.getRow(ty * ts + y) + tx * ts * 3;
+        for (uint32 x = 0; x < tw * 3; x++)
+          line[x] = (uchar8)row[x];
+        JSAMPROW r = &line[0];
+        jpeg_write_scanlines(&cinfo, &r, 1);
+      }
+      jpeg_finish_compress(&cinfo);
+      offsets.push_back(t.append(jpeg));
+      counts.push_back((uint32)jpeg.size());
+    }
+  }
+  jpeg_destroy_compress(&cinfo);
+
+  TiffDirectory d;
+  addDngTags(d, o, w, img.h, 0x884c);
+  ushort16 bps[3] = {8, 8, 8};
+  d.addShorts(BITSPERSAMPLE, bps, 3);
+  d.addShort(PHOTOMETRICINTERPRETATION, 34892);
+  d.addShort(SAMPLESPERPIXEL, 3);
+  d.addLong(TILEWIDTH, ts);
+  d.addLong(TILELENGTH, ts);
+  d.addLongs(TILEOFFSETS, &offsets[0], (uint32)offsets.size());
+  d.addLongs(TILEBYTECOUNTS, &counts[0], (uint32)counts.size());
+  t.setFirstIFD(d.write(t));
+}
+
+typedef void (*FormatWriter)(const GeneratorOptions& o, Image& img, TiffWriter& t);
+
+struct RawFormat {
+  const char* name;
+  const char* extension;
+  const char* make;
+  const char* model;
+  ushort16 magic;        // TIFF magic number
+  uint32 widthMultiple;  // The width must be a multiple of this
+  uint32 minBpp;
+  uint32 maxBpp;
+  uint32 defaultBpp;
+  uint32 components;     // Samples per pixel
+  bool lossless;         // The decoded image must match exactly
+  FormatWriter writer;
+  const char* description;
+};
+
+static const RawFormat formats[] = {
+  {"cr2", "cr2", "Canon", "Canon EOS 5D Mark III", 42, 2, 8, 16, 14, 1, true, writeCr2, "Canon lossless JPEG, sliced"},
+  {"nef", "nef", "NIKON CORPORATION", "NIKON D7000", 42, 2, 12, 14, 14, 1, true, writeNef, "Nikon lossless Huffman"},
+  {"arw", "arw", "SONY", "NEX-7", 42, 32, 11, 11, 11, 1, true, writeArw, "Sony ARW2"},
+  {"orf", "orf", "OLYMPUS IMAGING CORP.", "E-M5", 0x4f52, 2, 12, 12, 12, 1, true, writeOrf, "Olympus compressed"},
+  {"rw2", "rw2", "Panasonic", "DMC-GH1", 0x55, 14, 12, 12, 12, 1, true, writeRw2, "Panasonic compressed"},
+  {"srw", "srw", "SAMSUNG", "NX300", 42, 16, 12, 14, 12, 1, true, writeSrw, "Samsung compression 32770"},
+  {"pef", "pef", "PENTAX", "PENTAX K-5", 42, 2, 12, 12, 12, 1, true, writePef, "Pentax Huffman"},
+  {"dng", "dng", "RawSpeed", "Synthetic DNG", 42, 2, 8, 16, 12, 1, true, writeDngTiles, "DNG lossless JPEG tiles"},
+  {"dng-strips", "dng", "RawSpeed", "Synthetic DNG", 42, 2, 8, 16, 12, 1, true, writeDngStrips, "DNG lossless JPEG strips"},
+  {"dng-lossy", "dng", "RawSpeed", "Synthetic DNG", 42, 1, 8, 8, 8, 3, false, writeDngLossy, "DNG lossy JPEG tiles, RGB"},
+};
+
+static const int nformats = sizeof(formats) / sizeof(formats[0]);
+
+/*** Verification ***/
+
+/* Decodes the file, and compares it to the expected image. Returns true if it matches. */
+static bool verify(const RawFormat& f, const vector<uchar8>& file, Image& expected) {
+  FileMap map(&file[0], (uint64)file.size());
+  RawParser parser(&map);
+  RawDecoder* decoder = NULL;
+  bool ok = false;
+  try {
+    decoder = parser.getDecoder();
+    decoder->decodeRaw();
+    RawImage raw = decoder->mRaw;
+    if (!raw->errors.empty()) {
+      printf("  Decoder reported: %s\n", raw->errors[0]);
+    } else if ((uint32)raw->dim.x * raw->getCpp() != expected.w || (uint32)raw->dim.y != expected.h) {
+      printf("  Size mismatch: decoded %dx%d\n", raw->dim.x, raw->dim.y);
+    } else {
+      uint64 errors = 0;
+      uint64 totalError = 0;
+      int maxError = 0;
+      int firstX = -1, firstY = -1;
+      for (uint32 y = 0; y < expected.h; y++) {
+        ushort16* src = (ushort16*)raw->getData(0, y);
+        ushort16* exp = expected.getRow(y);
+        for (uint32 x = 0; x < expected.w; x++) {
+          int e = other_abs((int)src[x] - (int)exp[x]);
+          if (e) {
+            if (!errors) {
+              firstX = x;
+              firstY = y;
+            }
+            errors++;
+            totalError += e;
+            maxError = max(maxError, e);
+          }
+        }
+      }
+      if (f.lossless) {
+        ok = errors == 0;
+        if (!ok)
+          printf("  %llu samples differ, first at %d,%d, max error %d\n", (unsigned long long)errors, firstX, firstY, maxError);
+      } else {
+        double mean = (double)totalError / expected.pix.size();
+        printf("  Lossy: mean error %.3f, max error %d\n", mean, maxError);
+        ok = true;
+      }
+    }
+  } catch (RawDecoderException &e) {
+    printf("  Decoder error: %s\n", e.what());
+  } catch (TiffParserException &e) {
+    printf("  TIFF error: %s\n", e.what());
+  } catch (IOException &e) {
+    printf("  IO error: %s\n", e.what());
+  }
+  if (decoder)
+    delete decoder;
+  return ok;
+}
+
+/*** Main ***/
+
+static void usage() {
+  printf("Usage: RawGenerator [options]\n");
+  printf("  -f format   Format to write, or \"all\" (default)\n");
+  printf("  -o file     Output file. With -f all the format name and extension are appended\n");
+  printf("              (default \"synthetic\")\n");
+  printf("  -x width    Image width (default 4000)\n");
+  printf("  -y height   Image height (default 3000)\n");
+  printf("  -b bits     Bits per sample (default depends on format)\n");
+  printf("  -e bits     Bits of noise added to the content, 0-16 (default 6)\n");
+  printf("              More noise gives more entropy, and slower decoding\n");
+  printf("  -s seed     Seed for the content (default 1)\n");
+  printf("  -m model    Camera model to write, instead of the default for the format\n");
+  printf("  -t size     DNG tile size, or lines per strip (default 256)\n");
+  printf("  -q quality  JPEG quality for lossy DNG (default 90)\n");
+  printf("  -r rows     Lossless JPEG restart interval in rows, 0 for none (default 0)\n");
+  printf("  -V          Decode the written files, and compare with the expected image\n");
+  printf("Formats:\n");
+  for (int i = 0; i < nformats; i++)
+    printf("  %-12s %s, %u-%u bits (default %u)\n", formats[i].name, formats[i].description,
+           formats[i].minBpp, formats[i].maxBpp, formats[i].defaultBpp);
+  exit(1);
+}
+
+int main(int argc, char* argv[]) {
+  string format = "all";
+  string output = "synthetic";
+  string model;
+  uint32 width = 4000, height = 3000, bpp = 0, noise = 6, seed = 1, tileSize = 256, quality = 90, restartRows = 0;
+  bool doVerify = false;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool hasArg = i + 1 < argc;
+    if (a == "-f" && hasArg) format = argv[++i];
+    else if (a == "-o" && hasArg) output = argv[++i];
+    else if (a == "-x" && hasArg) width = atoi(argv[++i]);
+    else if (a == "-y" && hasArg) height = atoi(argv[++i]);
+    else if (a == "-b" && hasArg) bpp = atoi(argv[++i]);
+    else if (a == "-e" && hasArg) noise = atoi(argv[++i]);
+    else if (a == "-s" && hasArg) seed = atoi(argv[++i]);
+    else if (a == "-m" && hasArg) model = argv[++i];
+    else if (a == "-t" && hasArg) tileSize = atoi(argv[++i]);
+    else if (a == "-q" && hasArg) quality = atoi(argv[++i]);
+    else if (a == "-r" && hasArg) restartRows = atoi(argv[++i]);
+    else if (a == "-V") doVerify = true;
+    else usage();
+  }
+  if (noise > 16 || tileSize < 16 || tileSize > 65535 || quality < 1 || quality > 100)
+    usage();
+
+  bool all = format == "all";
+  int failed = 0;
+  int written = 0;
+  for (int i = 0; i < nformats; i++) {
+    const RawFormat& f = formats[i];
+    if (!all && format != f.name)
+      continue;
+    written++;
+
+    GeneratorOptions o;
+    o.width = width - width % f.widthMultiple;
+    o.height = height & ~1;
+    if (o.width < 32 || o.height < 4)
+      fail("Image size too small for %s", f.name);
+    o.bpp = bpp ? bpp : f.defaultBpp;
+    if (o.bpp < f.minBpp || o.bpp > f.maxBpp || (!strcmp(f.name, "nef") && o.bpp == 13)) {
+      uint32 clamped = o.bpp < f.minBpp ? f.minBpp : f.maxBpp;
+      printf("%s: %u bits not supported, using %u\n", f.name, o.bpp, clamped);
+      o.bpp = clamped;
+    }
+    o.noiseBits = min(noise, o.bpp);
+    o.seed = seed;
+    o.tileSize = tileSize;
+    o.quality = quality;
+    o.restartRows = restartRows;
+    o.make = f.make;
+    o.model = model.empty() ? f.model : model;
+
+    Image img(o.width * f.components, o.height);
+    generateContent(img, o.bpp, o.noiseBits, seed);
+    TiffWriter t(f.magic);
+    f.writer(o, img, t);
+
+    string filename = all ? output + "-" + f.name + "." + f.extension : output;
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+      fail("Could not open %s for writing", filename.c_str());
+    if (fwrite(&t.data[0], 1, t.data.size(), file) != t.data.size())
+      fail("Could not write %s", filename.c_str());
+    fclose(file);
+    printf("%s: %ux%u, %u bits, %.2f bits/pixel\n", filename.c_str(), o.width, o.height, o.bpp,
+           t.data.size() * 8.0 / ((double)o.width * o.height));
+    fflush(stdout);
+
+    if (doVerify) {
+      bool ok = verify(f, t.data, img);
+      printf("  Verify %s\n", ok ? "OK" : "FAILED");
+      if (!ok)
+        failed++;
+    }
+  }
+  if (!written)
+    usage();
+  ThreadPool::shutdown();
+  return failed ? 1 : 0;
+}
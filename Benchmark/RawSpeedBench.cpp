@@ -0,0 +1,615 @@
+#include "StdAfx.h"
+#include "FileReader.h"
+#include "RawParser.h"
+#include "RawDecoder.h"
+#include "CameraMetaData.h"
+#include "ThreadPool.h"
+#include "HuffmanTableCache.h"
+#include "NikonDecompressor.h"
+#include <algorithm>
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+/*
+  Decode benchmark.
+
+  Decodes a set of files a number of times, optionally with a cold
+  file cache and at several thread counts, and reports decode speed,
+  latency percentiles and peak memory use. Results can be written as
+  JSON, so runs of different versions can be compared.
+
+  Build by compiling this file together with all files in RawSpeed/
+  except RawSpeed.cpp, with RawSpeed/ on the include path, and link
+  with pthreads, libxml2 and libjpeg. For instance:
+
+    g++ -O2 -IRawSpeed -I/usr/include/libxml2 Benchmark/RawSpeedBench.cpp \
+        `ls RawSpeed/[A-Z]*.cpp | grep -v RawSpeed.cpp` -lpthread -lxml2 -ljpeg
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+using namespace RawSpeed;
+
+int rawspeed_get_number_of_processor_cores() {
+#if defined(__unix__) || defined(__APPLE__)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#else
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#endif
+}
+
+/* Wall clock time in seconds */
+static double getWallTime() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#else
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart / (double)freq.QuadPart;
+#endif
+}
+
+/* CPU time used by all threads of the process, in seconds */
+static double getCpuTime() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec * 1e-6 +
+         (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec * 1e-6;
+#else
+  FILETIME creation, exited, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user);
+  uint64 k = ((uint64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+  uint64 u = ((uint64)user.dwHighDateTime << 32) | user.dwLowDateTime;
+  return (double)(k + u) * 1e-7;
+#endif
+}
+
+/* Peak resident memory of the process in kilobytes */
+static uint64 getPeakRSS() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (uint64)usage.ru_maxrss / 1024;  // Bytes on OS X
+#else
+  return (uint64)usage.ru_maxrss;
+#endif
+#else
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return (uint64)pmc.PeakWorkingSetSize / 1024;
+#endif
+}
+
+/* Remove the file from the OS file cache, so the next read is from disk. */
+/* Returns false if not supported. */
+static bool dropFileCache(const string& filename) {
+#if defined(__unix__) && defined(POSIX_FADV_DONTNEED)
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  fdatasync(fd);
+  bool ok = (0 == posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+  close(fd);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+/* Adds all regular files in "dir" to "files", sorted by name */
+static bool listDirectory(const string& dir, vector<string>& files) {
+  vector<string> found;
+#if defined(__unix__) || defined(__APPLE__)
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return false;
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.')
+      continue;
+    string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (0 == stat(path.c_str(), &st) && S_ISREG(st.st_mode))
+      found.push_back(path);
+  }
+  closedir(d);
+#else
+  WIN32_FIND_DATAA fd;
+  HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    return false;
+  do {
+    if (fd.cFileName[0] == '.' || (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+      continue;
+    found.push_back(dir + "\\" + fd.cFileName);
+  } while (FindNextFileA(h, &fd));
+  FindClose(h);
+#endif
+  sort(found.begin(), found.end());
+  files.insert(files.end(), found.begin(), found.end());
+  return true;
+}
+
+static bool isDirectory(const string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+  struct stat st;
+  return 0 == stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+#else
+  DWORD attr = GetFileAttributesA(path.c_str());
+  return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#endif
+}
+
+/* Result of a single decode */
+class DecodeResult
+{
+public:
+  DecodeResult() : ok(false), readTime(0), decodeTime(0), cpuTime(0), pixels(0), width(0), height(0), cpp(0), fileSize(0), warnings(0), hasStats(false) {};
+  bool ok;
+  string error;
+  double readTime;    // Reading/mapping the file and parsing the container
+  double decodeTime;  // decodeRaw(), decodeMetaData() and scaleBlackWhite()
+  double cpuTime;     // CPU time of all threads during decodeTime
+  uint64 pixels;      // Pixels * components
+  int width, height, cpp;
+  uint64 fileSize;
+  uint32 warnings;    // Errors reported in RawImageData::errors
+  bool hasStats;
+  DecoderStats stats; // Per stage timing, with -s
+};
+
+class BenchOptions
+{
+public:
+  BenchOptions() : runs(5), cold(false), lazy(false), mmap(true), verbose(true), stats(false) {};
+  int runs;
+  bool cold;
+  bool lazy;
+  bool mmap;
+  bool verbose;
+  bool stats;
+  vector<uint32> threads;
+  string cameras;
+  string jsonFile;
+  map<string,string> hints;   // Added to all cameras
+};
+
+static DecodeResult decodeFile(const string& filename, CameraMetaData *meta, const BenchOptions& opt, bool collectStats = false) {
+  DecodeResult r;
+  RawDecoder *d = 0;
+  FileMap* m = 0;
+#if defined(__unix__) || defined(__APPLE__)
+  FileReader f((LPCWSTR)filename.c_str());
+#else
+  wchar_t wname[1024];
+  MultiByteToWideChar(CP_ACP, 0, filename.c_str(), -1, wname, 1024);
+  FileReader f(wname);
+#endif
+  f.useMemoryMap = opt.mmap;
+  try {
+    double start = getWallTime();
+    m = opt.lazy ? f.readFileLazy() : f.readFile();
+    r.fileSize = m->getSize();
+    RawParser t(m);
+    d = t.getDecoder();
+    if (collectStats)
+      d->enableStats();
+    d->checkSupport(meta);
+    double decodeStart = getWallTime();
+    double cpuStart = getCpuTime();
+    r.readTime = decodeStart - start;
+
+    d->decodeRaw();
+    d->decodeMetaData(meta);
+    RawImage raw = d->mRaw;
+    raw->scaleBlackWhite();
+
+    r.decodeTime = getWallTime() - decodeStart;
+    r.cpuTime = getCpuTime() - cpuStart;
+    r.width = raw->dim.x;
+    r.height = raw->dim.y;
+    r.cpp = raw->getCpp();
+    r.pixels = (uint64)r.width * r.height * r.cpp;
+    r.warnings = (uint32)raw->errors.size();
+    if (collectStats) {
+      r.stats = d->getStats()->getStats();
+      r.hasStats = true;
+    }
+    r.ok = true;
+  } catch (FileIOException &e) {
+    r.error = e.what();
+  } catch (RawDecoderException &e) {
+    r.error = e.what();
+  } catch (CameraMetadataException &e) {
+    r.error = e.what();
+  }
+  if (d) delete d;
+  if (m) delete m;
+  return r;
+}
+
+/* Percentile p (0-100) of sorted values, with linear interpolation */
+static double percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  double pos = p / 100.0 * (sorted.size() - 1);
+  uint32 i = (uint32)pos;
+  if (i + 1 >= sorted.size())
+    return sorted.back();
+  double frac = pos - i;
+  return sorted[i] * (1.0 - frac) + sorted[i+1] * frac;
+}
+
+/* Summary of a set of decode times */
+class TimeStats
+{
+public:
+  TimeStats() : count(0), pixels(0), total(0), cpu(0), fastest(0), slowest(0), mean(0), p50(0), p90(0), p99(0) {};
+  void calculate(vector<double> times) {
+    count = (uint32)times.size();
+    if (!count)
+      return;
+    sort(times.begin(), times.end());
+    total = 0;
+    for (uint32 i = 0; i < count; i++)
+      total += times[i];
+    fastest = times.front();
+    slowest = times.back();
+    mean = total / count;
+    p50 = percentile(times, 50);
+    p90 = percentile(times, 90);
+    p99 = percentile(times, 99);
+  }
+  double getMpps() const { return total > 0 ? (double)pixels / total * 1e-6 : 0; }
+  uint32 count;
+  uint64 pixels;   // Total pixels decoded
+  double total, cpu, fastest, slowest, mean, p50, p90, p99;
+};
+
+class FileResult
+{
+public:
+  string filename;
+  DecodeResult first;    // First (or cold) decode
+  bool coldCache;        // First decode was done with a dropped file cache
+  TimeStats warm;
+};
+
+class ThreadResult
+{
+public:
+  uint32 threads;
+  vector<FileResult> files;
+  TimeStats aggregate;   // All warm decodes of all files
+  uint32 failed;
+};
+
+static string jsonEscape(const string& s) {
+  string out;
+  for (uint32 i = 0; i < s.size(); i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      sprintf(buf, "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+static void writeTimeStats(FILE* f, const TimeStats& s, const char* indent) {
+  fprintf(f, "%s\"runs\": %u,\n", indent, s.count);
+  fprintf(f, "%s\"mpixel_per_s\": %.3f,\n", indent, s.getMpps());
+  fprintf(f, "%s\"cpu_s\": %.6f,\n", indent, s.cpu);
+  fprintf(f, "%s\"latency_ms\": {\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}\n",
+          indent, s.fastest * 1e3, s.mean * 1e3, s.p50 * 1e3, s.p90 * 1e3, s.p99 * 1e3, s.slowest * 1e3);
+}
+
+/* Writes the per stage timing of a decode, as "stages", "counters" and "threads" */
+static void writeDecoderStats(FILE* f, const DecoderStats& s, const char* indent) {
+  fprintf(f, "%s\"stages\": {", indent);
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    const DecoderTiming& t = s.stages[i];
+    fprintf(f, "%s\"%s\": {\"count\": %u, \"wall_ms\": %.3f, \"cpu_ms\": %.3f}", i ? ", " : "",
+            DecoderStats::getStageName((DecoderStage)i), t.count, t.wallTime * 1e3, t.cpuTime * 1e3);
+  }
+  fprintf(f, "},\n%s\"counters\": {", indent);
+  for (int i = 0; i < COUNTER_COUNT; i++)
+    fprintf(f, "%s\"%s\": %llu", i ? ", " : "", DecoderStats::getCounterName((DecoderCounter)i), (unsigned long long)s.counters[i]);
+  fprintf(f, "},\n%s\"threads\": [", indent);
+  for (uint32 i = 0; i < s.threads.size(); i++) {
+    const DecoderTiming& t = s.threads[i];
+    fprintf(f, "%s{\"jobs\": %u, \"wall_ms\": %.3f, \"cpu_ms\": %.3f}", i ? ", " : "", t.count, t.wallTime * 1e3, t.cpuTime * 1e3);
+  }
+  fprintf(f, "],\n");
+}
+
+static void printDecoderStats(const DecoderStats& s) {
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    const DecoderTiming& t = s.stages[i];
+    if (t.count)
+      fprintf(stderr, "  %-18s %8.2f ms wall, %8.2f ms cpu\n", DecoderStats::getStageName((DecoderStage)i), t.wallTime * 1e3, t.cpuTime * 1e3);
+  }
+  for (uint32 i = 0; i < s.threads.size(); i++) {
+    const DecoderTiming& t = s.threads[i];
+    if (t.count)
+      fprintf(stderr, "  thread %-11u %8.2f ms wall, %8.2f ms cpu, %u jobs\n", i, t.wallTime * 1e3, t.cpuTime * 1e3, t.count);
+  }
+  fprintf(stderr, "  %llu bytes, %llu slices, %llu tiles, %llu errors\n", (unsigned long long)s.counters[COUNTER_BYTES],
+          (unsigned long long)s.counters[COUNTER_SLICES], (unsigned long long)s.counters[COUNTER_TILES],
+          (unsigned long long)s.counters[COUNTER_ERRORS]);
+}
+
+static void writeJSON(FILE* f, const BenchOptions& opt, const vector<ThreadResult>& results) {
+  fprintf(f, "{\n");
+  fprintf(f, "  \"format_version\": 1,\n");
+  fprintf(f, "  \"cores\": %d,\n", rawspeed_get_number_of_processor_cores());
+  fprintf(f, "  \"runs_per_file\": %d,\n", opt.runs);
+  fprintf(f, "  \"read_mode\": \"%s\",\n", opt.lazy ? "lazy" : (opt.mmap ? "mmap" : "read"));
+  fprintf(f, "  \"hints\": {");
+  for (map<string,string>::const_iterator h = opt.hints.begin(); h != opt.hints.end(); h++)
+    fprintf(f, "%s\"%s\": \"%s\"", h == opt.hints.begin() ? "" : ", ", jsonEscape(h->first).c_str(), jsonEscape(h->second).c_str());
+  fprintf(f, "},\n");
+  fprintf(f, "  \"peak_rss_kb\": %llu,\n", (unsigned long long)getPeakRSS());
+  fprintf(f, "  \"results\": [\n");
+  for (uint32 t = 0; t < results.size(); t++) {
+    const ThreadResult& tr = results[t];
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"threads\": %u,\n", tr.threads);
+    fprintf(f, "      \"failed\": %u,\n", tr.failed);
+    fprintf(f, "      \"aggregate\": {\n");
+    writeTimeStats(f, tr.aggregate, "        ");
+    fprintf(f, "      },\n");
+    fprintf(f, "      \"files\": [\n");
+    for (uint32 i = 0; i < tr.files.size(); i++) {
+      const FileResult& fr = tr.files[i];
+      fprintf(f, "        {\n");
+      fprintf(f, "          \"file\": \"%s\",\n", jsonEscape(fr.filename).c_str());
+      if (!fr.first.ok) {
+        fprintf(f, "          \"error\": \"%s\"\n", jsonEscape(fr.first.error).c_str());
+      } else {
+        fprintf(f, "          \"file_size\": %llu,\n", (unsigned long long)fr.first.fileSize);
+        fprintf(f, "          \"width\": %d, \"height\": %d, \"cpp\": %d,\n", fr.first.width, fr.first.height, fr.first.cpp);
+        fprintf(f, "          \"warnings\": %u,\n", fr.first.warnings);
+        fprintf(f, "          \"first\": {\"cold_cache\": %s, \"read_ms\": %.3f, \"decode_ms\": %.3f, \"cpu_ms\": %.3f},\n",
+                fr.coldCache ? "true" : "false", fr.first.readTime * 1e3, fr.first.decodeTime * 1e3, fr.first.cpuTime * 1e3);
+        if (fr.first.hasStats)
+          writeDecoderStats(f, fr.first.stats, "          ");
+        fprintf(f, "          \"warm\": {\n");
+        writeTimeStats(f, fr.warm, "            ");
+        fprintf(f, "          }\n");
+      }
+      fprintf(f, "        }%s\n", i + 1 < tr.files.size() ? "," : "");
+    }
+    fprintf(f, "      ]\n");
+    fprintf(f, "    }%s\n", t + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n");
+  fprintf(f, "}\n");
+}
+
+static ThreadResult runBenchmark(const vector<string>& files, CameraMetaData *meta, const BenchOptions& opt, uint32 threads) {
+  ThreadResult tr;
+  tr.threads = threads;
+  tr.failed = 0;
+  ThreadPool::setSize(threads);
+  vector<double> allTimes;
+  for (uint32 i = 0; i < files.size(); i++) {
+    FileResult fr;
+    fr.filename = files[i];
+    fr.coldCache = opt.cold && dropFileCache(files[i]);
+    // The first decode also warms up the file cache and buffer pool,
+    // so it is reported separately.
+    fr.first = decodeFile(files[i], meta, opt, opt.stats);
+    if (!fr.first.ok) {
+      tr.failed++;
+      if (opt.verbose)
+        fprintf(stderr, "%s: %s\n", files[i].c_str(), fr.first.error.c_str());
+      tr.files.push_back(fr);
+      continue;
+    }
+    vector<double> times;
+    for (int run = 0; run < opt.runs; run++) {
+      DecodeResult r = decodeFile(files[i], meta, opt);
+      if (!r.ok)
+        break;
+      times.push_back(r.decodeTime);
+      fr.warm.pixels += r.pixels;
+      fr.warm.cpu += r.cpuTime;
+    }
+    fr.warm.calculate(times);
+    allTimes.insert(allTimes.end(), times.begin(), times.end());
+    tr.aggregate.pixels += fr.warm.pixels;
+    tr.aggregate.cpu += fr.warm.cpu;
+    if (opt.verbose) {
+      fprintf(stderr, "%s: %dx%d, %s %.1f ms, warm p50 %.1f ms, %.2f Mpixel/s\n",
+              files[i].c_str(), fr.first.width, fr.first.height, fr.coldCache ? "cold" : "first",
+              (fr.first.readTime + fr.first.decodeTime) * 1e3, fr.warm.p50 * 1e3, fr.warm.getMpps());
+      if (fr.first.hasStats)
+        printDecoderStats(fr.first.stats);
+    }
+    tr.files.push_back(fr);
+  }
+  tr.aggregate.calculate(allTimes);
+  return tr;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "Usage: %s [options] <file|directory>...\n", name);
+  fprintf(stderr, "  -c <cameras.xml>  Camera definitions (default: data/cameras.xml)\n");
+  fprintf(stderr, "  -n <runs>         Warm decodes per file (default: 5)\n");
+  fprintf(stderr, "  -t <n,n,...>      Thread counts to run, e.g. 1,2,4,8 (default: all cores)\n");
+  fprintf(stderr, "  -l <list>         Read file names from list, one per line\n");
+  fprintf(stderr, "  -o <file.json>    Write results as JSON, '-' for stdout\n");
+  fprintf(stderr, "  -r <mode>         File read mode: mmap (default), read or lazy\n");
+  fprintf(stderr, "  -H <name[=value]> Add a decoder hint to all cameras, e.g. nikon_curve_after_rows\n");
+  fprintf(stderr, "  -C                Drop each file from the OS cache before the first decode\n");
+  fprintf(stderr, "  -q                Only print the JSON output\n");
+  fprintf(stderr, "  -s                Time each decoding stage of the first decode of each file\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions opt;
+  opt.cameras = "data/cameras.xml";
+  vector<string> files;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool hasArg = i + 1 < argc;
+    if (a == "-c" && hasArg) {
+      opt.cameras = argv[++i];
+    } else if (a == "-n" && hasArg) {
+      opt.runs = max(atoi(argv[++i]), 0);
+    } else if (a == "-t" && hasArg) {
+      vector<string> t = split_string(argv[++i], ',');
+      for (uint32 j = 0; j < t.size(); j++) {
+        int n = atoi(t[j].c_str());
+        if (n > 0)
+          opt.threads.push_back(n);
+      }
+    } else if (a == "-l" && hasArg) {
+      FILE* lf = fopen(argv[++i], "r");
+      if (!lf) {
+        fprintf(stderr, "Could not open list: %s\n", argv[i]);
+        return 1;
+      }
+      char line[4096];
+      while (fgets(line, sizeof(line), lf)) {
+        string s(line);
+        while (!s.empty() && (s[s.size()-1] == '\n' || s[s.size()-1] == '\r'))
+          s.erase(s.size()-1);
+        if (!s.empty())
+          files.push_back(s);
+      }
+      fclose(lf);
+    } else if (a == "-o" && hasArg) {
+      opt.jsonFile = argv[++i];
+    } else if (a == "-r" && hasArg) {
+      string mode = argv[++i];
+      opt.lazy = (mode == "lazy");
+      opt.mmap = (mode == "mmap");
+      if (mode != "lazy" && mode != "mmap" && mode != "read") {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (a == "-H" && hasArg) {
+      string h = argv[++i];
+      size_t eq = h.find('=');
+      if (eq == string::npos)
+        opt.hints[h] = "";
+      else
+        opt.hints[h.substr(0, eq)] = h.substr(eq + 1);
+    } else if (a == "-C") {
+      opt.cold = true;
+    } else if (a == "-q") {
+      opt.verbose = false;
+    } else if (a == "-s") {
+      opt.stats = true;
+    } else if (a[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else if (isDirectory(a)) {
+      if (!listDirectory(a, files))
+        fprintf(stderr, "Could not read directory: %s\n", a.c_str());
+    } else {
+      files.push_back(a);
+    }
+  }
+
+  if (files.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (opt.threads.empty())
+    opt.threads.push_back(rawspeed_get_number_of_processor_cores());
+
+  CameraMetaData *meta;
+  try {
+    meta = new CameraMetaData(opt.cameras.c_str());
+  } catch (CameraMetadataException &e) {
+    fprintf(stderr, "Could not load camera definitions: %s\n", e.what());
+    return 1;
+  }
+
+  map<string,Camera*>::iterator c;
+  for (c = meta->cameras.begin(); c != meta->cameras.end(); c++) {
+    map<string,string>::iterator h;
+    for (h = opt.hints.begin(); h != opt.hints.end(); h++)
+      c->second->hints[h->first] = h->second;
+  }
+
+  vector<ThreadResult> results;
+  for (uint32 i = 0; i < opt.threads.size(); i++) {
+    if (opt.verbose)
+      fprintf(stderr, "--- %u thread(s) ---\n", opt.threads[i]);
+    results.push_back(runBenchmark(files, meta, opt, opt.threads[i]));
+    const TimeStats& s = results.back().aggregate;
+    if (opt.verbose)
+      fprintf(stderr, "Total: %u decodes, %.2f Mpixel/s, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, %u failed\n",
+              s.count, s.getMpps(), s.p50 * 1e3, s.p90 * 1e3, s.p99 * 1e3, results.back().failed);
+  }
+  if (opt.verbose)
+    fprintf(stderr, "Peak RSS: %llu kB\n", (unsigned long long)getPeakRSS());
+
+  if (!opt.jsonFile.empty()) {
+    FILE* f = opt.jsonFile == "-" ? stdout : fopen(opt.jsonFile.c_str(), "w");
+    if (!f) {
+      fprintf(stderr, "Could not write %s\n", opt.jsonFile.c_str());
+    } else {
+      writeJSON(f, opt, results);
+      if (f != stdout)
+        fclose(f);
+    }
+  }
+
+  ThreadPool::shutdown();
+  ImageBufferPool::shutdown();
+  HuffmanTableCache::flush();
+  NikonDecompressor::flushCurves();
+  delete meta;
+  return 0;
+}
@@ -99,11 +99,11 @@ RawImage ArwDecoder::decodeRawInternal() {
   if (!mFile->isValid(off))
     ThrowRDE("Sony ARW decoder: Data offset after EOF, file probably truncated");
 
-  if (!mFile->isValid(off + c2))
+  if (!mFile->isValid(off, c2))
     c2 = mFile->getSize() - off;
 
 
-  ByteStream input(mFile->getData(off), c2);
+  ByteStream input(mFile->getData(off, c2), c2);
  
   try {
     if (arw1)
@@ -249,6 +249,8 @@ void ArwDecoder::decodeThreaded(RawDecoderThread * t) {
       x += x & 1 ? 31 : 1;  // Skip to next 32 pixels
     }
   }
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, (uint64)(t->end_y - t->start_y) * w);
 }
 
 } // namespace RawSpeed
@@ -0,0 +1,227 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+#ifndef BIT_PUMP_H
+#define BIT_PUMP_H
+
+#include "ByteStream.h"
+
+#define BITS_PER_LONG_LONG (8*sizeof(uint64))
+#define MIN_GET_BITS  (BITS_PER_LONG_LONG-32)    /* bits available after fill() */
+
+namespace RawSpeed {
+
+/*************************************************************************
+ * Reads bits from a buffer, through a 64 bit bit buffer.
+ *
+ * The variants - BitPumpMSB, BitPumpMSB32, BitPumpJPEG and BitPumpPlain -
+ * only differ in the Policy class, and in refill() and checkPos(), which are
+ * specialized in their own header. Everything else is shared here, so the
+ * compiler sees all of it, and can inline it into the decoder loops.
+ *
+ * The Policy has an enum "msbFirst". If true, the first bit is the most
+ * significant bit of the buffer, and bits are shifted in at the bottom.
+ * If false, the first bit is the least significant, and bits are added
+ * at the top.
+ *
+ * Bytes after the end of the buffer are read as zero, so the buffer needs
+ * no padding.
+ *****************************/
+
+template <class Policy>
+class BitPump
+{
+public:
+  BitPump(ByteStream *s) :
+      buffer(s->getData()), size((uint32)min(s->getRemainSize(), (uint64)BITPUMP_MAX_SIZE) + sizeof(uint32)),
+      mCurr(0), mLeft(0), off(0), mStuffed(0) {
+    fill();
+  }
+  BitPump(const uchar8* _buffer, uint32 _size) :
+      buffer(_buffer), size(_size + sizeof(uint32)), mCurr(0), mLeft(0), off(0), mStuffed(0) {
+    fill();
+  }
+
+  uint32 getBitsSafe(uint32 nbits) {
+    if (nbits > MIN_GET_BITS)
+      ThrowIOE("Too many bits requested");
+
+    fill();
+    checkPos();
+    return getBitsNoFill(nbits);
+  }
+
+  uint32 getBitSafe() {
+    fill();
+    checkPos();
+    return getBitNoFill();
+  }
+
+  uchar8 getByteSafe() {
+    fill();
+    checkPos();
+    return getBitsNoFill(8);
+  }
+
+  // Set offset in bytes
+  void setAbsoluteOffset(uint32 offset) {
+    if (offset >= size)
+      ThrowIOE("Offset set out of buffer");
+
+    mCurr = 0;
+    mLeft = 0;
+    mStuffed = 0;
+    off = offset;
+    fill();
+  }
+
+  // Bytes read, including a partially read byte
+  __inline uint32 getOffset() { return off - (mLeft >> 3) + mStuffed; }
+
+  // Check if we have a valid position
+  __inline void checkPos();
+
+  // Fill the buffer with at least MIN_GET_BITS bits.
+  // Only refills when less than that is left, so several Huffman codes
+  // can be decoded between refills.
+  __inline void fill() {
+    if (mLeft < MIN_GET_BITS)
+      refill();
+  }
+
+  __inline uint32 peekBitsNoFill(uint32 nbits) {
+    uint64 mask = ((uint64)1 << nbits) - 1;
+    if (Policy::msbFirst)
+      return (uint32)((mCurr >> (mLeft - nbits)) & mask);
+    return (uint32)(mCurr & mask);
+  }
+
+  __inline void skipBitsNoFill(uint32 nbits) {
+    if (!Policy::msbFirst)
+      mCurr >>= nbits;
+    mLeft -= nbits;
+  }
+
+  __inline uint32 getBitsNoFill(uint32 nbits) {
+    uint32 ret = peekBitsNoFill(nbits);
+    skipBitsNoFill(nbits);
+    return ret;
+  }
+
+  __inline uint32 getBitNoFill() {
+    return getBitsNoFill(1);
+  }
+
+  __inline uint32 peekByteNoFill() {
+    return peekBitsNoFill(8);
+  }
+
+  __inline uint32 getBits(uint32 nbits) {
+    _ASSERTE(nbits <= MIN_GET_BITS);
+    if (mLeft < nbits)
+      refill();
+    return getBitsNoFill(nbits);
+  }
+
+  __inline uint32 getBit() {
+    if (!mLeft)
+      refill();
+    return getBitNoFill();
+  }
+
+  __inline uint32 peekBits(uint32 nbits) {
+    if (mLeft < nbits)
+      refill();
+    return peekBitsNoFill(nbits);
+  }
+
+  __inline uint32 peekBit() {
+    if (!mLeft)
+      refill();
+    return peekBitsNoFill(1);
+  }
+
+  __inline uint32 peekByte() {
+    fill();
+
+    if (off > size)
+      throw IOException("Out of buffer read");
+
+    return peekByteNoFill();
+  }
+
+  __inline uchar8 getByte() {
+    if (mLeft < 8)
+      refill();
+    return getBitsNoFill(8);
+  }
+
+  __inline void skipBits(uint32 nbits) {
+    while (nbits) {
+      fill();
+      checkPos();
+      uint32 n = min(nbits, mLeft);
+      skipBitsNoFill(n);
+      nbits -= n;
+    }
+  }
+
+protected:
+  // Add bits to the buffer. Must only be called with less than 32 bits left,
+  // and leaves at least 32 bits. Never leaves 64 bits, so no shift above is by 64.
+  __inline void refill();
+  // The slow part of refill(), near the end of the buffer
+  void refillTail();
+  const uchar8* buffer;
+  const uint32 size;            // This if the end of buffer.
+  uint64 mCurr;                // The bit buffer
+  uint32 mLeft;                // Bits left in mCurr
+  uint32 off;                  // Offset in bytes of the next byte to be added to mCurr
+  uint32 mStuffed;             // Zero bytes added, that wasn't read from the buffer
+};
+
+/* Helpers for the refill() implementations. These may read unaligned. */
+
+inline uint64 getBitPumpBE64(const uchar8* in) {
+#if defined(LE_PLATFORM_HAS_BSWAP)
+  return PLATFORM_BSWAP64(*(uint64*)in);
+#else
+  return ((uint64)((in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3]) << 32) |
+         (uint32)((in[4] << 24) | (in[5] << 16) | (in[6] << 8) | in[7]);
+#endif
+}
+
+inline uint64 getBitPumpLE64(const uchar8* in) {
+  if (getHostEndianness() == little)
+    return *(uint64*)in;
+  return ((uint64)((in[7] << 24) | (in[6] << 16) | (in[5] << 8) | in[4]) << 32) |
+         (uint32)((in[3] << 24) | (in[2] << 16) | (in[1] << 8) | in[0]);
+}
+
+inline uint32 getBitPumpLE32(const uchar8* in) {
+  if (getHostEndianness() == little)
+    return *(uint32*)in;
+  return (in[3] << 24) | (in[2] << 16) | (in[1] << 8) | in[0];
+}
+
+} // namespace RawSpeed
+
+#endif//BIT_PUMP_H
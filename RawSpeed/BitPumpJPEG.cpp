@@ -28,112 +28,30 @@ namespace RawSpeed {
 /*** Used for entropy encoded sections ***/
 
 
-BitPumpJPEG::BitPumpJPEG(ByteStream *s):
-    buffer(s->getData()), size(s->getRemainSize() + sizeof(uint32)), mLeft(0), off(0), stuffed(0) {
-  init();
-}
-
-BitPumpJPEG::BitPumpJPEG(const uchar8* _buffer, uint32 _size) :
-    buffer(_buffer), size(_size + sizeof(uint32)), mLeft(0), off(0), stuffed(0) {
-  init();
-}
-
-__inline void BitPumpJPEG::init() {
-  current_buffer = (uchar8*)_aligned_malloc(16, 16);
-  if (!current_buffer)
-    ThrowRDE("BitPumpJPEG::init(): Unable to allocate memory");
-  memset(current_buffer,0,16);
-  fill();
-}
-
-void BitPumpJPEG::fill()
-{
-  if (mLeft >=24)
-    return;
-  // Fill in 96 bits
-  int* b = (int*)current_buffer;
-  if ((off + 12) >= size) {
-    while(mLeft <= 64 && off < size) {
-      for (int i = (mLeft>>3); i >= 0; i--)
-        current_buffer[i+1] = current_buffer[i];
-      uchar8 val = buffer[off++];
+// Byte by byte, removing stuffed zeros, and stopping at markers
+template<> void BitPumpJPEG::refillTail() {
+  while (mLeft <= 48) {
+    uchar8 val = 0;
+    if (off < size) {
+      // The input isn't padded, so the bytes after it are read as zero
+      val = off < size - sizeof(uint32) ? buffer[off] : 0;
+      off++;
       if (val == 0xff) {
-        if (buffer[off] == 0)
+        if (off >= size - sizeof(uint32) || buffer[off] == 0)
           off++;
         else {
           // We hit another marker - don't forward bitpump anymore
           val = 0;
           off--;
-          stuffed++;
+          mStuffed++;
         }
       }
-      current_buffer[0] = val;
-      mLeft+=8;
-    }
-    while (mLeft < 64) {
-      b[2] = b[1];
-      b[1] = b[0];
-      b[0] = 0;
-      mLeft +=32;
-      stuffed +=4;  //We are adding to mLeft without incrementing offset
+    } else {
+      mStuffed++;  //We are adding to mLeft without incrementing offset
     }
-    return;
+    mCurr = (mCurr << 8) | val;
+    mLeft += 8;
   }
-  b[3] = b[0];
-  for (int i = 0; i < 12; i++) {
-    uchar8 val = buffer[off++];
-    if (val == 0xff) {
-      if (buffer[off] == 0)
-        off++;
-      else {
-        val = 0;
-        off--;
-        stuffed++;
-      }
-    }
-    current_buffer[11-i] = val;
-  } 
-  mLeft+=96;
-}
-
-
-uint32 BitPumpJPEG::getBitSafe() {
-  fill();
-  checkPos();
-
-  return getBitNoFill();
-}
-
-uint32 BitPumpJPEG::getBitsSafe(unsigned int nbits) {
-  if (nbits > MIN_GET_BITS)
-    throw IOException("Too many bits requested");
-
-  fill();
-  checkPos();
-  return getBitsNoFill(nbits);
-}
-
-
-uchar8 BitPumpJPEG::getByteSafe() {
-  fill();
-  checkPos();
-  return getBitsNoFill(8);
-}
-
-void BitPumpJPEG::setAbsoluteOffset(unsigned int offset) {
-  if (offset >= size)
-    throw IOException("Offset set out of buffer");
-
-  mLeft = 0;
-  off = offset;
-  fill();
-}
-
-
-
-BitPumpJPEG::~BitPumpJPEG(void) {
-	_aligned_free(current_buffer);
 }
 
 } // namespace RawSpeed
-
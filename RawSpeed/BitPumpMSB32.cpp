@@ -27,61 +27,16 @@ namespace RawSpeed {
 /*** Used for entropy encoded sections, for now only Nikon Coolpix ***/
 
 
-BitPumpMSB32::BitPumpMSB32(ByteStream *s):
-    buffer(s->getData()), size(s->getRemainSize() + sizeof(uint32)), mLeft(0), mCurr(0), off(0) {
-  init();
-}
-
-BitPumpMSB32::BitPumpMSB32(const uchar8* _buffer, uint32 _size) :
-    buffer(_buffer), size(_size + sizeof(uint32)), mLeft(0), mCurr(0), off(0) {
-  init();
-}
-
-__inline void BitPumpMSB32::init() {
-  fill();
-}
-
-void BitPumpMSB32::fill()
-{
-  uint32 c, c2, c3, c4;
-
-  if (mLeft >= MIN_GET_BITS)
-    return;
-
-  c = buffer[off++];
-  c2 = buffer[off++];
-  c3 = buffer[off++];
-  c4 = buffer[off++];
-  mCurr <<= 32;
-  mCurr |= (c4 << 24) | (c3<<16) | (c2<<8) | c;
-  mLeft += 32;
-}
-
-uint32 BitPumpMSB32::getBitsSafe(unsigned int nbits) {
-  if (nbits > MIN_GET_BITS)
-    throw IOException("Too many bits requested");
-
-  if (mLeft < nbits) {
-    fill();
-    checkPos();
+// Last word of the input. The input isn't padded, so the bytes after it are read as zero
+template<> void BitPumpMSB32::refillTail() {
+  uint32 in = 0;
+  for (uint32 i = 0; i < 4; i++) {
+    if (off + i < size - sizeof(uint32))
+      in |= (uint32)buffer[off + i] << (i * 8);
   }
-
-  return (uint32)((mCurr >> (mLeft -= (nbits))) & ((1 << nbits) - 1));
-}
-
-
-void BitPumpMSB32::setAbsoluteOffset(unsigned int offset) {
-  if (offset >= size)
-    throw IOException("Offset set out of buffer");
-
-  mLeft = 0;
-  mCurr = 0;
-  off = offset;
-  fill();
-}
-
-BitPumpMSB32::~BitPumpMSB32(void) {
+  mCurr = (mCurr << 32) | in;
+  mLeft += 32;
+  off += 4;
 }
 
-
 } // namespace RawSpeed
@@ -22,68 +22,37 @@
 #ifndef BIT_PUMP_MSB32_H
 #define BIT_PUMP_MSB32_H
 
-#include "ByteStream.h"
-
-#ifdef MIN_GET_BITS
-#undef MIN_GET_BITS
-#endif
-
-#define BITS_PER_LONG_LONG (8*sizeof(uint64))
-#define MIN_GET_BITS  (BITS_PER_LONG_LONG-33)    /* max value for long getBuffer */
+#include "BitPump.h"
 
 namespace RawSpeed {
 
-// Note: Allocated buffer MUST be at least size+sizeof(uint32) large.
-
-class BitPumpMSB32
+// Little endian 32 bit words, most significant bit first.
+class BitPumpMSB32Policy
 {
 public:
-  BitPumpMSB32(ByteStream *s);
-  BitPumpMSB32(const uchar8* _buffer, uint32 _size );
-	uint32 getBitsSafe(uint32 nbits);
-	uint32 getBitSafe();
-	uchar8 getByteSafe();
-	void setAbsoluteOffset(uint32 offset);     // Set offset in bytes
-  __inline uint32 getOffset() { return off-(mLeft>>3);}
-  __inline void checkPos()  { if (off>size) throw IOException("Out of buffer read");};        // Check if we have a valid position
-
-  // Fill the buffer with at least 24 bits
-void fill();
-
-  __inline uint32 getBit() {
-    if (!mLeft) fill();
-
-    return (uint32)((mCurr >> (--mLeft)) & 1);
-  }
+  enum { msbFirst = 1 };
+};
 
-  __inline uint32 getBits(uint32 nbits) {
-    if (mLeft < nbits) {
-      fill();
-    }
+typedef BitPump<BitPumpMSB32Policy> BitPumpMSB32;
 
-    return (uint32)((mCurr >> (mLeft -= (nbits))) & ((1 << nbits) - 1));
-  }
+template<> void BitPumpMSB32::refillTail();
 
-  __inline void skipBits(unsigned int nbits) {
-    while (nbits) {
-      fill();
-      checkPos();
-      int n = MIN(nbits, mLeft);
-      mLeft -= n;
-      nbits -= n;
-    }
+// The input is read in 32 bit words, so one word is added at a time.
+template<> __inline void BitPumpMSB32::refill() {
+  if (off + 4 > size - sizeof(uint32)) {
+    refillTail();
+    return;
   }
-
-  virtual ~BitPumpMSB32(void);
-protected:
-  void __inline init();
-  const uchar8* buffer;
-  const uint32 size;            // This if the end of buffer.
-  uint32 mLeft;
-  uint64 mCurr;
-  uint32 off;                  // Offset in bytes
-private:
-};
+  mCurr = (mCurr << 32) | getBitPumpLE32(&buffer[off]);
+  mLeft += 32;
+  off += 4;
+}
+
+// Throws when more than the zero bytes after the buffer have been read
+template<> __inline void BitPumpMSB32::checkPos() {
+  if (getOffset() > size)
+    throw IOException("Out of buffer read");
+}
 
 } // namespace RawSpeed
 
@@ -26,80 +26,15 @@ namespace RawSpeed {
 
 /*** Used for entropy encoded sections ***/
 
-#define BITS_PER_LONG (8*sizeof(uint32))
-#define MIN_GET_BITS  (BITS_PER_LONG-7)    /* max value for long getBuffer */
 
-
-BitPumpPlain::BitPumpPlain(ByteStream *s):
-    buffer(s->getData()), size(8*s->getRemainSize()), off(0) {
-}
-
-BitPumpPlain::BitPumpPlain(const uchar8* _buffer, uint32 _size) :
-    buffer(_buffer), size(_size*8), off(0) {
-}
-
-uint32 BitPumpPlain::getBit() throw() {
-  uint32 v = *(uint32*) & buffer[off>>3] >> (off & 7) & 1;
-  off++;
-  return v;
-}
-
-uint32 BitPumpPlain::getBits(uint32 nbits) throw() {
-  uint32 v = *(uint32*) & buffer[off>>3] >> (off & 7) & ((1 << nbits) - 1);
-  off += nbits;
-  return v;
-}
-
-uint32 BitPumpPlain::peekBit() throw() {
-  return *(uint32*)&buffer[off>>3] >> (off&7) & 1;
-}
-
-uint32 BitPumpPlain::peekBits(uint32 nbits) throw() {
-  return *(uint32*)&buffer[off>>3] >> (off&7) & ((1 << nbits) - 1);
-}
-
-uint32 BitPumpPlain::peekByte() throw() {
-  return *(uint32*)&buffer[off>>3] >> (off&7) & 0xff;
-}
-
-uint32 BitPumpPlain::getBitSafe() {
-  checkPos();
-  return *(uint32*)&buffer[off>>3] >> (off&7) & 1;
-}
-
-uint32 BitPumpPlain::getBitsSafe(unsigned int nbits) {
-  checkPos();
-  return *(uint32*)&buffer[off>>3] >> (off&7) & ((1 << nbits) - 1);
-}
-
-void BitPumpPlain::skipBits(unsigned int nbits) {
-  off += nbits;
-  checkPos();
-}
-
-uchar8 BitPumpPlain::getByte() throw() {
-  uint32 v = *(uint32*) & buffer[off>>3] >> (off & 7) & 0xff;
-  off += 8;
-  return v;
-}
-
-uchar8 BitPumpPlain::getByteSafe() {
-  uint32 v = *(uint32*) & buffer[off>>3] >> (off & 7) & 0xff;
-  off += 8;
-  checkPos();
-
-  return v;
-}
-
-void BitPumpPlain::setAbsoluteOffset(unsigned int offset) {
-  if (offset >= size)
-    throw IOException("Offset set out of buffer");
-
-  off = offset * 8;
-}
-
-
-BitPumpPlain::~BitPumpPlain(void) {
+// Last bytes of the input. The input isn't padded, so the bytes after it are read as zero
+template<> void BitPumpPlain::refillTail() {
+  while (mLeft <= 48) {
+    if (off < size - sizeof(uint32))
+      mCurr |= (uint64)buffer[off] << mLeft;
+    off++;
+    mLeft += 8;
+  }
 }
 
 } // namespace RawSpeed
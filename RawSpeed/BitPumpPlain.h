@@ -22,39 +22,38 @@
 #ifndef BIT_PUMP_PLAIN_H
 #define BIT_PUMP_PLAIN_H
 
-#include "ByteStream.h"
+#include "BitPump.h"
 
 namespace RawSpeed {
 
-// Note: Allocated buffer MUST be at least size+sizeof(uint32) large.
-
-class BitPumpPlain
+// Little endian bytes, least significant bit first.
+class BitPumpPlainPolicy
 {
 public:
-  BitPumpPlain(ByteStream *s);
-  BitPumpPlain(const uchar8* _buffer, uint32 _size );
-	uint32 getBits(uint32 nbits) throw ();
-	uint32 getBit() throw ();
-	uint32 getBitsSafe(uint32 nbits);
-	uint32 getBitSafe();
-	uint32 peekBits(uint32 nbits) throw ();
-	uint32 peekBit() throw ();
-  uint32 peekByte() throw ();
-  void skipBits(uint32 nbits);
-	uchar8 getByte() throw();
-	uchar8 getByteSafe();
-	void setAbsoluteOffset(uint32 offset);
-  uint32 getOffset() { return off>>3;}
-  __inline void checkPos()  { if (off>size) throw IOException("Out of buffer read");};        // Check if we have a valid position
-
-  virtual ~BitPumpPlain(void);
-protected:
-  const uchar8* buffer;
-  const uint32 size;            // This if the end of buffer.
-  uint32 off;                  // Offset in bytes
-private:
+  enum { msbFirst = 0 };
 };
 
+typedef BitPump<BitPumpPlainPolicy> BitPumpPlain;
+
+template<> void BitPumpPlain::refillTail();
+
+template<> __inline void BitPumpPlain::refill() {
+  if (off + 8 > size - sizeof(uint32)) {
+    refillTail();
+    return;
+  }
+  // Read 8 bytes above the bits left. The bytes that doesn't fit are read again next time.
+  mCurr |= getBitPumpLE64(&buffer[off]) << mLeft;
+  off += (63 - mLeft) >> 3;
+  mLeft |= 56;
+}
+
+// Throws when bits after the end of the buffer have been read
+template<> __inline void BitPumpPlain::checkPos() {
+  if (getOffset() > size - sizeof(uint32))
+    throw IOException("Out of buffer read");
+}
+
 } // namespace RawSpeed
 
 #endif
@@ -24,7 +24,7 @@
 
 namespace RawSpeed {
 
-ByteStream::ByteStream(const uchar8* _buffer, uint32 _size) :
+ByteStream::ByteStream(const uchar8* _buffer, uint64 _size) :
     buffer(_buffer), size(_size), off(0) {
 
 }
@@ -39,12 +39,14 @@ ByteStream::~ByteStream(void) {
 }
 
 uint32 ByteStream::peekByte() {
+  if (off >= size)
+    ThrowIOE("peekByte: Out of buffer read");
   return buffer[off];
 }
 
-void ByteStream::skipBytes(uint32 nbytes) {
+void ByteStream::skipBytes(uint64 nbytes) {
   off += nbytes;
-  if (off > size)
+  if (off > size || off < nbytes)
     ThrowIOE("Skipped out of buffer");
 }
 
@@ -78,7 +80,7 @@ int ByteStream::getInt() {
   return r;
 }
 
-void ByteStream::setAbsoluteOffset(uint32 offset) {
+void ByteStream::setAbsoluteOffset(uint64 offset) {
   if (offset >= size)
     ThrowIOE("setAbsoluteOffset:Offset set out of buffer");
   off = offset;
@@ -86,7 +88,9 @@ void ByteStream::setAbsoluteOffset(uint32 offset) {
 
 void ByteStream::skipToMarker() {
   int c = 0;
-  while (!(buffer[off] == 0xFF && buffer[off+1] != 0)) {
+  if (off >= size)
+    ThrowIOE("No marker found inside rest of buffer");
+  while (!(buffer[off] == 0xFF && off + 1 < size && buffer[off+1] != 0)) {
     off++;
     c++;
     if (off >= size)
@@ -27,19 +27,22 @@
 
 namespace RawSpeed {
 
+/* Bitpumps use 32 bit offsets. Bitpumps created from a larger ByteStream only read the first part */
+#define BITPUMP_MAX_SIZE 0xfffffff0
+
 class ByteStream
 {
 public:
-  ByteStream(const uchar8* _buffer, uint32 _size);
+  ByteStream(const uchar8* _buffer, uint64 _size);
   ByteStream(const ByteStream* b);
   virtual ~ByteStream(void);
   uint32 peekByte();
-  uint32 getOffset() {return off;}
-  void skipBytes(uint32 nbytes);
+  uint64 getOffset() {return off;}
+  void skipBytes(uint64 nbytes);
   uchar8 getByte();
-  void setAbsoluteOffset(uint32 offset);
+  void setAbsoluteOffset(uint64 offset);
   void skipToMarker();
-  uint32 getRemainSize() { return size-off;}
+  uint64 getRemainSize() { return size-off;}
   const uchar8* getData() {return &buffer[off];}
   virtual ushort16 getShort();
   virtual int getInt();
@@ -49,9 +52,9 @@ public:
   void popOffset();
 protected:
   const uchar8* buffer;
-  const uint32 size;            // This if the end of buffer.
-  uint32 off;                  // Offset in bytes (this is next byte to deliver)
-  stack<uint32> offset_stack;
+  const uint64 size;            // This if the end of buffer.
+  uint64 off;                  // Offset in bytes (this is next byte to deliver)
+  stack<uint64> offset_stack;
 };
 
 } // namespace RawSpeed
@@ -4,7 +4,7 @@
 namespace RawSpeed {
 
 
-ByteStreamSwap::ByteStreamSwap( const uchar8* _buffer, uint32 _size ) : 
+ByteStreamSwap::ByteStreamSwap( const uchar8* _buffer, uint64 _size ) : 
 ByteStream(_buffer, _size)
 {}
 
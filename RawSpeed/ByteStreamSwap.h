@@ -11,7 +11,7 @@ class ByteStreamSwap :
   public ByteStream
 {
 public:
-  ByteStreamSwap(const uchar8* _buffer, uint32 _size);
+  ByteStreamSwap(const uchar8* _buffer, uint64 _size);
   ByteStreamSwap(const ByteStreamSwap* b);
   virtual ushort16 getShort();
   virtual int getInt();
@@ -130,6 +130,7 @@ inline Endianness getHostEndianness() {
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && __alignof__ (int) == 1
 #define LE_PLATFORM_HAS_BSWAP
 #define PLATFORM_BSWAP32(A) __builtin_bswap32(A)
+#define PLATFORM_BSWAP64(A) __builtin_bswap64(A)
 #endif
 #endif
 
@@ -137,6 +138,22 @@ inline Endianness getHostEndianness() {
 #include <intrin.h>
 #define LE_PLATFORM_HAS_BSWAP
 #define PLATFORM_BSWAP32(A) _byteswap_ulong(A)
+#define PLATFORM_BSWAP64(A) _byteswap_uint64(A)
+#endif
+
+/* Atomically increment/decrement *v and return the new value. */
+/* Both act as full memory barriers. */
+#ifdef _MSC_VER
+inline int32 atomicIncrement(volatile int32* v) { return _InterlockedIncrement((volatile long*)v); }
+inline int32 atomicDecrement(volatile int32* v) { return _InterlockedDecrement((volatile long*)v); }
+#else
+inline int32 atomicIncrement(volatile int32* v) { return __sync_add_and_fetch(v, 1); }
+inline int32 atomicDecrement(volatile int32* v) { return __sync_sub_and_fetch(v, 1); }
+#endif
+
+/* Compiler supports rvalue references (move constructors) */
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#define HAS_RVALUE_REFERENCES
 #endif
 
 inline uint32 clampbits(int x, uint32 n) { 
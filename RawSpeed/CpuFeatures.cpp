@@ -0,0 +1,84 @@
+#include "StdAfx.h"
+#include "CpuFeatures.h"
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace RawSpeed {
+
+static uint32 cpu_detected = 0;
+static pthread_once_t cpu_detected_once = PTHREAD_ONCE_INIT;
+static uint32 cpu_mask = CPU_ALL;
+static pthread_mutex_t cpu_mask_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void CpuFeatures::detectOnce() {
+  cpu_detected = detect();
+}
+
+uint32 CpuFeatures::get() {
+  pthread_once(&cpu_detected_once, detectOnce);
+  pthread_mutex_lock(&cpu_mask_mutex);
+  uint32 mask = cpu_mask;
+  pthread_mutex_unlock(&cpu_mask_mutex);
+  return cpu_detected & mask;
+}
+
+void CpuFeatures::setMask(uint32 mask) {
+  pthread_mutex_lock(&cpu_mask_mutex);
+  cpu_mask = mask;
+  pthread_mutex_unlock(&cpu_mask_mutex);
+}
+
+uint32 CpuFeatures::detect() {
+  uint32 f = 0;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 1);
+  if (info[3] & (1 << 26))
+    f |= CPU_SSE2;
+#ifdef RAWSPEED_AVX2
+  // AVX2 also needs the OS to save the YMM registers
+  bool osxsave = !!(info[2] & (1 << 27));
+  if (osxsave && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5))
+      f |= CPU_AVX2;
+  }
+#endif
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#ifdef RAWSPEED_SSE2
+  f |= CPU_SSE2;
+#endif
+#ifdef RAWSPEED_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    f |= CPU_AVX2;
+#endif
+#endif
+#ifdef RAWSPEED_NEON
+  f |= CPU_NEON;
+#endif
+  return f;
+}
+
+} // namespace RawSpeed
@@ -0,0 +1,83 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+/* Vector code that can be compiled. Whether it can run is checked with CpuFeatures. */
+#if _MSC_VER > 1399 || defined(__SSE2__)
+#define RAWSPEED_SSE2
+#endif
+
+/* AVX2 functions are compiled with a target attribute, so the rest of the */
+/* library does not need to be compiled for AVX2 */
+#if (_MSC_VER >= 1700 && (defined(_M_X64) || defined(_M_IX86))) || \
+    (defined(__GNUC__) && defined(__SSE2__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)))
+#define RAWSPEED_AVX2
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RAWSPEED_NEON
+#endif
+
+#if defined(RAWSPEED_AVX2) && defined(__GNUC__)
+#define RAWSPEED_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RAWSPEED_TARGET_AVX2
+#endif
+
+namespace RawSpeed {
+
+typedef enum {
+  CPU_SSE2 = 1,
+  CPU_AVX2 = 2,
+  CPU_NEON = 4,
+  CPU_ALL = 0xffff
+} CpuFeature;
+
+/*************************************************************************
+ * Runtime detection of vector instruction sets
+ *
+ * Decoders with vector code check has() before using it, and fall back to
+ * scalar code, that gives the same result. Features can be disabled with
+ * setMask(), for instance to compare the vector code to the scalar code.
+ *
+ *****************************/
+class CpuFeatures
+{
+public:
+  /* Features supported by the CPU, and compiled in, that are not disabled */
+  static uint32 get();
+  static bool has(CpuFeature f) {return !!(get() & f);}
+
+  /* Only use the features in "mask" - CPU_ALL (default) uses all supported */
+  /* features, 0 uses scalar code only. */
+  static void setMask(uint32 mask);
+private:
+  static uint32 detect();
+  /* Sets the detected features. Run once, with pthread_once() */
+  static void detectOnce();
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -47,6 +47,8 @@ RawImage Cr2Decoder::decodeRawInternal() {
 
   TiffIFD* raw = data[0];
   mRaw = RawImage::create();
+  mRaw->setExternalData(mOutputBuffer, mOutputBufferSize, mOutputPitch);
+  mRaw->stats = mStats;
   mRaw->isCFA = true;
   vector<Cr2Slice> slices;
   int completeH = 0;
@@ -68,7 +70,7 @@ RawImage Cr2Decoder::decodeRawInternal() {
         if (slices[0].w != slice.w)
           ThrowRDE("CR2 Decoder: Slice width does not match.");
 
-      if (mFile->isValid(slice.offset + slice.count)) // Only decode if size is valid
+      if (mFile->isValid(slice.offset, slice.count)) // Only decode if size is valid
         slices.push_back(slice);
       completeH += slice.h;
     }
@@ -124,8 +126,11 @@ RawImage Cr2Decoder::decodeRawInternal() {
       LJpegPlain l(mFile, mRaw);
       l.addSlices(s_width);
       l.mUseBigtable = true;
+      l.mUseThreads = true;
       l.mCanonFlipDim = flipDims;
       l.startDecoder(slice.offset, slice.count, 0, offY);
+      if (mStats)
+        mStats->addCount(COUNTER_SLICES, (uint64)s_width.size());
     } catch (RawDecoderException &e) {
       if (i == 0)
         throw;
@@ -208,6 +213,7 @@ int Cr2Decoder::getHue() {
 
 // Interpolate and convert sRaw data.
 void Cr2Decoder::sRawInterpolate() {
+  StageTimer timer(mStats, STAGE_SRAW_INTERPOLATE);
   vector<TiffIFD*> data = mRootIFD->getIFDsWithTag((TiffTag)0x4001);
   if (data.empty())
     ThrowRDE("CR2 sRaw: Unable to locate WB info.");
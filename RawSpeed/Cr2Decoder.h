@@ -57,7 +57,7 @@ public:
   ~Cr2Slice() {};
   uint32 w;
   uint32 h;
-  uint32 offset;
+  uint64 offset;
   uint32 count;
 };
 
@@ -87,6 +87,8 @@ RawImage DngDecoder::decodeRawInternal() {
     mRaw = RawImage::create(TYPE_FLOAT32);
   else
     ThrowRDE("DNG Decoder: Only 16 bit unsigned or float point data supported.");
+  mRaw->setExternalData(mOutputBuffer, mOutputBufferSize, mOutputPitch);
+  mRaw->stats = mStats;
 
   mRaw->isCFA = (raw->getEntry(PHOTOMETRICINTERPRETATION)->getShort() == 32803);
 
@@ -199,7 +201,7 @@ RawImage DngDecoder::decodeRawInternal() {
 
           offY += yPerSlice;
 
-          if (mFile->isValid(slice.offset + slice.count)) // Only decode if size is valid
+          if (mFile->isValid(slice.offset, slice.count)) // Only decode if size is valid
             slices.push_back(slice);
         }
 
@@ -209,7 +211,7 @@ RawImage DngDecoder::decodeRawInternal() {
           DngStrip slice = slices[i];
           if (hints.find("ignore_bytecount") != hints.end())
             slice.count = mFile->getSize() - slice.offset;
-          ByteStream in(mFile->getData(slice.offset), slice.count);
+          ByteStream in(mFile->getData(slice.offset, slice.count), slice.count);
           iPoint2D size(width, slice.h);
           iPoint2D pos(0, slice.offsetY);
 
@@ -292,7 +294,7 @@ RawImage DngDecoder::decodeRawInternal() {
             e.mUseBigtable = yPerSlice * mRaw->dim.y > 1024 * 1024;
             offY += yPerSlice;
 
-            if (mFile->isValid(e.byteOffset + e.byteCount)) // Only decode if size is valid
+            if (mFile->isValid(e.byteOffset, e.byteCount)) // Only decode if size is valid
               slices.addSlice(e);
           }
         }
@@ -300,8 +302,14 @@ RawImage DngDecoder::decodeRawInternal() {
         if (!nSlices)
           ThrowRDE("DNG Decoder: No valid slices found.");
 
+        size_t errorsBefore = mRaw->errors.size();
         slices.startDecoding();
 
+        if (mStats) {
+          uint64 decoded = nSlices - min((size_t)nSlices, mRaw->errors.size() - errorsBefore);
+          mStats->addCount(raw->hasEntry(TILEOFFSETS) ? COUNTER_TILES : COUNTER_SLICES, decoded);
+        }
+
         if (mRaw->errors.size() >= nSlices)
           ThrowRDE("DNG Decoding: Too many errors encountered. Giving up.\nFirst Error:%s", mRaw->errors[0]);
       } catch (TiffParserException e) {
@@ -386,9 +394,11 @@ RawImage DngDecoder::decodeRawInternal() {
     if (raw->hasEntry(OPCODELIST1))
     {
       // Apply stage 1 codes
+      StageTimer timer(mStats, STAGE_DNG_OPCODES);
       try{
         DngOpcodes codes(raw->getEntry(OPCODELIST1));
         mRaw = codes.applyOpCodes(mRaw);
+        mRaw->stats = mStats;
       } catch (RawDecoderException &e) {
         // We push back errors from the opcode parser, since the image may still be usable
         mRaw->setError(e.what());
@@ -434,9 +444,11 @@ RawImage DngDecoder::decodeRawInternal() {
       // We must apply black/white scaling
       mRaw->scaleBlackWhite();
       // Apply stage 2 codes
+      StageTimer timer(mStats, STAGE_DNG_OPCODES);
       try{
         DngOpcodes codes(raw->getEntry(OPCODELIST2));
         mRaw = codes.applyOpCodes(mRaw);
+        mRaw->stats = mStats;
       } catch (RawDecoderException &e) {
         // We push back errors from the opcode parser, since the image may still be usable
         mRaw->setError(e.what());
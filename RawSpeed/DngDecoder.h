@@ -53,8 +53,8 @@ public:
   DngStrip() { h = offset = count = offsetY = 0;};
   ~DngStrip() {};
   uint32 h;
-  uint32 offset; // Offset in bytes
-  uint32 count;
+  uint64 offset; // Offset in bytes
+  uint64 count;
   uint32 offsetY;
 };
 
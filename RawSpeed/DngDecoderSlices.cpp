@@ -32,17 +32,17 @@ namespace RawSpeed {
 void *DecodeThread(void *_this) {
   DngDecoderThread* me = (DngDecoderThread*)_this;
   DngDecoderSlices* parent = me->parent;
+  JobTimer timer(parent->mRaw->stats);
   try {
     parent->decodeSlice(me);
   } catch (...) {
     parent->mRaw->setError("DNGDEcodeThread: Caught exception.");
   }
-  pthread_exit(NULL);
   return NULL;
 }
 
 
-DngDecoderSlices::DngDecoderSlices(FileMap* file, RawImage img, int _compression) :
+DngDecoderSlices::DngDecoderSlices(FileMap* file, const RawImage& img, int _compression) :
     mFile(file), mRaw(img) {
   mFixLjpeg = false;
   compression = _compression;
@@ -52,19 +52,18 @@ DngDecoderSlices::~DngDecoderSlices(void) {
 }
 
 void DngDecoderSlices::addSlice(DngSliceElement slice) {
+  // Read it now, so decoder threads don't have to wait for each other to read
+  mFile->prefetch(slice.byteOffset, slice.byteCount);
   slices.push(slice);
 }
 
 void DngDecoderSlices::startDecoding() {
-  // Create threads
-
-  nThreads = getThreadCount();
+  ThreadPool* pool = ThreadPool::getPool();
+  // Hand out a few slices at a time, since compressed size of slices may vary a lot.
+  nThreads = pool->getPartCount((uint32)slices.size());
   int slicesPerThread = ((int)slices.size() + nThreads - 1) / nThreads;
 //  decodedSlices = 0;
-  pthread_attr_t attr;
-  /* Initialize and set thread detached attribute */
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+  void **args = new void*[nThreads];
 
   for (uint32 i = 0; i < nThreads; i++) {
     DngDecoderThread* t = new DngDecoderThread();
@@ -75,17 +74,17 @@ void DngDecoderSlices::startDecoding() {
       }
     }
     t->parent = this;
-    pthread_create(&t->threadid, &attr, DecodeThread, t);
     threads.push_back(t);
+    args[i] = t;
   }
-  pthread_attr_destroy(&attr);
 
-  void *status;
+  pool->run(DecodeThread, args, nThreads);
+  delete[] args;
+
   for (uint32 i = 0; i < nThreads; i++) {
-    pthread_join(threads[i]->threadid, &status);
     delete(threads[i]);
   }
-
+  threads.clear();
 }
 
 #if JPEG_LIB_VERSION < 80
@@ -148,6 +147,8 @@ void DngDecoderSlices::decodeSlice(DngDecoderThread* t) {
       l.mDNGCompatible = mFixLjpeg;
       DngSliceElement e = t->slices.front();
       l.mUseBigtable = e.mUseBigtable;
+      // Fewer slices than threads, so split the slices too
+      l.mUseThreads = nThreads < ThreadPool::getPool()->getSize();
       t->slices.pop();
       try {
         l.startDecoder(e.byteOffset, e.byteCount, e.offX, e.offY);
@@ -169,13 +170,13 @@ void DngDecoderSlices::decodeSlice(DngDecoderThread* t) {
       JSAMPARRAY buffer = (JSAMPARRAY)malloc(sizeof(JSAMPROW));
 
       try {
-        uint32 size = mFile->getSize();
+        uint64 size = mFile->getSize();
         jpeg_create_decompress(&dinfo);
         dinfo.err = jpeg_std_error(&jerr);
         jerr.error_exit = my_error_throw;
         CHECKSIZE(e.byteOffset);
         CHECKSIZE(e.byteOffset+e.byteCount);
-        JPEG_MEMSRC(&dinfo, (unsigned char*)mFile->getData(e.byteOffset), e.byteCount);
+        JPEG_MEMSRC(&dinfo, (unsigned char*)mFile->getData(e.byteOffset, e.byteCount), e.byteCount);
 
         if (JPEG_HEADER_OK != jpeg_read_header(&dinfo, TRUE))
           ThrowRDE("DngDecoderSlices: Unable to read JPEG header");
@@ -204,6 +205,8 @@ void DngDecoderSlices::decodeSlice(DngDecoderThread* t) {
               *dst++ = (*src++);
           }
         }
+        if (mRaw->stats)
+          mRaw->stats->addCount(COUNTER_BYTES, e.byteCount);
       } catch (RawDecoderException &err) {
         mRaw->setError(err.what());
       } catch (IOException &err) {
@@ -31,10 +31,10 @@ namespace RawSpeed {
 class DngSliceElement
 {
 public:
-  DngSliceElement(uint32 off, uint32 count, uint32 offsetX, uint32 offsetY) : 
+  DngSliceElement(uint64 off, uint32 count, uint32 offsetX, uint32 offsetY) : 
       byteOffset(off), byteCount(count), offX(offsetX), offY(offsetY), mUseBigtable(false) {};
   ~DngSliceElement(void) {};
-  const uint32 byteOffset;
+  const uint64 byteOffset;
   const uint32 byteCount;
   const uint32 offX;
   const uint32 offY;
@@ -47,7 +47,6 @@ class DngDecoderThread
 public:
   DngDecoderThread(void) {}
   ~DngDecoderThread(void) {}
-  pthread_t threadid;
   queue<DngSliceElement> slices;
   DngDecoderSlices* parent;
 };
@@ -56,7 +55,7 @@ public:
 class DngDecoderSlices
 {
 public:
-  DngDecoderSlices(FileMap* file, RawImage img, int compression );
+  DngDecoderSlices(FileMap* file, const RawImage& img, int compression );
   ~DngDecoderSlices(void);
   void addSlice(DngSliceElement slice);
   void startDecoding();
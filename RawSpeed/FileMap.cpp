@@ -1,5 +1,8 @@
 #include "StdAfx.h"
 #include "FileMap.h"
+#if defined(__unix__) || defined(__APPLE__) 
+#include <sys/mman.h>
+#endif
 /*
     RawSpeed - RAW file decoder.
 
@@ -24,53 +27,166 @@
 
 namespace RawSpeed {
 
-FileMap::FileMap(uint32 _size) : size(_size) {
+FileMap::FileMap(uint64 _size) : size(_size) {
   if (!size)
     throw FileIOException("Filemap of 0 bytes not possible");
-  data = (uchar8*)_aligned_malloc(size + 16, 16);
+  if (size > (uint64)((size_t)-1) - FILEMAP_MARGIN)
+    throw FileIOException("File is too large to be opened.");
+  data = (uchar8*)_aligned_malloc((size_t)size + FILEMAP_MARGIN, 16);
   if (!data) {
     throw FileIOException("Not enough memory to open file.");
   }
   mOwnAlloc = true;
+  mMapSize = 0;
+  mLoader = NULL;
+  mParent = NULL;
 }
 
-FileMap::FileMap(uchar8* _data, uint32 _size): data(_data), size(_size) {
+FileMap::FileMap(const uchar8* _data, uint64 _size): data((uchar8*)_data), size(_size) {
   mOwnAlloc = false;
+  mMapSize = 0;
+  mLoader = NULL;
+  mParent = NULL;
 }
 
+FileMap::FileMap(uchar8* _data, uint64 _size, uint64 _mapSize): data(_data), size(_size) {
+  mOwnAlloc = false;
+  mMapSize = _mapSize;
+  mLoader = NULL;
+  mParent = NULL;
+}
+
+FileMap::FileMap(FileMap* parent, uint64 offset, uint64 _size) : size(_size) {
+  if (offset > parent->size || size > parent->size - offset)
+    throw IOException("FileMap: Attempting to map outside of file.");
+  data = &parent->data[offset];
+  mOwnAlloc = false;
+  mMapSize = 0;
+  mLoader = NULL;
+  mParent = (parent->mLoader || parent->mParent) ? parent : NULL;
+  mParentOffset = offset;
+}
+
+FileMap::FileMap(uint64 _size, FileMapLoader* _loader) : size(_size) {
+  mLoader = NULL;
+  mParent = NULL;
+  if (!size) {
+    delete _loader;
+    throw FileIOException("Filemap of 0 bytes not possible");
+  }
+  if (size > (uint64)((size_t)-1) - FILEMAP_MARGIN) {
+    delete _loader;
+    throw FileIOException("File is too large to be opened.");
+  }
+  // Memory is only used for the pages that are read into.
+  data = (uchar8*)_aligned_malloc((size_t)size + FILEMAP_MARGIN, 16);
+  if (!data) {
+    delete _loader;
+    throw FileIOException("Not enough memory to open file.");
+  }
+  memset(&data[size], 0, FILEMAP_MARGIN);
+  mOwnAlloc = true;
+  mMapSize = 0;
+  mLoader = _loader;
+  mLoaded.resize((size_t)((size + FILEMAP_BLOCK_SIZE - 1) / FILEMAP_BLOCK_SIZE), false);
+  pthread_mutex_init(&mLoadMutex, NULL);
+}
 
 FileMap::~FileMap(void) {
   if (data && mOwnAlloc) {
     _aligned_free(data);
   }
+#if defined(__unix__) || defined(__APPLE__) 
+  if (data && mMapSize) {
+    munmap(data, (size_t)mMapSize);
+  }
+#endif
+  if (mLoader) {
+    delete mLoader;
+    pthread_mutex_destroy(&mLoadMutex);
+  }
+  mLoader = NULL;
   data = 0;
   size = 0;
 }
 
 FileMap* FileMap::clone() {
+  prefetch(0, size);
   FileMap *new_map = new FileMap(size);
-  memcpy(new_map->data, data, size);
+  memcpy(new_map->data, data, (size_t)size);
   return new_map;
 }
 
 FileMap* FileMap::cloneRandomSize() {
-  uint32 new_size = (rand() | (rand() << 15)) % size;
+  uint64 new_size = (rand() | (rand() << 15)) % size;
+  prefetch(0, new_size);
   FileMap *new_map = new FileMap(new_size);
-  memcpy(new_map->data, data, new_size);
+  memcpy(new_map->data, data, (size_t)new_size);
   return new_map;
 }
 
 void FileMap::corrupt(int errors) {
+  prefetch(0, size);
   for (int i = 0; i < errors; i++) {
-    uint32 pos = (rand() | (rand() << 15)) % size;
+    uint64 pos = (rand() | (rand() << 15)) % size;
     data[pos] = rand() & 0xff;
   }
 }
 
-const uchar8* FileMap::getData( uint32 offset )
+const uchar8* FileMap::getData( uint64 offset )
 {
   if (offset >= size)
     throw IOException("FileMap: Attempting to read out of file.");
+  if (mLoader || mParent)
+    load(offset, FILEMAP_BLOCK_SIZE);
   return &data[offset];
 }
+
+const uchar8* FileMap::getData( uint64 offset, uint64 count )
+{
+  if (offset >= size)
+    throw IOException("FileMap: Attempting to read out of file.");
+  if (mLoader || mParent)
+    load(offset, count);
+  return &data[offset];
+}
+
+void FileMap::prefetch( uint64 offset, uint64 count )
+{
+  if ((mLoader || mParent) && offset < size)
+    load(offset, count);
+}
+
+/* Reads all blocks in the range that haven't been read. Range is limited to the end of the file. */
+void FileMap::load( uint64 offset, uint64 count )
+{
+  uint64 end = count > size - offset ? size : offset + count;
+  if (mParent) {
+    mParent->load(mParentOffset + offset, end - offset);
+    return;
+  }
+  uint64 block = offset / FILEMAP_BLOCK_SIZE;
+  uint64 last = (end + FILEMAP_BLOCK_SIZE - 1) / FILEMAP_BLOCK_SIZE;
+
+  pthread_mutex_lock(&mLoadMutex);
+  while (block < last) {
+    if (mLoaded[(size_t)block]) {
+      block++;
+      continue;
+    }
+    // Read all consecutive blocks that are missing at once
+    uint64 run_end = block;
+    while (run_end < last && !mLoaded[(size_t)run_end])
+      run_end++;
+    uint64 start = block * FILEMAP_BLOCK_SIZE;
+    uint64 stop = min(run_end * FILEMAP_BLOCK_SIZE, size);
+    if (!mLoader->read(&data[start], start, stop - start)) {
+      pthread_mutex_unlock(&mLoadMutex);
+      ThrowFIE("FileMap: Could not read %llu bytes at offset %llu from file.", stop - start, start);
+    }
+    for (; block < run_end; block++)
+      mLoaded[(size_t)block] = true;
+  }
+  pthread_mutex_unlock(&mLoadMutex);
+}
 } // namespace RawSpeed
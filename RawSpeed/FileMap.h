@@ -28,32 +28,77 @@
 
 namespace RawSpeed {
 
+/* Number of readable bytes that follow the file data in maps allocated by FileMap */
+#define FILEMAP_MARGIN 16
+
+/* Lazily loaded maps are read in blocks of this size */
+#define FILEMAP_BLOCK_SIZE (64*1024)
+
+/* Reads parts of a file into a lazily loaded FileMap */
+class FileMapLoader
+{
+public:
+  virtual ~FileMapLoader(void) {};
+  /* Read "count" bytes at "offset" in the file into dest. Returns false if the data could not be read. */
+  virtual bool read(uchar8* dest, uint64 offset, uint64 count) = 0;
+};
+
 /*************************************************************************
  * This is the basic file map
  *
  * It allows access to a file.
  * Base implementation is for a complete file that is already in memory.
  * This can also be done as a MemMap 
+ *
+ * The data is never modified by the decoders, and readers do not
+ * rely on data being readable past the end of the map.
+ *
+ * A map can also be loaded lazily, where data is read from the file
+ * as it is requested. In that case only data returned by getData()
+ * may be accessed: getData(offset) makes FILEMAP_BLOCK_SIZE bytes
+ * available, which is enough for file structures, and getData(offset, count)
+ * makes "count" bytes available.
  * 
  *****************************/
 class FileMap
 {
 public:
-  FileMap(uint32 _size);                 // Allocates the data array itself
-  FileMap(uchar8* _data, uint32 _size);  // Data already allocated, if possible allocate 16 extra bytes.
+  FileMap(uint64 _size);                 // Allocates the data array itself
+  FileMap(const uchar8* _data, uint64 _size);  // Wraps data owned by the caller without copying. No padding is needed.
+  /* Memory mapped file. _data must have at least FILEMAP_MARGIN readable bytes after _size. */
+  /* The _mapSize bytes at _data are unmapped when the FileMap is destroyed. */
+  FileMap(uchar8* _data, uint64 _size, uint64 _mapSize);
+  /* Lazily loaded file. Data is read by the loader when it is requested. */
+  /* The loader is deleted when the FileMap is destroyed. */
+  FileMap(uint64 _size, FileMapLoader* _loader);
+  /* Part of another map, starting at "offset". Lazily loaded data is read through the parent, */
+  /* which must remain valid while this object exists. */
+  FileMap(FileMap* parent, uint64 offset, uint64 _size);
   ~FileMap(void);
-  const uchar8* getData(uint32 offset);
-  uchar8* getDataWrt(uint32 offset) {return &data[offset];}
-  uint32 getSize() {return size;}
-  bool isValid(uint32 offset) {return offset<=size;}
+  const uchar8* getData(uint64 offset);
+  const uchar8* getData(uint64 offset, uint64 count);  // Use when reading more than a few bytes
+  /* Reads data that will be needed, if the map is lazily loaded. */
+  /* Data is read in a single request, instead of as it is requested. */
+  void prefetch(uint64 offset, uint64 count);
+  uchar8* getDataWrt(uint64 offset) {return &data[offset];}  // Only for filling maps that own their data
+  uint64 getSize() {return size;}
+  bool isValid(uint64 offset) {return offset<=size;}
+  bool isValid(uint64 offset, uint64 count) {return offset+count<=size;}  // Check that "count" bytes from "offset" are inside the file
   FileMap* clone();
   /* For testing purposes */
   void corrupt(int errors);
   FileMap* cloneRandomSize();
 private:
  uchar8* data;
- uint32 size;
+ uint64 size;
  bool mOwnAlloc;
+ uint64 mMapSize;   // Size of memory mapping, 0 if not mapped
+ void load(uint64 offset, uint64 count);
+ FileMapLoader* mLoader;    // NULL if all data is in memory
+ FileMap* mParent;          // Map this is a part of, if it may need loading
+ uint64 mParentOffset;
+ vector<bool> mLoaded;      // Blocks that have been read
+ pthread_mutex_t mLoadMutex;
 };
 
 } // namespace RawSpeed
@@ -5,7 +5,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
-//#include <sys/mman.h>
+#include <errno.h>
+#include <sys/mman.h>
 #endif // __unix__
 /*
     RawSpeed - RAW file decoder.
@@ -32,43 +33,136 @@
 namespace RawSpeed {
 
 FileReader::FileReader(LPCWSTR _filename) : mFilename(_filename) {
+  useMemoryMap = true;
 }
 
+/* Reads from an open file into a lazily loaded FileMap, and closes the file when deleted */
+class FileReaderLoader : public FileMapLoader
+{
+public:
+#if defined(__unix__) || defined(__APPLE__) 
+  FileReaderLoader(int _fd) : fd(_fd) {};
+  virtual ~FileReaderLoader(void) { close(fd); };
+  virtual bool read(uchar8* dest, uint64 offset, uint64 count) {
+    while (count) {
+      ssize_t bytes_read = pread(fd, dest, (size_t)min(count, (uint64)1 << 30), (off_t)offset);
+      if (bytes_read < 0 && errno == EINTR)
+        continue;
+      if (bytes_read <= 0)
+        return false;
+      dest += bytes_read;
+      offset += bytes_read;
+      count -= bytes_read;
+    }
+    return true;
+  }
+private:
+  int fd;
+#else
+  FileReaderLoader(HANDLE _file_h) : file_h(_file_h) {};
+  virtual ~FileReaderLoader(void) { CloseHandle(file_h); };
+  virtual bool read(uchar8* dest, uint64 offset, uint64 count) {
+    while (count) {
+      OVERLAPPED pos;
+      memset(&pos, 0, sizeof(OVERLAPPED));
+      pos.Offset = (DWORD)offset;
+      pos.OffsetHigh = (DWORD)(offset >> 32);
+      DWORD bytes_read;
+      DWORD block = (DWORD)min(count, (uint64)1 << 30);
+      if (!ReadFile(file_h, dest, block, &bytes_read, &pos) || !bytes_read)
+        return false;
+      dest += bytes_read;
+      offset += bytes_read;
+      count -= bytes_read;
+    }
+    return true;
+  }
+private:
+  HANDLE file_h;
+#endif
+};
+
+#if defined(__unix__) || defined(__APPLE__) 
+/* Maps the file into memory, followed by at least FILEMAP_MARGIN zero bytes. */
+/* Returns NULL if the file cannot be mapped, so it can be read instead. */
+FileMap* FileReader::mapFile() {
+  int fd = open(mFilename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (uint64)st.st_size > (uint64)((size_t)-1) - FILEMAP_MARGIN - page) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  size_t file_size = (size + page - 1) & ~(page - 1);
+  size_t map_size = (size + FILEMAP_MARGIN + page - 1) & ~(page - 1);
+
+  // Reserve room for the file and the margin. Pages beyond the end of the file
+  // cannot be accessed in a file mapping, so they are kept as anonymous zero pages.
+  uchar8* area = (uchar8*)mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (area == (uchar8*)MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  // Private and writable, so it behaves like an allocated map.
+  void* pa = mmap(area, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  close(fd);
+  if (pa == MAP_FAILED) {
+    munmap(area, map_size);
+    return NULL;
+  }
+#ifdef MADV_WILLNEED
+  // Start reading the file in the background, it will all be needed.
+  madvise(area, file_size, MADV_WILLNEED);
+#endif
+  return new FileMap(area, size, map_size);
+}
+#endif // __unix__
+
 FileMap* FileReader::readFile() {
 #if defined(__unix__) || defined(__APPLE__) 
-  int bytes_read = 0;
+  if (useMemoryMap) {
+    FileMap *mapped = mapFile();
+    if (mapped)
+      return mapped;
+  }
+
+  size_t bytes_read = 0;
   FILE *file;
   char *dest;
-  long size;
+  off_t size;
 
   file = fopen(mFilename, "rb");
   if (file == NULL)
     throw FileIOException("Could not open file.");
-  fseek(file, 0, SEEK_END);
-  size = ftell(file);
+  fseeko(file, 0, SEEK_END);
+  size = ftello(file);
   if (size <= 0) {
     fclose(file);
     throw FileIOException("File is 0 bytes.");
   }
-  fseek(file, 0, SEEK_SET);
-
-#if 0
-  // Not used, as it is slower than sync read
+  fseeko(file, 0, SEEK_SET);
 
-  uchar8* pa = (uchar8*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-  FileMap *fileData = new FileMap(pa, size);
-
-#else
-  FileMap *fileData = new FileMap(size);
+  FileMap *fileData;
+  try {
+    fileData = new FileMap((uint64)size);
+  } catch (FileIOException &) {
+    fclose(file);
+    throw;
+  }
 
   dest = (char *)fileData->getDataWrt(0);
-  bytes_read = fread(dest, 1, size, file);
+  bytes_read = fread(dest, 1, (size_t)size, file);
   fclose(file);
-  if (size != bytes_read) {
+  if ((size_t)size != bytes_read) {
     delete fileData;
     throw FileIOException("Could not read file.");
   }
-#endif
 
 #else // __unix__
   HANDLE file_h;  // File handle
@@ -80,16 +174,30 @@ FileMap* FileReader::readFile() {
   LARGE_INTEGER f_size;
   GetFileSizeEx(file_h , &f_size);
 
-  if (!f_size.LowPart)
+  if (!f_size.QuadPart) {
+    CloseHandle(file_h);
     throw FileIOException("File is 0 bytes.");
+  }
 
-  FileMap *fileData = new FileMap(f_size.LowPart);
-
-  DWORD bytes_read;
-  if (! ReadFile(file_h, fileData->getDataWrt(0), fileData->getSize(), &bytes_read, NULL)) {
+  FileMap *fileData;
+  try {
+    fileData = new FileMap((uint64)f_size.QuadPart);
+  } catch (FileIOException &) {
     CloseHandle(file_h);
-    delete fileData;
-    throw FileIOException("Could not read file.");
+    throw;
+  }
+
+  // ReadFile can read at most 4GB at the time, so read in blocks.
+  uint64 pos = 0;
+  while (pos < fileData->getSize()) {
+    DWORD bytes_read;
+    DWORD block = (DWORD)MIN(fileData->getSize() - pos, (uint64)1 << 30);
+    if (! ReadFile(file_h, fileData->getDataWrt(pos), block, &bytes_read, NULL) || !bytes_read) {
+      CloseHandle(file_h);
+      delete fileData;
+      throw FileIOException("Could not read file.");
+    }
+    pos += bytes_read;
   }
   CloseHandle(file_h);
 
@@ -97,6 +205,36 @@ FileMap* FileReader::readFile() {
   return fileData;
 }
 
+FileMap* FileReader::readFileLazy() {
+#if defined(__unix__) || defined(__APPLE__) 
+  int fd = open(mFilename, O_RDONLY);
+  if (fd < 0)
+    throw FileIOException("Could not open file.");
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    throw FileIOException("File is 0 bytes.");
+  }
+#if defined(POSIX_FADV_RANDOM)
+  // Only the requested parts are read, so read-ahead would be wasted.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+  return new FileMap((uint64)st.st_size, new FileReaderLoader(fd));
+
+#else // __unix__
+  HANDLE file_h = CreateFile(mFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+  if (file_h == INVALID_HANDLE_VALUE) {
+    throw FileIOException("Could not open file.");
+  }
+  LARGE_INTEGER f_size;
+  if (!GetFileSizeEx(file_h , &f_size) || !f_size.QuadPart) {
+    CloseHandle(file_h);
+    throw FileIOException("File is 0 bytes.");
+  }
+  return new FileMap((uint64)f_size.QuadPart, new FileReaderLoader(file_h));
+#endif // __unix__
+}
+
 FileReader::~FileReader(void) {
 
 }
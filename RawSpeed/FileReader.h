@@ -33,10 +33,21 @@ public:
 	FileReader(LPCWSTR filename);
 public:
 	FileMap* readFile();
+  /* Opens the file without reading it. Data is read when it is requested from the FileMap, */
+  /* so only the parts of the file that are used are read. */
+  /* The file is kept open until the FileMap is deleted. */
+	FileMap* readFileLazy();
 	virtual ~FileReader();
   LPCWSTR Filename() const { return mFilename; }
 //  void Filename(LPCWSTR val) { mFilename = val; }
+
+  /* Memory map the file instead of reading it, where supported (default). */
+  /* If the file cannot be mapped, it is read into memory instead. */
+  bool useMemoryMap;
 private:
+#if defined(__unix__) || defined(__APPLE__) 
+  FileMap* mapFile();
+#endif
   LPCWSTR mFilename;
 };
 
@@ -0,0 +1,185 @@
+#include "StdAfx.h"
+#include "HuffmanTableCache.h"
+#include "RefCountedCache.h"
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+// Number of values in huffval
+static uint32 getValueCount(const HuffmanTable *t) {
+  uint32 acc = 0;
+  for (uint32 i = 1; i <= 16; i++)
+    acc += t->bits[i];
+  return min(acc, 256u);
+}
+
+// FNV-1a of the DHT content and the options
+static uint32 getTableHash(const HuffmanTable *t, uint32 prec, bool dngCompatible, bool useBigtable) {
+  uint32 h = 2166136261u;
+  for (uint32 i = 1; i <= 16; i++)
+    h = (h ^ t->bits[i]) * 16777619u;
+  uint32 acc = getValueCount(t);
+  for (uint32 i = 0; i < acc; i++)
+    h = (h ^ t->huffval[i]) * 16777619u;
+  h = (h ^ prec) * 16777619u;
+  return (h ^ ((dngCompatible ? 1 : 0) | (useBigtable ? 2 : 0))) * 16777619u;
+}
+
+static bool isSameTable(const HuffmanTable *a, const HuffmanTable *b) {
+  if (memcmp(&a->bits[1], &b->bits[1], 16 * sizeof(uint32)))
+    return false;
+  return !memcmp(a->huffval, b->huffval, getValueCount(a) * sizeof(uint32));
+}
+
+/* What a table is found by: the DHT content of "table", and the options */
+class HuffmanTableKey
+{
+public:
+  HuffmanTableKey(const HuffmanTable *t, uint32 _prec, bool _dngCompatible, bool _useBigtable) :
+      table(t), hash(getTableHash(t, _prec, _dngCompatible, _useBigtable)), prec(_prec),
+      dngCompatible(_dngCompatible), useBigtable(_useBigtable) {};
+  const HuffmanTable* table;
+  uint32 hash;
+  uint32 prec;
+  bool dngCompatible;
+  bool useBigtable;
+};
+
+class HuffmanTableCacheEntry
+{
+public:
+  HuffmanTableCacheEntry(HuffmanTable *t, const HuffmanTableKey& k) :
+      table(t), hash(k.hash), prec(k.prec), dngCompatible(k.dngCompatible), useBigtable(k.useBigtable), refs(0) {
+    t->cacheEntry = this;
+  };
+  bool matches(const HuffmanTableKey& k) const {
+    return hash == k.hash && prec == k.prec && dngCompatible == k.dngCompatible &&
+           useBigtable == k.useBigtable && isSameTable(table, k.table);
+  }
+  HuffmanTable* table;
+  uint32 hash;
+  uint32 prec;
+  bool dngCompatible;
+  bool useBigtable;
+  uint32 refs;        // Number of acquire()/insert() not yet released
+  vector<pair<HuffmanTableCacheEntry*, int*> > pairs;  // Pair tables, with this as the first table
+};
+
+class HuffmanTableCacheImpl : public RefCountedCache<HuffmanTableCacheEntry, HuffmanTableKey>
+{
+public:
+  HuffmanTableCacheImpl() : RefCountedCache<HuffmanTableCacheEntry, HuffmanTableKey>(HUFFMAN_CACHE_UNUSED_TABLES) {};
+  int* getPairTable(HuffmanTableCacheEntry* a, HuffmanTableCacheEntry* b);
+  int* insertPairTable(HuffmanTableCacheEntry* a, HuffmanTableCacheEntry* b, int* pairTable);
+protected:
+  virtual void deleteEntry(HuffmanTableCacheEntry* e);
+};
+
+// Never deleted, see RefCountedCache
+static HuffmanTableCacheImpl* table_cache = NULL;
+static pthread_once_t table_cache_once = PTHREAD_ONCE_INIT;
+
+static void createTableCache() {
+  table_cache = new HuffmanTableCacheImpl();
+}
+
+static HuffmanTableCacheImpl* getTableCache() {
+  pthread_once(&table_cache_once, createTableCache);
+  return table_cache;
+}
+
+int* HuffmanTableCacheImpl::getPairTable(HuffmanTableCacheEntry* a, HuffmanTableCacheEntry* b) {
+  int* table = NULL;
+  pthread_mutex_lock(&mutex);
+  for (uint32 i = 0; i < a->pairs.size(); i++) {
+    if (a->pairs[i].first == b)
+      table = a->pairs[i].second;
+  }
+  pthread_mutex_unlock(&mutex);
+  return table;
+}
+
+int* HuffmanTableCacheImpl::insertPairTable(HuffmanTableCacheEntry* a, HuffmanTableCacheEntry* b, int* pairTable) {
+  pthread_mutex_lock(&mutex);
+  for (uint32 i = 0; i < a->pairs.size(); i++) {
+    if (a->pairs[i].first == b) {
+      int* table = a->pairs[i].second;
+      pthread_mutex_unlock(&mutex);
+      _aligned_free(pairTable);
+      return table;
+    }
+  }
+  a->pairs.push_back(make_pair(b, pairTable));
+  pthread_mutex_unlock(&mutex);
+  return pairTable;
+}
+
+// Also deletes pair tables using the entry.
+void HuffmanTableCacheImpl::deleteEntry(HuffmanTableCacheEntry* e) {
+  for (list<HuffmanTableCacheEntry*>::iterator i = entries.begin(); i != entries.end(); ++i) {
+    vector<pair<HuffmanTableCacheEntry*, int*> > &pairs = (*i)->pairs;
+    for (uint32 j = 0; j < pairs.size(); ) {
+      if (pairs[j].first == e) {
+        _aligned_free(pairs[j].second);
+        pairs.erase(pairs.begin() + j);
+      } else {
+        j++;
+      }
+    }
+  }
+  for (uint32 j = 0; j < e->pairs.size(); j++)
+    _aligned_free(e->pairs[j].second);
+  if (e->table->bigTable)
+    _aligned_free(e->table->bigTable);
+  delete e->table;
+  delete e;
+}
+
+HuffmanTable* HuffmanTableCache::acquire(const HuffmanTable *t, uint32 prec, bool dngCompatible, bool useBigtable) {
+  HuffmanTableCacheEntry* e = getTableCache()->acquire(HuffmanTableKey(t, prec, dngCompatible, useBigtable));
+  return e ? e->table : NULL;
+}
+
+HuffmanTable* HuffmanTableCache::insert(HuffmanTable *t, uint32 prec, bool dngCompatible, bool useBigtable) {
+  HuffmanTableKey key(t, prec, dngCompatible, useBigtable);
+  HuffmanTableCacheEntry* e = getTableCache()->insert(new HuffmanTableCacheEntry(t, key), key);
+  return e->table;
+}
+
+void HuffmanTableCache::release(HuffmanTable *t) {
+  getTableCache()->release(t->cacheEntry);
+}
+
+int* HuffmanTableCache::getPairTable(HuffmanTable *a, HuffmanTable *b) {
+  return getTableCache()->getPairTable(a->cacheEntry, b->cacheEntry);
+}
+
+int* HuffmanTableCache::insertPairTable(HuffmanTable *a, HuffmanTable *b, int* pairTable) {
+  return getTableCache()->insertPairTable(a->cacheEntry, b->cacheEntry, pairTable);
+}
+
+void HuffmanTableCache::flush() {
+  getTableCache()->flush();
+}
+
+} // namespace RawSpeed
@@ -0,0 +1,78 @@
+#ifndef HUFFMAN_TABLE_CACHE_H
+#define HUFFMAN_TABLE_CACHE_H
+
+#include "LJpegDecompressor.h"
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/* Number of tables no longer in use, that are kept for the next image */
+#define HUFFMAN_CACHE_UNUSED_TABLES 16
+
+/*************************************************************************
+ * Process-wide cache of built Huffman tables
+ *
+ * Tables are found by the content of the DHT (bits and huffval), and the
+ * options used for building them, so all slices of a CR2 and all tiles
+ * of a DNG share one table, and one bigTable.
+ * Returned tables are shared between threads, and must not be modified.
+ * Each acquire() or insert() must be matched by a release(). Tables that
+ * are no longer used are kept, up to HUFFMAN_CACHE_UNUSED_TABLES, and
+ * the least recently used are deleted.
+ * Pair tables (see LJpegDecompressor::getPairTable()) are kept with
+ * the first table, and deleted with either table.
+ * The cache itself is never deleted, so it can be used by pool threads
+ * while static objects are destroyed. flush() deletes the tables.
+ *
+ *****************************/
+class HuffmanTableCache
+{
+public:
+  /* Returns a built table with the bits and huffval of "t", and the given options. */
+  /* NULL if none is cached. */
+  static HuffmanTable* acquire(const HuffmanTable *t, uint32 prec, bool dngCompatible, bool useBigtable);
+
+  /* Adds a table built by the caller. The cache takes ownership of "t" and its bigTable. */
+  /* If another thread has added the same table meanwhile, "t" is deleted, and the */
+  /* cached table returned. */
+  static HuffmanTable* insert(HuffmanTable *t, uint32 prec, bool dngCompatible, bool useBigtable);
+
+  /* Release a table returned by acquire() or insert() */
+  static void release(HuffmanTable *t);
+
+  /* Returns the pair table for "a" followed by "b", NULL if none is cached. */
+  /* Both must be tables returned by the cache. */
+  static int* getPairTable(HuffmanTable *a, HuffmanTable *b);
+
+  /* Adds a pair table, allocated with _aligned_malloc. Returns the table to use, */
+  /* which is another thread's table, if it was added first. */
+  static int* insertPairTable(HuffmanTable *a, HuffmanTable *b, int* pairTable);
+
+  /* Deletes all tables not in use */
+  static void flush();
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -0,0 +1,180 @@
+#include "StdAfx.h"
+#include "ImageBufferPool.h"
+#include "RawDecoderException.h"
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+static ImageBufferPool* image_pool_instance = NULL;
+static pthread_mutex_t image_pool_instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* defaultImageAlloc(uint64 size, void* /*userData*/) {
+  if (size != (uint64)(size_t)size)
+    return NULL;
+  return _aligned_malloc((size_t)size, 16);
+}
+
+static void defaultImageFree(void* buffer, uint64 /*size*/, void* /*userData*/) {
+  _aligned_free(buffer);
+}
+
+ImageBufferPool::ImageBufferPool(void) :
+    mMaxPooledBytes(IMAGE_POOL_DEFAULT_MAX_BYTES),
+    mAllocFunc(defaultImageAlloc), mFreeFunc(defaultImageFree), mUserData(NULL) {
+  pthread_mutex_init(&mMutex, NULL);
+}
+
+ImageBufferPool::~ImageBufferPool(void) {
+  trim();
+  pthread_mutex_destroy(&mMutex);
+}
+
+ImageBufferPool* ImageBufferPool::getPool() {
+  pthread_mutex_lock(&image_pool_instance_mutex);
+  if (!image_pool_instance)
+    image_pool_instance = new ImageBufferPool();
+  ImageBufferPool* p = image_pool_instance;
+  pthread_mutex_unlock(&image_pool_instance_mutex);
+  return p;
+}
+
+void ImageBufferPool::shutdown() {
+  pthread_mutex_lock(&image_pool_instance_mutex);
+  ImageBufferPool* p = image_pool_instance;
+  if (p && p->mStats.bytesInUse) {
+    // Images are still alive, so keep the pool for them, but free the unused memory
+    p->trim();
+    p = NULL;
+  } else {
+    image_pool_instance = NULL;
+  }
+  pthread_mutex_unlock(&image_pool_instance_mutex);
+  if (p)
+    delete p;
+}
+
+uint64 ImageBufferPool::getSizeClass(uint64 size) {
+  // Small buffers are rounded to whole pages
+  if (size <= 65536)
+    return (size + 4095) & ~(uint64)4095;
+  // Larger buffers use 8 classes per power of two
+  uint32 bits = 0;
+  while ((size >> bits) > 15)
+    bits++;
+  uint64 step = (uint64)1 << bits;
+  return (size + step - 1) & ~(step - 1);
+}
+
+uchar8* ImageBufferPool::alloc(uint64 size) {
+  size = getSizeClass(size);
+  pthread_mutex_lock(&mMutex);
+  for (list<PooledBuffer>::iterator i = mFree.begin(); i != mFree.end(); i++) {
+    if (i->size == size) {
+      uchar8* data = i->data;
+      mFree.erase(i);
+      mStats.reuses++;
+      mStats.bytesPooled -= size;
+      mStats.bytesInUse += size;
+      mStats.peakBytesInUse = max(mStats.peakBytesInUse, mStats.bytesInUse);
+      pthread_mutex_unlock(&mMutex);
+      return data;
+    }
+  }
+  uchar8* data = (uchar8*)mAllocFunc(size, mUserData);
+  if (!data && !mFree.empty()) {
+    // Give the unused buffers back, and try again
+    evict(0);
+    data = (uchar8*)mAllocFunc(size, mUserData);
+  }
+  if (data) {
+    mStats.allocations++;
+    mStats.bytesInUse += size;
+    mStats.peakBytesInUse = max(mStats.peakBytesInUse, mStats.bytesInUse);
+  }
+  pthread_mutex_unlock(&mMutex);
+  return data;
+}
+
+void ImageBufferPool::release(uchar8* buffer, uint64 size) {
+  if (!buffer)
+    return;
+  size = getSizeClass(size);
+  pthread_mutex_lock(&mMutex);
+  mStats.bytesInUse -= size;
+  if (size > mMaxPooledBytes) {
+    mFreeFunc(buffer, size, mUserData);
+    mStats.releases++;
+  } else {
+    evict(mMaxPooledBytes - size);
+    mFree.push_front(PooledBuffer(buffer, size));
+    mStats.bytesPooled += size;
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void ImageBufferPool::evict(uint64 maxBytes) {
+  while (mStats.bytesPooled > maxBytes) {
+    PooledBuffer &b = mFree.back();
+    mFreeFunc(b.data, b.size, mUserData);
+    mStats.bytesPooled -= b.size;
+    mStats.releases++;
+    mFree.pop_back();
+  }
+}
+
+void ImageBufferPool::setMaxPooledBytes(uint64 bytes) {
+  pthread_mutex_lock(&mMutex);
+  mMaxPooledBytes = bytes;
+  evict(bytes);
+  pthread_mutex_unlock(&mMutex);
+}
+
+void ImageBufferPool::setAllocator(ImageBufferAllocFunc allocFunc, ImageBufferFreeFunc freeFunc, void* userData) {
+  if ((allocFunc == NULL) != (freeFunc == NULL))
+    ThrowRDE("ImageBufferPool::setAllocator: Both allocation and free function must be set.");
+  pthread_mutex_lock(&mMutex);
+  if (mStats.bytesInUse) {
+    pthread_mutex_unlock(&mMutex);
+    ThrowRDE("ImageBufferPool::setAllocator: Cannot change allocator while images are allocated.");
+  }
+  evict(0);
+  mAllocFunc = allocFunc ? allocFunc : defaultImageAlloc;
+  mFreeFunc = freeFunc ? freeFunc : defaultImageFree;
+  mUserData = allocFunc ? userData : NULL;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void ImageBufferPool::trim() {
+  pthread_mutex_lock(&mMutex);
+  evict(0);
+  pthread_mutex_unlock(&mMutex);
+}
+
+ImageBufferPoolStats ImageBufferPool::getStats() {
+  pthread_mutex_lock(&mMutex);
+  ImageBufferPoolStats s = mStats;
+  pthread_mutex_unlock(&mMutex);
+  return s;
+}
+
+} // namespace RawSpeed
@@ -0,0 +1,117 @@
+#ifndef IMAGE_BUFFER_POOL_H
+#define IMAGE_BUFFER_POOL_H
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/* Allocator hook. Must return memory aligned to at least 16 bytes, or NULL on failure. */
+/* "size" is passed to the free function, so it can be used for munmap, etc. */
+typedef void* (*ImageBufferAllocFunc)(uint64 size, void* userData);
+typedef void (*ImageBufferFreeFunc)(void* buffer, uint64 size, void* userData);
+
+/* Default maximum number of bytes kept in unused buffers */
+#define IMAGE_POOL_DEFAULT_MAX_BYTES (256*1024*1024)
+
+class ImageBufferPoolStats
+{
+public:
+  ImageBufferPoolStats() : allocations(0), reuses(0), releases(0),
+      bytesInUse(0), bytesPooled(0), peakBytesInUse(0) {};
+  uint64 allocations;     // Buffers returned by the allocator
+  uint64 reuses;          // Buffers handed out from the pool
+  uint64 releases;        // Buffers given back to the allocator
+  uint64 bytesInUse;      // Bytes currently handed out
+  uint64 bytesPooled;     // Bytes kept in unused buffers
+  uint64 peakBytesInUse;
+};
+
+/*************************************************************************
+ * Process-wide pool of image buffers
+ *
+ * RawImageData allocates its pixel data from here, and returns it when
+ * the image is destroyed. Returned buffers are kept, and handed out
+ * again for images of the same size class, so decoding a series of
+ * similar images does not allocate, or page fault in, new memory.
+ * Sizes are rounded up to one of 8 classes per power of two, so at
+ * most 12.5% is wasted.
+ * Buffers are not cleared, when they are handed out.
+ *
+ *****************************/
+class ImageBufferPool
+{
+public:
+  /* Returns the pool, creating it if needed */
+  static ImageBufferPool* getPool();
+
+  /* Frees all pooled buffers, and deletes the pool, unless buffers are in use. */
+  /* Must not be called while images are being created. */
+  static void shutdown();
+
+  /* Returns a buffer of at least "size" bytes, aligned to 16 bytes, or NULL */
+  uchar8* alloc(uint64 size);
+
+  /* Return a buffer from alloc() - "size" must be the size it was allocated with */
+  void release(uchar8* buffer, uint64 size);
+
+  /* Maximum number of bytes kept in unused buffers. */
+  /* Least recently used buffers are freed first. 0 disables pooling. */
+  void setMaxPooledBytes(uint64 bytes);
+
+  /* Use a custom allocator, for instance for huge pages. */
+  /* NULL functions restores the default. Pooled buffers are freed. */
+  /* Throws if buffers are in use. */
+  void setAllocator(ImageBufferAllocFunc allocFunc, ImageBufferFreeFunc freeFunc, void* userData = NULL);
+
+  /* Free all unused buffers */
+  void trim();
+
+  ImageBufferPoolStats getStats();
+
+  /* Size that will be allocated for a request of "size" bytes */
+  static uint64 getSizeClass(uint64 size);
+
+private:
+  class PooledBuffer
+  {
+  public:
+    PooledBuffer(uchar8* _data, uint64 _size) : data(_data), size(_size) {};
+    uchar8* data;
+    uint64 size;
+  };
+
+  ImageBufferPool(void);
+  ~ImageBufferPool(void);
+  void evict(uint64 maxBytes);   // Must be called with mMutex held
+  list<PooledBuffer> mFree;      // Most recently released first
+  uint64 mMaxPooledBytes;
+  ImageBufferAllocFunc mAllocFunc;
+  ImageBufferFreeFunc mFreeFunc;
+  void* mUserData;
+  ImageBufferPoolStats mStats;
+  pthread_mutex_t mMutex;
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -1,6 +1,7 @@
 #include "StdAfx.h"
 #include "LJpegDecompressor.h"
 #include "ByteStreamSwap.h"
+#include "HuffmanTableCache.h"
 
 /*
     RawSpeed - RAW file decoder.
@@ -80,18 +81,18 @@ const uint32 bitMask[] = {  0xffffffff, 0x7fffffff,
                            0x00000003, 0x00000001
                         };
 
-LJpegDecompressor::LJpegDecompressor(FileMap* file, RawImage img):
+LJpegDecompressor::LJpegDecompressor(FileMap* file, const RawImage& img):
     mFile(file), mRaw(img) {
   input = 0;
   skipX = skipY = 0;
-  for (int i = 0; i < 4; i++) {
-    huff[i].initialized = false;
-    huff[i].bigTable = 0;
-  }
+  for (int i = 0; i < 4; i++)
+    huff[i] = 0;
   mDNGCompatible = false;
   slicesW.clear();
   mUseBigtable = false;
   mCanonFlipDim = false;
+  mUseThreads = false;
+  Ri = 0;
 }
 
 LJpegDecompressor::~LJpegDecompressor(void) {
@@ -99,22 +100,21 @@ LJpegDecompressor::~LJpegDecompressor(void) {
     delete input;
   input = 0;
   for (int i = 0; i < 4; i++) {
-    if (huff[i].bigTable)
-      _aligned_free(huff[i].bigTable);
+    if (huff[i])
+      HuffmanTableCache::release(huff[i]);
   }
-
 }
 
-void LJpegDecompressor::getSOF(SOFInfo* sof, uint32 offset, uint32 size) {
+void LJpegDecompressor::getSOF(SOFInfo* sof, uint64 offset, uint32 size) {
   if (!mFile->isValid(offset + size - 1))
     ThrowRDE("LJpegDecompressor::getSOF: Start offset plus size is longer than file. Truncated file.");
   try {
     Endianness host_endian = getHostEndianness();
     // JPEG is big endian
     if (host_endian == big)
-      input = new ByteStream(mFile->getData(offset), size);
+      input = new ByteStream(mFile->getData(offset, size), size);
     else 
-      input = new ByteStreamSwap(mFile->getData(offset), size);
+      input = new ByteStreamSwap(mFile->getData(offset, size), size);
 
     if (getNextMarker(false) != M_SOI)
       ThrowRDE("LJpegDecompressor::getSOF: Image did not start with SOI. Probably not an LJPEG");
@@ -135,7 +135,7 @@ void LJpegDecompressor::getSOF(SOFInfo* sof, uint32 offset, uint32 size) {
   }
 }
 
-void LJpegDecompressor::startDecoder(uint32 offset, uint32 size, uint32 offsetX, uint32 offsetY) {
+void LJpegDecompressor::startDecoder(uint64 offset, uint32 size, uint32 offsetX, uint32 offsetY) {
   if (!mFile->isValid(offset + size - 1))
     ThrowRDE("LJpegDecompressor::startDecoder: Start offset plus size is longer than file. Truncated file.");
   if ((int)offsetX >= mRaw->dim.x)
@@ -149,9 +149,9 @@ void LJpegDecompressor::startDecoder(uint32 offset, uint32 size, uint32 offsetX,
     Endianness host_endian = getHostEndianness();
     // JPEG is big endian
     if (host_endian == big)
-      input = new ByteStream(mFile->getData(offset), size);
+      input = new ByteStream(mFile->getData(offset, size), size);
     else 
-      input = new ByteStreamSwap(mFile->getData(offset), size);
+      input = new ByteStreamSwap(mFile->getData(offset, size), size);
 
     if (getNextMarker(false) != M_SOI)
       ThrowRDE("LJpegDecompressor::startDecoder: Image did not start with SOI. Probably not an LJPEG");
@@ -182,6 +182,7 @@ void LJpegDecompressor::startDecoder(uint32 offset, uint32 size, uint32 offsetX,
 
         case M_DRI:
 //          _RPT0(0,"Found DRI marker\n");
+          parseDRI();
           break;
 
         case M_APP0:
@@ -198,6 +199,8 @@ void LJpegDecompressor::startDecoder(uint32 offset, uint32 size, uint32 offsetX,
           break;
       }
     }
+    if (mRaw->stats)
+      mRaw->stats->addCount(COUNTER_BYTES, input->getOffset());
 
   } catch (IOException) {
     throw;
@@ -256,7 +259,7 @@ void LJpegDecompressor::parseSOS() {
     uint32 td = b >> 4;
     if (td > 3)
       ThrowRDE("LJpegDecompressor::parseSOS: Invalid Huffman table selection");
-    if (!huff[td].initialized)
+    if (!huff[td])
       ThrowRDE("LJpegDecompressor::parseSOS: Invalid Huffman table selection, not defined.");
 
     if (count > 3)
@@ -288,6 +291,13 @@ void LJpegDecompressor::parseSOS() {
   delete bits;
 }
 
+void LJpegDecompressor::parseDRI() {
+  uint32 headerLength = input->getShort();
+  if (headerLength != 4)
+    ThrowRDE("LJpegDecompressor::parseDRI: Invalid header length.");
+  Ri = input->getShort();
+}
+
 void LJpegDecompressor::parseDHT() {
   uint32 headerLength = input->getShort() - 2; // Subtract myself
 
@@ -303,17 +313,16 @@ void LJpegDecompressor::parseDHT() {
       ThrowRDE("LJpegDecompressor::parseDHT: Invalid huffman table destination id.");
 
     uint32 acc = 0;
-    HuffmanTable* t = &huff[Th];
-
-    if (t->initialized)
+    if (huff[Th])
       ThrowRDE("LJpegDecompressor::parseDHT: Duplicate table definition");
 
+    HuffmanTable t;
     for (uint32 i = 0; i < 16 ;i++) {
-      t->bits[i+1] = input->getByte();
-      acc += t->bits[i+1];
+      t.bits[i+1] = input->getByte();
+      acc += t.bits[i+1];
     }
-    t->bits[0] = 0;
-    memset(t->huffval, 0, sizeof(t->huffval));
+    t.bits[0] = 0;
+    memset(t.huffval, 0, sizeof(t.huffval));
     if (acc > 256)
       ThrowRDE("LJpegDecompressor::parseDHT: Invalid DHT table.");
 
@@ -321,9 +330,9 @@ void LJpegDecompressor::parseDHT() {
       ThrowRDE("LJpegDecompressor::parseDHT: Invalid DHT table length.");
 
     for (uint32 i = 0 ; i < acc; i++) {
-      t->huffval[i] = input->getByte();
+      t.huffval[i] = input->getByte();
     }
-    createHuffmanTable(t);
+    setHuffmanTable(Th, new HuffmanTable(t));
     headerLength -= 1 + 16 + acc;
   }
 }
@@ -449,6 +458,28 @@ void LJpegDecompressor::createHuffmanTable(HuffmanTable *htbl) {
   htbl->initialized = true;
 }
 
+void LJpegDecompressor::setHuffmanTable(uint32 n, HuffmanTable *htbl) {
+  HuffmanTable* t = HuffmanTableCache::acquire(htbl, frame.prec, mDNGCompatible, mUseBigtable);
+  if (t) {
+    delete htbl;
+  } else {
+    htbl->bigTable = 0;
+    htbl->initialized = false;
+    try {
+      createHuffmanTable(htbl);
+    } catch (...) {
+      if (htbl->bigTable)
+        _aligned_free(htbl->bigTable);
+      delete htbl;
+      throw;
+    }
+    t = HuffmanTableCache::insert(htbl, frame.prec, mDNGCompatible, mUseBigtable);
+  }
+  if (huff[n])
+    HuffmanTableCache::release(huff[n]);
+  huff[n] = t;
+}
+
 /************************************
  * Bitable creation
  *
@@ -526,6 +557,58 @@ void LJpegDecompressor::createBigTable(HuffmanTable *htbl) {
 }
 
 
+/************************************
+ * Pair table creation
+ *
+ * Each entry of the bigTable resolves one code and difference.
+ * With typical raw data, two of them are often within 16 bits,
+ * so this table is indexed by 16 bits, and resolves a difference
+ * from table "a" followed by one from table "b".
+ *
+ * Entries where both fit have bit 0 set, the total length in bits 1-5,
+ * and the differences as signed 13 bit values in bits 6-18 and 19-31.
+ * All other entries are 0, and HuffDecode must be used.
+ *
+ * It is created from the bigTables, so it is only used where those are.
+ *
+ ************************************/
+
+int* LJpegDecompressor::getPairTable(HuffmanTable *a, HuffmanTable *b) {
+  if (!a->bigTable || !b->bigTable)
+    return NULL;
+
+  int* table = HuffmanTableCache::getPairTable(a, b);
+  if (!table) {
+    const uint32 size = 1 << 16;
+    table = (int*)_aligned_malloc(size * sizeof(int), 16);
+    if (!table)
+      ThrowRDE("Out of memory, failed to allocate %d bytes", size*sizeof(int));
+    createPairTable(table, a, b);
+    table = HuffmanTableCache::insertPairTable(a, b, table);
+  }
+  return table;
+}
+
+void LJpegDecompressor::createPairTable(int* table, HuffmanTable *a, HuffmanTable *b) {
+  for (uint32 i = 0; i < (1 << 16); i++) {
+    table[i] = 0;
+    int val1 = a->bigTable[i >> 2];
+    uint32 l1 = val1 & 0xff;
+    int diff1 = val1 >> 8;
+    if (l1 == 0xff || l1 > 16 || diff1 < -4096 || diff1 > 4095)
+      continue;
+
+    // The bits after the first 16 are read as zero, so only use "b" if it is within those.
+    int val2 = b->bigTable[((i << l1) & 0xffff) >> 2];
+    uint32 l2 = val2 & 0xff;
+    int diff2 = val2 >> 8;
+    if (l2 == 0xff || l1 + l2 > 16 || diff2 < -4096 || diff2 > 4095)
+      continue;
+
+    table[i] = (int)(((uint32)diff2 << 19) | (((uint32)diff1 & 0x1fff) << 6) | ((l1 + l2) << 1) | 1);
+  }
+}
+
 /*
 *--------------------------------------------------------------
 *
@@ -542,7 +625,7 @@ void LJpegDecompressor::createBigTable(HuffmanTable *htbl) {
 *
 *--------------------------------------------------------------
 */
-int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
+int LJpegDecompressor::HuffDecode(HuffmanTable *htbl, BitPumpJPEG *pump) {
   int rv;
   int temp;
   int code, val;
@@ -551,12 +634,12 @@ int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
    * First attempt to do complete decode, by using the first 14 bits
    */
 
-  bits->fill();
-  code = bits->peekBitsNoFill(14);
+  pump->fill();
+  code = pump->peekBitsNoFill(14);
   if (htbl->bigTable) {
     val = htbl->bigTable[code];
     if ((val&0xff) !=  0xff) {
-      bits->skipBitsNoFill(val&0xff);
+      pump->skipBitsNoFill(val&0xff);
       return val >> 8;
     }
   }
@@ -570,13 +653,13 @@ int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
   val = htbl->numbits[code];
   l = val & 15;
   if (l) {
-    bits->skipBitsNoFill(l);
+    pump->skipBitsNoFill(l);
     rv = val >> 4;
   }  else {
-    bits->skipBitsNoFill(8);
+    pump->skipBitsNoFill(8);
     l = 8;
     while (code > htbl->maxcode[l]) {
-      temp = bits->getBitNoFill();
+      temp = pump->getBitNoFill();
       code = (code << 1) | temp;
       l++;
     }
@@ -595,7 +678,7 @@ int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
 
   if (rv == 16) {
     if (mDNGCompatible)
-      bits->skipBitsNoFill(16);
+      pump->skipBitsNoFill(16);
     return -32768;
   }
 
@@ -604,7 +687,7 @@ int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
     if (rv > 16) // There is no values above 16 bits.
       ThrowRDE("Corrupt JPEG data: Too many bits requested.");
     else
-      bits->fill();
+      pump->fill();
   }
 
   /*
@@ -613,7 +696,7 @@ int LJpegDecompressor::HuffDecode(HuffmanTable *htbl) {
   */
 
   if (rv) {
-    int x = bits->getBitsNoFill(rv);
+    int x = pump->getBitsNoFill(rv);
     if ((x & (1 << (rv - 1))) == 0)
       x -= (1 << rv) - 1;
     return x;
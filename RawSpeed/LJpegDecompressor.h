@@ -128,6 +128,8 @@ typedef struct JpegComponentInfo {
 * and vice-versa.
 */
 
+class HuffmanTableCacheEntry;
+
 struct HuffmanTable {
   /*
   * These two fields directly represent the contents of a JPEG DHT
@@ -148,6 +150,7 @@ struct HuffmanTable {
   uint32 numbits[256];
   int* bigTable;
   bool initialized;
+  HuffmanTableCacheEntry* cacheEntry;  // Set by HuffmanTableCache
 };
 
 class SOFInfo {
@@ -162,26 +165,100 @@ public:
   bool initialized;  
 };
 
+/* Position at the start of a row, so decoding can continue from there. */
+/* For the Nikon and Pentax decoders, where the first pixels of a row are */
+/* predicted from the first pixels of the row two above. */
+class MSBRowState
+{
+public:
+  BitPumpMSB* bits;
+  uint32 y;
+  int pUp1[2];    // Predictors for the first pixels of even and odd rows
+  int pUp2[2];
+  /* Copy with its own copy of the bit pump, for RowCheckpointScan */
+  MSBRowState checkpoint() const {MSBRowState c = *this; c.bits = new BitPumpMSB(*bits); return c;}
+};
+
 class LJpegDecompressor
 {
 public:
-  LJpegDecompressor(FileMap* file, RawImage img);
+  LJpegDecompressor(FileMap* file, const RawImage& img);
   virtual ~LJpegDecompressor(void);
-  virtual void startDecoder(uint32 offset, uint32 size, uint32 offsetX, uint32 offsetY);
-  virtual void getSOF(SOFInfo* i, uint32 offset, uint32 size);
+  virtual void startDecoder(uint64 offset, uint32 size, uint32 offsetX, uint32 offsetY);
+  virtual void getSOF(SOFInfo* i, uint64 offset, uint32 size);
   bool mDNGCompatible;  // DNG v1.0.x compatibility
   bool mUseBigtable;    // Use only for large images
   bool mCanonFlipDim;   // Fix Canon 6D mRaw where width/height is flipped
+  bool mUseThreads;     // Decode large scans on the thread pool, where supported
   virtual void addSlices(vector<int> slices) {slicesW=slices;};  // CR2 slices.
 protected:
   virtual void parseSOF(SOFInfo* i);
   virtual void parseSOS();
   virtual void createHuffmanTable(HuffmanTable *htbl);
   virtual void createBigTable(HuffmanTable *htbl);
+  /* Sets huff[n] to the table with the bits and huffval of "htbl", from HuffmanTableCache. */
+  /* The table is only built, if it isn't cached. Takes ownership of "htbl". */
+  void setHuffmanTable(uint32 n, HuffmanTable *htbl);
   virtual void decodeScan() {ThrowRDE("LJpegDecompressor: No Scan decoder found");};
   JpegMarker getNextMarker(bool allowskip);
   void parseDHT();
-  int HuffDecode(HuffmanTable *htbl);
+  void parseDRI();
+  int HuffDecode(HuffmanTable *htbl) {return HuffDecode(htbl, bits);}
+  /* Decodes from "pump" instead of "bits", so several threads can decode the same scan */
+  int HuffDecode(HuffmanTable *htbl, BitPumpJPEG *pump);
+
+  /* Returns the table for decoding a difference from "a" followed by one from "b", */
+  /* in one lookup. Created on first use, and shared through HuffmanTableCache. */
+  /* NULL if either table has no bigTable. */
+  int* getPairTable(HuffmanTable *a, HuffmanTable *b);
+  virtual void createPairTable(int* table, HuffmanTable *a, HuffmanTable *b);
+
+  /* Decodes a difference from table "a", and then one from table "b". */
+  /* If both codes and differences are within the next 16 bits, this is a single lookup */
+  /* in "pairTable", as returned by getPairTable(). Otherwise, or if pairTable is NULL, */
+  /* they are decoded with HuffDecode(). */
+  __inline void HuffDecodePair(int* pairTable, HuffmanTable *a, HuffmanTable *b, int &diff1, int &diff2) {
+    HuffDecodePair(pairTable, a, b, diff1, diff2, bits);
+  }
+  __inline void HuffDecodePair(int* pairTable, HuffmanTable *a, HuffmanTable *b, int &diff1, int &diff2, BitPumpJPEG *pump) {
+    if (pairTable) {
+      pump->fill();
+      int val = pairTable[pump->peekBitsNoFill(16)];
+      if (val & 1) {
+        pump->skipBitsNoFill((val >> 1) & 31);
+        diff1 = (int)((uint32)val << 13) >> 19;
+        diff2 = val >> 19;
+        return;
+      }
+    }
+    diff1 = HuffDecodeBig(a, pump);
+    diff2 = HuffDecodeBig(b, pump);
+  }
+
+  /* Inlined bigTable lookup, for where a call to HuffDecode() is too expensive. */
+  __inline int HuffDecodeBig(HuffmanTable *htbl, BitPumpJPEG *pump) {
+    if (htbl->bigTable) {
+      pump->fill();
+      int val = htbl->bigTable[pump->peekBitsNoFill(14)];
+      if ((val & 0xff) != 0xff) {
+        pump->skipBitsNoFill(val & 0xff);
+        return val >> 8;
+      }
+    }
+    return HuffDecode(htbl, pump);
+  }
+
+  /* Skips one code and the difference bits after it, if both are in the bigTable. */
+  /* Returns false, without skipping, if they are not, and the code must be decoded. */
+  __inline bool skipBigTableCode(HuffmanTable *htbl, BitPumpMSB *pump) {
+    pump->fill();
+    int val = htbl->bigTable[pump->peekBitsNoFill(14)];
+    if ((val & 0xff) == 0xff)
+      return false;
+    pump->skipBitsNoFill(val & 0xff);
+    return true;
+  }
+
   ByteStream* input;
   BitPumpJPEG* bits;
   FileMap *mFile;
@@ -191,9 +268,10 @@ protected:
   vector<int> slicesW;
   uint32 pred;
   uint32 Pt;
+  uint32 Ri;          // Restart interval in MCUs, 0 if there are no restart markers
   uint32 offX, offY;  // Offset into image where decoding should start
   uint32 skipX, skipY;   // Tile is larger than output, skip these border pixels
-  HuffmanTable huff[4]; 
+  HuffmanTable* huff[4];  // Shared with other decompressors, must not be modified. NULL if not defined.
 };
 
 } // namespace RawSpeed
@@ -1,5 +1,6 @@
 #include "StdAfx.h"
 #include "LJpegPlain.h"
+#include "RowCheckpointScan.h"
 /*
 RawSpeed - RAW file decoder.
 
@@ -24,7 +25,7 @@ http://www.klauspost.com
 
 namespace RawSpeed {
 
-LJpegPlain::LJpegPlain(FileMap* file, RawImage img) :
+LJpegPlain::LJpegPlain(FileMap* file, const RawImage& img) :
     LJpegDecompressor(file, img) {
   offset = 0;
   slice_width = 0;
@@ -77,6 +78,9 @@ void LJpegPlain::decodeScan() {
       if (mRaw->isCFA)
         ThrowRDE("LJpegDecompressor::decodeScan: Cannot decode subsampled image to CFA data");
 
+      if (Ri)
+        ThrowRDE("LJpegDecompressor::decodeScan: Restart intervals in subsampled images are not supported");
+
       if (mRaw->getCpp() != frame.cps)
         ThrowRDE("LJpegDecompressor::decodeScan: Subsampled component count does not match image.");
 
@@ -157,7 +161,7 @@ void LJpegPlain::decodeScanLeftGeneric() {
   uint32 pixGroup = 0;   // How many pixels per group.
 
   for (uint32 i = 0; i < comps; i++) {
-    dctbl[i] = &huff[frame.compInfo[i].dcTblNo];
+    dctbl[i] = huff[frame.compInfo[i].dcTblNo];
     samplesH[i] = frame.compInfo[i].superH;
     if (!isPowerOfTwo(samplesH[i]))
       ThrowRDE("LJpegPlain::decodeScanLeftGeneric: Horizontal sampling is not power of two.");
@@ -299,9 +303,9 @@ void LJpegPlain::decodeScanLeft4_2_0() {
   _ASSERTE(frame.cps == COMPS);
   _ASSERTE(skipX == 0);
 
-  HuffmanTable *dctbl1 = &huff[frame.compInfo[0].dcTblNo];
-  HuffmanTable *dctbl2 = &huff[frame.compInfo[1].dcTblNo];
-  HuffmanTable *dctbl3 = &huff[frame.compInfo[2].dcTblNo];
+  HuffmanTable *dctbl1 = huff[frame.compInfo[0].dcTblNo];
+  HuffmanTable *dctbl2 = huff[frame.compInfo[1].dcTblNo];
+  HuffmanTable *dctbl3 = huff[frame.compInfo[2].dcTblNo];
 
   ushort16 *predict;      // Prediction pointer
 
@@ -369,6 +373,10 @@ void LJpegPlain::decodeScanLeft4_2_0() {
   x = 2;
   pixInSlice -= 2;
 
+  int* pairs11 = getPairTable(dctbl1, dctbl1);
+  int* pairs23 = getPairTable(dctbl2, dctbl3);
+  int diff1, diff2;
+
   uint32 cw = (frame.w - skipX);
   for (uint32 y = 0;y < (frame.h - skipY);y += 2) {
     for (; x < cw ; x += 2) {
@@ -388,17 +396,20 @@ void LJpegPlain::decodeScanLeft4_2_0() {
           predict = dest;
         }
       }
-      p1 += HuffDecode(dctbl1);
+      HuffDecodePair(pairs11, dctbl1, dctbl1, diff1, diff2);
+      p1 += diff1;
       *dest = p1;
-      p1 += HuffDecode(dctbl1);
+      p1 += diff2;
       dest[COMPS] = p1;
-      p1 += HuffDecode(dctbl1);
+      HuffDecodePair(pairs11, dctbl1, dctbl1, diff1, diff2);
+      p1 += diff1;
       dest[pitch_s] = p1;
-      p1 += HuffDecode(dctbl1);
+      p1 += diff2;
       dest[pitch_s+COMPS] = p1;
 
-      dest[1] = p2 = p2 + HuffDecode(dctbl2);
-      dest[2] = p3 = p3 + HuffDecode(dctbl3);
+      HuffDecodePair(pairs23, dctbl2, dctbl3, diff1, diff2);
+      dest[1] = p2 = p2 + diff1;
+      dest[2] = p3 = p3 + diff2;
 
       dest += COMPS * 2;
       pixInSlice -= 2;
@@ -428,9 +439,9 @@ void LJpegPlain::decodeScanLeft4_2_2() {
   _ASSERTE(frame.cps == COMPS);
   _ASSERTE(skipX == 0);
 
-  HuffmanTable *dctbl1 = &huff[frame.compInfo[0].dcTblNo];
-  HuffmanTable *dctbl2 = &huff[frame.compInfo[1].dcTblNo];
-  HuffmanTable *dctbl3 = &huff[frame.compInfo[2].dcTblNo];
+  HuffmanTable *dctbl1 = huff[frame.compInfo[0].dcTblNo];
+  HuffmanTable *dctbl2 = huff[frame.compInfo[1].dcTblNo];
+  HuffmanTable *dctbl3 = huff[frame.compInfo[2].dcTblNo];
 
   mRaw->subsampling.x = 2;
   mRaw->subsampling.y = 1;
@@ -493,6 +504,10 @@ void LJpegPlain::decodeScanLeft4_2_2() {
   x = 2;
   pixInSlice -= 2;
 
+  int* pairs11 = getPairTable(dctbl1, dctbl1);
+  int* pairs23 = getPairTable(dctbl2, dctbl3);
+  int diff1, diff2;
+
   uint32 cw = (frame.w - skipX);
   for (uint32 y = 0;y < (frame.h - skipY);y++) {
     for (; x < cw ; x += 2) {
@@ -511,13 +526,15 @@ void LJpegPlain::decodeScanLeft4_2_2() {
           predict = dest;
         }
       }
-      p1 += HuffDecode(dctbl1);
+      HuffDecodePair(pairs11, dctbl1, dctbl1, diff1, diff2);
+      p1 += diff1;
       *dest = p1;
-      p1 += HuffDecode(dctbl1);
+      p1 += diff2;
       dest[COMPS] = p1;
 
-      dest[1] = p2 = p2 + HuffDecode(dctbl2);
-      dest[2] = p3 = p3 + HuffDecode(dctbl3);
+      HuffDecodePair(pairs23, dctbl2, dctbl3, diff1, diff2);
+      dest[1] = p2 = p2 + diff1;
+      dest[2] = p3 = p3 + diff2;
 
       dest += COMPS * 2;
       pixInSlice -= 2;
@@ -540,11 +557,6 @@ void LJpegPlain::decodeScanLeft2Comps() {
   _ASSERTE(slicesW.size() < 16);  // We only have 4 bits for slice number.
   _ASSERTE(!(slicesW.size() > 1 && skipX)); // Check if this is a valid state
 
-  uchar8 *draw = mRaw->getData();
-  // First line
-  HuffmanTable *dctbl1 = &huff[frame.compInfo[0].dcTblNo];
-  HuffmanTable *dctbl2 = &huff[frame.compInfo[1].dcTblNo];
-
   //Prepare slices (for CR2)
   uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
   offset = new uint32[slices+1];
@@ -553,7 +565,6 @@ void LJpegPlain::decodeScanLeft2Comps() {
   uint32 t_x = 0;
   uint32 t_s = 0;
   uint32 slice = 0;
-  uint32 cw = (frame.w - skipX);
   for (slice = 0; slice < slices; slice++) {
     offset[slice] = ((t_x + offX) * mRaw->getBpp() + ((offY + t_y) * mRaw->pitch)) | (t_s << 28);
     _ASSERTE((offset[slice]&0x0fffffff) < mRaw->pitch*mRaw->dim.y);
@@ -574,27 +585,35 @@ void LJpegPlain::decodeScanLeft2Comps() {
   if (skipX)
     slice_width[slicesW.size()-1] -= skipX;
 
-  // First pixels are obviously not predicted
-  int p1;
-  int p2;
-  ushort16 *dest = (ushort16*) & draw[offset[0] & 0x0fffffff];
-  ushort16 *predict = dest;
-  *dest++ = p1 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl1);
-  *dest++ = p2 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl2);
+  decodeRows();
+}
+
+void LJpegPlain::decodeRowsLeft2Comps(LJpegRowState *s, uint32 endY) {
+  uchar8 *draw = mRaw->getData();
+  HuffmanTable *dctbl1 = huff[frame.compInfo[0].dcTblNo];
+  HuffmanTable *dctbl2 = huff[frame.compInfo[1].dcTblNo];
+  BitPumpJPEG *pump = s->bits;
+  uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
+  uint32 slice = s->slice;
+  uint32 pixInSlice = s->pixInSlice;
+  int p1 = s->p[0];
+  int p2 = s->p[1];
+  ushort16 *dest = (ushort16*) & draw[s->dest];
+  ushort16 *predict = (ushort16*) & draw[s->predict];
 
-  slice = 1;    // Always points to next slice
-  uint32 pixInSlice = slice_width[0] - 1;  // Skip first pixel
+  int* pairs12 = getPairTable(dctbl1, dctbl2);
+  int diff1, diff2;
 
-  uint32 x = 1;                            // Skip first pixels on first line.
-  for (uint32 y = 0;y < (frame.h - skipY);y++) {
+  uint32 cw = (frame.w - skipX);
+  uint32 x = s->x;
+  for (uint32 y = s->y; y < endY; y++) {
     for (; x < cw ; x++) {
-      int diff = HuffDecode(dctbl1);
-      p1 += diff;
+      HuffDecodePair(pairs12, dctbl1, dctbl2, diff1, diff2, pump);
+      p1 += diff1;
       *dest++ = (ushort16)p1;
   //    _ASSERTE(p1 >= 0 && p1 < 65536);
 
-      diff = HuffDecode(dctbl2);
-      p2 += diff;
+      p2 += diff2;
       *dest++ = (ushort16)p2;
 //      _ASSERTE(p2 >= 0 && p2 < 65536);
 
@@ -611,8 +630,8 @@ void LJpegPlain::decodeScanLeft2Comps() {
 
     if (skipX) {
       for (uint32 i = 0; i < skipX; i++) {
-        HuffDecode(dctbl1);
-        HuffDecode(dctbl2);
+        HuffDecode(dctbl1, pump);
+        HuffDecode(dctbl2, pump);
       }
     }
 
@@ -620,7 +639,7 @@ void LJpegPlain::decodeScanLeft2Comps() {
     p2 = predict[1];
     predict = dest;  // Adjust destination for next prediction
     x = 0;
-    bits->checkPos();
+    pump->checkPos();
   }
 }
 
@@ -628,12 +647,6 @@ void LJpegPlain::decodeScanLeft2Comps() {
 #define COMPS 3
 
 void LJpegPlain::decodeScanLeft3Comps() {
-  uchar8 *draw = mRaw->getData();
-  // First line
-  HuffmanTable *dctbl1 = &huff[frame.compInfo[0].dcTblNo];
-  HuffmanTable *dctbl2 = &huff[frame.compInfo[1].dcTblNo];
-  HuffmanTable *dctbl3 = &huff[frame.compInfo[2].dcTblNo];
-
   //Prepare slices (for CR2)
   uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
   offset = new uint32[slices+1];
@@ -663,31 +676,40 @@ void LJpegPlain::decodeScanLeft3Comps() {
   if (skipX)
     slice_width[slicesW.size()-1] -= skipX;
 
-  // First pixels are obviously not predicted
-  int p1;
-  int p2;
-  int p3;
-  ushort16 *dest = (ushort16*) & draw[offset[0] & 0x0fffffff];
-  ushort16 *predict = dest;
-  *dest++ = p1 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl1);
-  *dest++ = p2 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl2);
-  *dest++ = p3 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl3);
+  decodeRows();
+}
 
-  slice = 1;
-  uint32 pixInSlice = slice_width[0] - 1;
+void LJpegPlain::decodeRowsLeft3Comps(LJpegRowState *s, uint32 endY) {
+  uchar8 *draw = mRaw->getData();
+  HuffmanTable *dctbl1 = huff[frame.compInfo[0].dcTblNo];
+  HuffmanTable *dctbl2 = huff[frame.compInfo[1].dcTblNo];
+  HuffmanTable *dctbl3 = huff[frame.compInfo[2].dcTblNo];
+  BitPumpJPEG *pump = s->bits;
+  uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
+  uint32 slice = s->slice;
+  uint32 pixInSlice = s->pixInSlice;
+  int p1 = s->p[0];
+  int p2 = s->p[1];
+  int p3 = s->p[2];
+  ushort16 *dest = (ushort16*) & draw[s->dest];
+  ushort16 *predict = (ushort16*) & draw[s->predict];
+
+  int* pairs12 = getPairTable(dctbl1, dctbl2);
+  int diff1, diff2;
 
   uint32 cw = (frame.w - skipX);
-  uint32 x = 1;                            // Skip first pixels on first line.
+  uint32 x = s->x;
 
-  for (uint32 y = 0;y < (frame.h - skipY);y++) {
+  for (uint32 y = s->y; y < endY; y++) {
     for (; x < cw ; x++) {
-      p1 += HuffDecode(dctbl1);
+      HuffDecodePair(pairs12, dctbl1, dctbl2, diff1, diff2, pump);
+      p1 += diff1;
       *dest++ = (ushort16)p1;
 
-      p2 += HuffDecode(dctbl2);
+      p2 += diff2;
       *dest++ = (ushort16)p2;
 
-      p3 += HuffDecode(dctbl3);
+      p3 += HuffDecode(dctbl3, pump);
       *dest++ = (ushort16)p3;
 
       if (0 == --pixInSlice) { // Next slice
@@ -704,9 +726,9 @@ void LJpegPlain::decodeScanLeft3Comps() {
 
     if (skipX) {
       for (uint32 i = 0; i < skipX; i++) {
-        HuffDecode(dctbl1);
-        HuffDecode(dctbl2);
-        HuffDecode(dctbl3);
+        HuffDecode(dctbl1, pump);
+        HuffDecode(dctbl2, pump);
+        HuffDecode(dctbl3, pump);
       }
     }
 
@@ -715,7 +737,7 @@ void LJpegPlain::decodeScanLeft3Comps() {
     p3 = predict[2];  // Predictors for next row
     predict = dest;  // Adjust destination for next prediction
     x = 0;
-    bits->checkPos();
+    pump->checkPos();
   }
 }
 
@@ -723,13 +745,6 @@ void LJpegPlain::decodeScanLeft3Comps() {
 #define COMPS 4
 
 void LJpegPlain::decodeScanLeft4Comps() {
-  uchar8 *draw = mRaw->getData();
-  // First line
-  HuffmanTable *dctbl1 = &huff[frame.compInfo[0].dcTblNo];
-  HuffmanTable *dctbl2 = &huff[frame.compInfo[1].dcTblNo];
-  HuffmanTable *dctbl3 = &huff[frame.compInfo[2].dcTblNo];
-  HuffmanTable *dctbl4 = &huff[frame.compInfo[3].dcTblNo];
-
   //Prepare slices (for CR2)
   uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
   offset = new uint32[slices+1];
@@ -758,36 +773,47 @@ void LJpegPlain::decodeScanLeft4Comps() {
   if (skipX)
     slice_width[slicesW.size()-1] -= skipX;
 
-  // First pixels are obviously not predicted
-  int p1;
-  int p2;
-  int p3;
-  int p4;
-  ushort16 *dest = (ushort16*) & draw[offset[0] & 0x0fffffff];
-  ushort16 *predict = dest;
-  *dest++ = p1 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl1);
-  *dest++ = p2 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl2);
-  *dest++ = p3 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl3);
-  *dest++ = p4 = (1 << (frame.prec - Pt - 1)) + HuffDecode(dctbl4);
+  decodeRows();
+}
 
-  slice = 1;
-  uint32 pixInSlice = slice_width[0] - 1;
+void LJpegPlain::decodeRowsLeft4Comps(LJpegRowState *s, uint32 endY) {
+  uchar8 *draw = mRaw->getData();
+  HuffmanTable *dctbl1 = huff[frame.compInfo[0].dcTblNo];
+  HuffmanTable *dctbl2 = huff[frame.compInfo[1].dcTblNo];
+  HuffmanTable *dctbl3 = huff[frame.compInfo[2].dcTblNo];
+  HuffmanTable *dctbl4 = huff[frame.compInfo[3].dcTblNo];
+  BitPumpJPEG *pump = s->bits;
+  uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
+  uint32 slice = s->slice;
+  uint32 pixInSlice = s->pixInSlice;
+  int p1 = s->p[0];
+  int p2 = s->p[1];
+  int p3 = s->p[2];
+  int p4 = s->p[3];
+  ushort16 *dest = (ushort16*) & draw[s->dest];
+  ushort16 *predict = (ushort16*) & draw[s->predict];
+
+  int* pairs12 = getPairTable(dctbl1, dctbl2);
+  int* pairs34 = getPairTable(dctbl3, dctbl4);
+  int diff1, diff2;
 
   uint32 cw = (frame.w - skipX);
-  uint32 x = 1;                            // Skip first pixels on first line.
+  uint32 x = s->x;
 
-  for (uint32 y = 0;y < (frame.h - skipY);y++) {
+  for (uint32 y = s->y; y < endY; y++) {
     for (; x < cw ; x++) {
-      p1 += HuffDecode(dctbl1);
+      HuffDecodePair(pairs12, dctbl1, dctbl2, diff1, diff2, pump);
+      p1 += diff1;
       *dest++ = (ushort16)p1;
 
-      p2 += HuffDecode(dctbl2);
+      p2 += diff2;
       *dest++ = (ushort16)p2;
 
-      p3 += HuffDecode(dctbl3);
+      HuffDecodePair(pairs34, dctbl3, dctbl4, diff1, diff2, pump);
+      p3 += diff1;
       *dest++ = (ushort16)p3;
 
-      p4 += HuffDecode(dctbl4);
+      p4 += diff2;
       *dest++ = (ushort16)p4;
 
       if (0 == --pixInSlice) { // Next slice
@@ -802,13 +828,13 @@ void LJpegPlain::decodeScanLeft4Comps() {
     }
     if (skipX) {
       for (uint32 i = 0; i < skipX; i++) {
-        HuffDecode(dctbl1);
-        HuffDecode(dctbl2);
-        HuffDecode(dctbl3);
-        HuffDecode(dctbl4);
+        HuffDecode(dctbl1, pump);
+        HuffDecode(dctbl2, pump);
+        HuffDecode(dctbl3, pump);
+        HuffDecode(dctbl4, pump);
       }
     }
-    bits->checkPos();
+    pump->checkPos();
     p1 = predict[0];  // Predictors for next row
     p2 = predict[1];
     p3 = predict[2];  // Predictors for next row
@@ -818,4 +844,254 @@ void LJpegPlain::decodeScanLeft4Comps() {
   }
 }
 
+#undef COMPS
+
+void LJpegPlain::decodeRowsLeft(LJpegRowState *s, uint32 endY) {
+  if (frame.cps == 2)
+    decodeRowsLeft2Comps(s, endY);
+  else if (frame.cps == 3)
+    decodeRowsLeft3Comps(s, endY);
+  else
+    decodeRowsLeft4Comps(s, endY);
+}
+
+/**
+*  Threaded decoding:
+*  The scan is a single bit stream, so it is decoded with RowCheckpointScan.
+*  scanRowsLeft() finds the bit position, the predictors and the output position
+*  of each row, by only reading the code lengths.
+**/
+
+void LJpegPlain::decodeRows() {
+  LJpegRowState s;
+  s.bits = bits;
+  s.y = 0;
+  s.x = 0;
+  for (uint32 i = 0; i < 4; i++)
+    s.p[i] = 1 << (frame.prec - Pt - 1);   // First pixels are obviously not predicted
+  s.slice = 1;                             // Always points to next slice
+  s.pixInSlice = slice_width[0];
+  s.dest = s.predict = offset[0] & 0x0fffffff;
+
+  if (Ri) {
+    decodeRowsRestart(&s);
+    return;
+  }
+
+  uint32 h = frame.h - skipY;
+  uint32 parts = 1;
+  if (mUseThreads)
+    parts = ThreadPool::getPool()->getPartCount(h, 64);
+
+  // Avoid guessing how the decoder handles empty slices
+  for (uint32 i = 0; i < slicesW.size(); i++) {
+    if (slice_width[i] <= 1)
+      parts = 1;
+  }
+
+  if (parts > 1) {
+    RowCheckpointScan<LJpegPlain, LJpegRowState> scan(this, &LJpegPlain::scanRowsLeft, &LJpegPlain::decodeRowsLeft, mRaw->stats);
+    scan.run(&s, h, parts);
+  } else {
+    decodeRowsLeft(&s, h);
+  }
+}
+
+/* Moves "s" to the start of row "endY", reading the same bits as decodeRowsLeft(), */
+/* but only decoding the first pixel of each row, as that is the predictor for the next row. */
+void LJpegPlain::scanRowsLeft(LJpegRowState *s, uint32 endY) {
+  uint32 comps = frame.cps;
+  HuffmanTable *dctbl[4] = {NULL, NULL, NULL, NULL};
+  for (uint32 i = 0; i < comps; i++)
+    dctbl[i] = huff[frame.compInfo[i].dcTblNo];
+  BitPumpJPEG *pump = s->bits;
+
+  int* pairs12 = getPairTable(dctbl[0], dctbl[1]);
+  int* pairs34 = comps == 4 ? getPairTable(dctbl[2], dctbl[3]) : NULL;
+  int diff1, diff2;
+
+  uint32 cw = (frame.w - skipX);
+  for (; s->y < endY; s->y++) {
+    // First pixels of the row
+    if (s->x == 0) {
+      for (uint32 i = 0; i < comps; i++)
+        s->p[i] += HuffDecode(dctbl[i], pump);
+    }
+    for (uint32 i = 0; i < comps; i++)
+      s->p[i] = (ushort16)s->p[i];
+
+    for (uint32 x = 1; x < cw; x++) {
+      HuffDecodePair(pairs12, dctbl[0], dctbl[1], diff1, diff2, pump);
+      if (comps == 3)
+        HuffDecode(dctbl[2], pump);
+      else if (comps == 4)
+        HuffDecodePair(pairs34, dctbl[2], dctbl[3], diff1, diff2, pump);
+    }
+
+    for (uint32 x = 0; x < skipX; x++) {
+      for (uint32 i = 0; i < comps; i++)
+        HuffDecode(dctbl[i], pump);
+    }
+    pump->checkPos();
+
+    advanceSlices(s, cw - s->x);
+    s->predict = s->dest;
+    s->x = 0;
+  }
+}
+
+/* Moves the output position of "s" forward "n" pixel groups, following the slices, */
+/* as the decoder does for each pixel */
+void LJpegPlain::advanceSlices(LJpegRowState *s, uint32 n) {
+  uint32 slices = (uint32)slicesW.size() * (frame.h - skipY);
+  while (n >= s->pixInSlice) {
+    n -= s->pixInSlice;
+    if (s->slice > slices)
+      ThrowRDE("LJpegPlain::decodeScanLeft: Ran out of slices");
+    uint32 o = offset[s->slice++];
+    if((o&0x0fffffff) > mRaw->pitch*mRaw->dim.y)
+      ThrowRDE("LJpegPlain::decodeScanLeft: Offset out of bounds");
+    s->dest = o&0x0fffffff;
+    s->pixInSlice = slice_width[o>>28];
+  }
+  s->pixInSlice -= n;
+  s->dest += n * frame.cps * sizeof(ushort16);
+}
+
+/**
+*  Restart intervals:
+*  If the image has a DRI marker, the scan is split into intervals of Ri pixel groups,
+*  separated by RSTn markers. Each interval starts on a byte boundary, with the predictors
+*  reset, so it can be decoded without decoding the previous intervals. The intervals are
+*  found by searching the scan for the markers, and decoded on the thread pool if
+*  mUseThreads is set. An error only affects the interval it occurs in - the other
+*  intervals are still decoded, and the error of the first failing interval is thrown.
+*  Only intervals of whole rows are supported.
+**/
+
+class LJpegIntervalJob
+{
+public:
+  LJpegIntervalJob() : ioError(false) {};
+  LJpegPlain* parent;
+  BitPumpJPEG* bits;
+  vector<LJpegRowState>* intervals;   // Start of each interval
+  vector<uint32>* starts;             // Offset of each interval in the scan
+  uint32 first;                       // Intervals decoded by this job
+  uint32 end;
+  uint32 rows;                        // Rows per interval
+  string error;                       // First error, empty if none
+  bool ioError;                       // The error was an IOException
+};
+
+void *LJpegPlainDecodeIntervals(void *_this) {
+  LJpegIntervalJob* me = (LJpegIntervalJob*)_this;
+  me->parent->decodeIntervalJob(me);
+  return NULL;
+}
+
+void LJpegPlain::decodeRowsRestart(LJpegRowState *s) {
+  uint32 h = frame.h - skipY;
+  if (Ri % frame.w)
+    ThrowRDE("LJpegPlain::decodeScan: Restart interval is not a whole number of rows.");
+  uint32 rows = Ri / frame.w;
+  uint32 count = (h + rows - 1) / rows;
+
+  // Find the start of each interval, after the RSTn markers.
+  vector<uint32> starts;
+  starts.push_back(0);
+  const uchar8* data = input->getData();
+  uint32 size = (uint32)min(input->getRemainSize(), (uint64)BITPUMP_MAX_SIZE);
+  for (uint32 i = 0; i + 1 < size && starts.size() < count; i++) {
+    if (data[i] != 0xff)
+      continue;
+    uint32 m = data[i + 1];
+    if (m == 0) {
+      i++;   // Stuffed zero
+    } else if (m == (uint32)M_RST0 + ((starts.size() - 1) & 7)) {
+      starts.push_back(i + 2);
+      i++;
+    } else if (m != 0xff) {
+      break; // End of scan, or RSTn out of order
+    }
+  }
+
+  // The output position of each interval
+  vector<LJpegRowState> intervals(starts.size());
+  uint32 cw = (frame.w - skipX);
+  for (uint32 k = 0; k < intervals.size(); k++) {
+    if (k)
+      advanceSlices(s, rows * cw);
+    s->y = k * rows;
+    s->predict = s->dest;
+    intervals[k] = *s;
+  }
+
+  uint32 parts = 1;
+  if (mUseThreads)
+    parts = ThreadPool::getPool()->getPartCount((uint32)intervals.size());
+  uint32 perPart = ((uint32)intervals.size() + parts - 1) / parts;
+  parts = ((uint32)intervals.size() + perPart - 1) / perPart;
+
+  LJpegIntervalJob *jobs = new LJpegIntervalJob[parts];
+  void **args = new void*[parts];
+  for (uint32 i = 0; i < parts; i++) {
+    jobs[i].parent = this;
+    // The last part uses "bits", so it is left at the end of the scan.
+    jobs[i].bits = (i == parts - 1) ? bits : new BitPumpJPEG(*bits);
+    jobs[i].intervals = &intervals;
+    jobs[i].starts = &starts;
+    jobs[i].first = i * perPart;
+    jobs[i].end = min((i + 1) * perPart, (uint32)intervals.size());
+    jobs[i].rows = rows;
+    args[i] = &jobs[i];
+  }
+  if (parts > 1)
+    ThreadPool::getPool()->run(LJpegPlainDecodeIntervals, args, parts);
+  else
+    decodeIntervalJob(&jobs[0]);
+
+  string error;
+  bool ioError = false;
+  for (uint32 i = 0; i < parts; i++) {
+    if (error.empty()) {
+      error = jobs[i].error;
+      ioError = jobs[i].ioError;
+    }
+    if (jobs[i].bits != bits)
+      delete jobs[i].bits;
+  }
+  delete[] args;
+  delete[] jobs;
+
+  if (!error.empty()) {
+    if (ioError)
+      throw IOException(error);
+    throw RawDecoderException(error);
+  }
+  if (intervals.size() < count)
+    ThrowIOE("LJpegPlain::decodeScan: Restart marker not found. Image is truncated.");
+}
+
+void LJpegPlain::decodeIntervalJob(LJpegIntervalJob *job) {
+  JobTimer timer(mRaw->stats);
+  uint32 h = frame.h - skipY;
+  for (uint32 k = job->first; k < job->end; k++) {
+    try {
+      LJpegRowState s = (*job->intervals)[k];
+      s.bits = job->bits;
+      s.bits->setAbsoluteOffset((*job->starts)[k]);
+      decodeRowsLeft(&s, min(h, (k + 1) * job->rows));
+    } catch (RawDecoderException &e) {
+      if (job->error.empty())
+        job->error = e.what();
+    } catch (IOException &e) {
+      if (job->error.empty()) {
+        job->error = e.what();
+        job->ioError = true;
+      }
+    }
+  }
+}
+
 } // namespace RawSpeed
@@ -27,6 +27,24 @@
 
 namespace RawSpeed {
 
+class LJpegIntervalJob;
+
+/* Position in the scan at the start of a row, so decoding can continue from there */
+class LJpegRowState
+{
+public:
+  BitPumpJPEG* bits;
+  uint32 y;           // Row
+  uint32 x;           // First pixel group to decode in the row
+  int p[4];           // Predictors
+  uint32 slice;       // Next entry in "offset"
+  uint32 pixInSlice;  // Pixel groups left in the current slice
+  uint32 dest;        // Offset in bytes of the next pixel in the image
+  uint32 predict;     // Offset in bytes of the first pixel of the row
+  /* Copy with its own copy of the bit pump, for RowCheckpointScan */
+  LJpegRowState checkpoint() const {LJpegRowState c = *this; c.bits = new BitPumpJPEG(*bits); return c;}
+};
+
 /******************
  * Decompresses Lossless non subsampled JPEGs, with 2-4 components
  *****************/
@@ -35,8 +53,10 @@ class LJpegPlain :
   public LJpegDecompressor
 {
 public:
-  LJpegPlain(FileMap* file, RawImage img);
+  LJpegPlain(FileMap* file, const RawImage& img);
   virtual ~LJpegPlain(void);
+  /* Internal: decodes restart intervals on the thread pool, see decodeRowsRestart() */
+  void decodeIntervalJob(LJpegIntervalJob *job);
 protected:
   virtual void decodeScan();
 private:
@@ -46,6 +66,17 @@ private:
   void decodeScanLeftGeneric();
   void decodeScanLeft4_2_0();
   void decodeScanLeft4_2_2();
+  /* Decode from "s" to the start of row "endY", with 2 to 4 components */
+  void decodeRowsLeft(LJpegRowState *s, uint32 endY);
+  void decodeRowsLeft2Comps(LJpegRowState *s, uint32 endY);
+  void decodeRowsLeft3Comps(LJpegRowState *s, uint32 endY);
+  void decodeRowsLeft4Comps(LJpegRowState *s, uint32 endY);
+  /* Decode all rows, on the thread pool if mUseThreads is set and the image is large */
+  void decodeRows();
+  /* Decode all rows, where the scan has restart intervals */
+  void decodeRowsRestart(LJpegRowState *s);
+  void scanRowsLeft(LJpegRowState *s, uint32 endY);
+  void advanceSlices(LJpegRowState *s, uint32 n);
   uint32 *offset;
   int* slice_width;
 };
@@ -74,7 +74,7 @@ RawImage NefDecoder::decodeRawInternal() {
   if (counts->count != offsets->count) {
     ThrowRDE("NEF Decoder: Byte count number does not match strip size: count:%u, strips:%u ", counts->count, offsets->count);
   }
-  if (!mFile->isValid(offsets->getInt() + counts->getInt()))
+  if (!mFile->isValid(offsets->getInt(), counts->getInt()))
     ThrowRDE("NEF Decoder: Invalid strip byte count. File probably truncated.");
 
 
@@ -94,8 +94,7 @@ RawImage NefDecoder::decodeRawInternal() {
 
   TiffIFD* exif = data[0];
   TiffEntry *makernoteEntry = exif->getEntry(MAKERNOTE);
-  const uchar8* makernote = makernoteEntry->getData();
-  FileMap makermap((uchar8*)&makernote[10], mFile->getSize() - makernoteEntry->getDataOffset() - 10);
+  FileMap makermap(mFile, makernoteEntry->getDataOffset() + 10, mFile->getSize() - makernoteEntry->getDataOffset() - 10);
   TiffParser makertiff(&makermap);
   makertiff.parseData();
 
@@ -114,6 +113,8 @@ RawImage NefDecoder::decodeRawInternal() {
   try {
     NikonDecompressor decompressor(mFile, mRaw);
     decompressor.uncorrectedRawValues = uncorrectedRawValues;
+    decompressor.curveAfterRows = hints.find(string("nikon_curve_after_rows")) != hints.end();
+    decompressor.mUseThreads = true;
     ByteStream* metastream;
     if (getHostEndianness() == data[0]->endian)
       metastream = new ByteStream(meta->getData(), meta->count);
@@ -184,13 +185,16 @@ void NefDecoder::DecodeUncompressed() {
 
     offY += yPerSlice;
 
-    if (mFile->isValid(slice.offset + slice.count)) // Only decode if size is valid
+    if (mFile->isValid(slice.offset, slice.count)) // Only decode if size is valid
       slices.push_back(slice);
   }
 
   if (0 == slices.size())
     ThrowRDE("NEF Decoder: No valid slices found. File probably truncated.");
 
+  for (uint32 i = 0; i < slices.size(); i++)
+    mFile->prefetch(slices[i].offset, slices[i].count);
+
   mRaw->dim = iPoint2D(width, offY);
   mRaw->createData();
   if (bitPerPixel == 14 && width*slices[0].h*2 == slices[0].count)
@@ -209,7 +213,7 @@ void NefDecoder::DecodeUncompressed() {
   offY = 0;
   for (uint32 i = 0; i < slices.size(); i++) {
     NefSlice slice = slices[i];
-    ByteStream in(mFile->getData(slice.offset), slice.count);
+    ByteStream in(mFile->getData(slice.offset, slice.count), slice.count);
     iPoint2D size(width, slice.h);
     iPoint2D pos(0, offY);
     try {
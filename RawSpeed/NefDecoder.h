@@ -57,7 +57,7 @@ public:
   NefSlice() { h = offset = count = 0;};
   ~NefSlice() {};
   uint32 h;
-  uint32 offset;
+  uint64 offset;
   uint32 count;
 };
 
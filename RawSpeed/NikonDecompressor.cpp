@@ -1,6 +1,8 @@
 #include "StdAfx.h"
 #include "NikonDecompressor.h"
-#include "BitPumpMSB.h"
+#include "CpuFeatures.h"
+#include "RowCheckpointScan.h"
+#include "RefCountedCache.h"
 
 /*
     RawSpeed - RAW file decoder.
@@ -23,18 +25,65 @@
 
     http://www.klauspost.com
 */
+#ifdef RAWSPEED_AVX2
+#include <immintrin.h>
+#endif
 
 namespace RawSpeed {
 
-NikonDecompressor::NikonDecompressor(FileMap* file, RawImage img) :
+/**
+*  Curve cache:
+*  Images from the same camera usually have the same curve. Curves are kept with
+*  the metadata values they are made from, so decoders with the same values can
+*  use the same curve, instead of making it again.
+**/
+
+class NikonCurve
+{
+public:
+  NikonCurve(const vector<uint32>& _key, ushort16* _curve) : key(_key), curve(_curve), refs(0) {};
+  ~NikonCurve() {_aligned_free(curve);}
+  bool matches(const vector<uint32>& k) const {return key == k;}
+  vector<uint32> key;   // Curve type, size, step and the curve points
+  ushort16* curve;      // 0x8000 values, padded so 32 bits can be read at the last value
+  uint32 refs;          // Number of decoders using the curve
+};
+
+#define NIKON_CURVE_CACHE_UNUSED 4
+
+// Never deleted, see RefCountedCache
+static RefCountedCache<NikonCurve, vector<uint32> >* curve_cache = NULL;
+static pthread_once_t curve_cache_once = PTHREAD_ONCE_INIT;
+
+static void createCurveCache() {
+  curve_cache = new RefCountedCache<NikonCurve, vector<uint32> >(NIKON_CURVE_CACHE_UNUSED);
+}
+
+static RefCountedCache<NikonCurve, vector<uint32> >* getCurveCache() {
+  pthread_once(&curve_cache_once, createCurveCache);
+  return curve_cache;
+}
+
+void NikonDecompressor::flushCurves() {
+  getCurveCache()->flush();
+}
+
+NikonDecompressor::NikonDecompressor(FileMap* file, const RawImage& img) :
     LJpegDecompressor(file, img) {
-  for (uint32 i = 0; i < 0x8000 ; i++) {
-    curve[i]  = i;
-  }
+  split = cw = h = 0;
+  curve = NULL;
+  curveEntry = NULL;
+  curveAfterRows = false;
+}
+
+NikonDecompressor::~NikonDecompressor(void) {
+  if (curveEntry)
+    getCurveCache()->release(curveEntry);
 }
 
-void NikonDecompressor::initTable(uint32 huffSelect) {
-  HuffmanTable *dctbl1 = &huff[0];
+void NikonDecompressor::initTable(uint32 huffSelect, uint32 n) {
+  HuffmanTable table;
+  HuffmanTable *dctbl1 = &table;
   uint32 acc = 0;
   for (uint32 i = 0; i < 16 ;i++) {
     dctbl1->bits[i+1] = nikon_tree[huffSelect][i];
@@ -45,17 +94,17 @@ void NikonDecompressor::initTable(uint32 huffSelect) {
   for (uint32 i = 0 ; i < acc; i++) {
     dctbl1->huffval[i] = nikon_tree[huffSelect][i+16];
   }
-  createHuffmanTable(dctbl1);
+  setHuffmanTable(n, new HuffmanTable(table));
 }
 
 void NikonDecompressor::DecompressNikon(ByteStream *metadata, uint32 w, uint32 h, uint32 bitsPS, uint32 offset, uint32 size) {
   uint32 v0 = metadata->getByte();
   uint32 v1 = metadata->getByte();
   uint32 huffSelect = 0;
-  uint32 split = 0;
   int pUp1[2];
   int pUp2[2];
   mUseBigtable = true;
+  split = 0;
 
   _RPT2(0, "Nef version v0:%u, v1:%u\n", v0, v1);
 
@@ -75,56 +124,179 @@ void NikonDecompressor::DecompressNikon(ByteStream *metadata, uint32 w, uint32 h
   uint32 csize = metadata->getShort();
   if (csize  > 1)
     step = _max / (csize - 1);
+  // The curve is made from type, _max, step and the points
+  uint32 type = 0;
+  vector<uint32> key;
   if (v0 == 68 && v1 == 32 && step > 0 && !uncorrectedRawValues) {
+    type = 1;   // Interpolated between points
     for (uint32 i = 0; i < csize; i++)
-      curve[i*step] = metadata->getShort();
-    for (int i = 0; i < _max; i++)
-      curve[i] = (curve[i-i%step] * (step - i % step) +
-                  curve[i-i%step+step] * (i % step)) / step;
+      key.push_back(metadata->getShort());
     metadata->setAbsoluteOffset(562);
     split = metadata->getShort();
   } else if (v0 != 70 && csize <= 0x4001 && !uncorrectedRawValues) {
-    for (uint32 i = 0; i < csize; i++) {
-      curve[i] = metadata->getShort();
-    }
+    type = 2;   // All values given
+    for (uint32 i = 0; i < csize; i++)
+      key.push_back(metadata->getShort());
     _max = csize;
   }
-  initTable(huffSelect);
+  if (_max < 1)
+    ThrowRDE("NikonDecompressor: Invalid curve size");
+
+  key.push_back(step);
+  key.push_back(_max);
+  key.push_back(type);
+  if (curveEntry)
+    getCurveCache()->release(curveEntry);
+  curve = NULL;
+  curveEntry = getCurveCache()->acquire(key);
+  if (!curveEntry) {
+    ushort16* c = (ushort16*)_aligned_malloc((0x8000 + 8) * sizeof(ushort16), 16);
+    if (!c)
+      ThrowRDE("NikonDecompressor: Memory Allocation failed.");
+    for (uint32 i = 0; i < 0x8000 ; i++)
+      c[i] = i;
+    if (type == 1) {
+      for (uint32 i = 0; i < csize; i++)
+        c[i*step] = key[i];
+      for (int i = 0; i < _max; i++)
+        c[i] = (c[i-i%step] * (step - i % step) +
+                c[i-i%step+step] * (i % step)) / step;
+    } else if (type == 2) {
+      for (uint32 i = 0; i < csize; i++)
+        c[i] = key[i];
+    }
+    ushort16 top = c[_max-1];
+    for (int i = _max; i < 0x8000 + 8; i++)
+      c[i] = top;
+    curveEntry = getCurveCache()->insert(new NikonCurve(key, c), key);
+  }
+  curve = curveEntry->curve;
+  initTable(huffSelect, 0);
+  // Rows from "split" use the second table
+  if (split)
+    initTable(huffSelect + 1, 1);
 
   mRaw->whitePoint = curve[_max-1];
   mRaw->blackLevel = curve[0];
 
-  ushort16 top = mRaw->whitePoint;
-  for (int i = _max; i < 0x8000; i++)
-    curve[i] = top;
+  BitPumpMSB bits(mFile->getData(offset, size), size);
+  cw = w / 2;
+  this->h = h;
+
+  MSBRowState s;
+  s.bits = &bits;
+  s.y = 0;
+  for (int i = 0; i < 2; i++) {
+    s.pUp1[i] = pUp1[i];
+    s.pUp2[i] = pUp2[i];
+  }
+
+  uint32 parts = 1;
+  if (mUseThreads)
+    parts = ThreadPool::getPool()->getPartCount(h, 64);
+  if (parts > 1) {
+    RowCheckpointScan<NikonDecompressor, MSBRowState> scan(this, &NikonDecompressor::scanRows, &NikonDecompressor::decodeRows, mRaw->stats);
+    scan.run(&s, h, parts);
+  } else {
+    decodeRows(&s, h);
+  }
+
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, bits.getOffset());
+}
 
-  uint32 x, y;
-  BitPumpMSB bits(mFile->getData(offset), size);
+void NikonDecompressor::decodeRows(MSBRowState *s, uint32 endY) {
+  BitPumpMSB &bits = *s->bits;
   uchar8 *draw = mRaw->getData();
-  uint32 *dest;
   uint32 pitch = mRaw->pitch;
 
-  int pLeft1 = 0;
-  int pLeft2 = 0;
-  uint32 cw = w / 2;
-
-  for (y = 0; y < h; y++) {
-    if (split && y == split) {
-      initTable(huffSelect + 1);
+  for (uint32 y = s->y; y < endY; y++) {
+    HuffmanTable *dctbl1 = getTable(y);
+    uint32 *dest = (uint32*) & draw[y*pitch];  // Adjust destination
+    if (curveAfterRows) {
+      uint32 x = 0;
+      try {
+        s->pUp1[y&1] += HuffDecodeNikon(bits, dctbl1);
+        s->pUp2[y&1] += HuffDecodeNikon(bits, dctbl1);
+        int pLeft1 = s->pUp1[y&1];
+        int pLeft2 = s->pUp2[y&1];
+        dest[x++] = clampbits(pLeft1,15) | (clampbits(pLeft2,15) << 16);
+        for (; x < cw; x++) {
+          bits.checkPos();
+          pLeft1 += HuffDecodeNikon(bits, dctbl1);
+          pLeft2 += HuffDecodeNikon(bits, dctbl1);
+          dest[x] = clampbits(pLeft1,15) | (clampbits(pLeft2,15) << 16);
+        }
+      } catch (...) {
+        // Leave the decoded part of the row as if it was decoded with the curve
+        applyCurve((ushort16*)dest, x * 2);
+        throw;
+      }
+      applyCurve((ushort16*)dest, cw * 2);
+      continue;
     }
-    dest = (uint32*) & draw[y*pitch];  // Adjust destination
-    pUp1[y&1] += HuffDecodeNikon(bits);
-    pUp2[y&1] += HuffDecodeNikon(bits);
-    pLeft1 = pUp1[y&1];
-    pLeft2 = pUp2[y&1];
+    s->pUp1[y&1] += HuffDecodeNikon(bits, dctbl1);
+    s->pUp2[y&1] += HuffDecodeNikon(bits, dctbl1);
+    int pLeft1 = s->pUp1[y&1];
+    int pLeft2 = s->pUp2[y&1];
     dest[0] = curve[clampbits(pLeft1,15)] | ((uint32)curve[clampbits(pLeft2,15)] << 16);
-    for (x = 1; x < cw; x++) {
+    for (uint32 x = 1; x < cw; x++) {
       bits.checkPos();
-      pLeft1 += HuffDecodeNikon(bits);
-      pLeft2 += HuffDecodeNikon(bits);
+      pLeft1 += HuffDecodeNikon(bits, dctbl1);
+      pLeft2 += HuffDecodeNikon(bits, dctbl1);
       dest[x] = curve[clampbits(pLeft1,15)] | ((uint32)curve[clampbits(pLeft2,15)] << 16);
     }
   }
+  s->y = endY;
+}
+
+void NikonDecompressor::applyCurve(ushort16* pix, uint32 n) {
+#ifdef RAWSPEED_AVX2
+  if (CpuFeatures::has(CPU_AVX2)) {
+    applyCurveAVX2(pix, n);
+    return;
+  }
+#endif
+  for (uint32 i = 0; i < n; i++)
+    pix[i] = curve[pix[i]];
+}
+
+#ifdef RAWSPEED_AVX2
+/* Looks up 16 values at the time, with the even and odd values in separate gathers. */
+/* Each gather reads 32 bits, so the value after the curve is read and masked out. */
+RAWSPEED_TARGET_AVX2 void NikonDecompressor::applyCurveAVX2(ushort16* pix, uint32 n) {
+  const int* table = (const int*)curve;
+  __m256i mask = _mm256_set1_epi32(0xffff);
+  uint32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((__m256i*)&pix[i]);
+    __m256i even = _mm256_i32gather_epi32(table, _mm256_and_si256(v, mask), 2);
+    __m256i odd = _mm256_i32gather_epi32(table, _mm256_srli_epi32(v, 16), 2);
+    v = _mm256_or_si256(_mm256_and_si256(even, mask), _mm256_slli_epi32(odd, 16));
+    _mm256_storeu_si256((__m256i*)&pix[i], v);
+  }
+  for (; i < n; i++)
+    pix[i] = curve[pix[i]];
+}
+#endif // RAWSPEED_AVX2
+
+/* Moves "s" to the start of row "endY", reading the same bits as decodeRows(), */
+/* but only decoding the first pixels of each row, as they update the predictors. */
+void NikonDecompressor::scanRows(MSBRowState *s, uint32 endY) {
+  BitPumpMSB &bits = *s->bits;
+
+  for (uint32 y = s->y; y < endY; y++) {
+    HuffmanTable *dctbl1 = getTable(y);
+    s->pUp1[y&1] += HuffDecodeNikon(bits, dctbl1);
+    s->pUp2[y&1] += HuffDecodeNikon(bits, dctbl1);
+    for (uint32 x = 1; x < cw; x++) {
+      bits.checkPos();
+      for (int i = 0; i < 2; i++)
+        if (!skipBigTableCode(dctbl1, &bits))
+          HuffDecodeNikon(bits, dctbl1);
+    }
+  }
+  s->y = endY;
 }
 
 /*
@@ -143,13 +315,11 @@ void NikonDecompressor::DecompressNikon(ByteStream *metadata, uint32 w, uint32 h
 *
 *--------------------------------------------------------------
 */
-int NikonDecompressor::HuffDecodeNikon(BitPumpMSB& bits) {
+int NikonDecompressor::HuffDecodeNikon(BitPumpMSB& bits, HuffmanTable *dctbl1) {
   int rv;
   int l, temp;
   int code, val ;
 
-  HuffmanTable *dctbl1 = &huff[0];
-
   bits.fill();
   code = bits.peekBitsNoFill(14);
   val = dctbl1->bigTable[code];
@@ -2,6 +2,7 @@
 #define NIKON_DECOMPRESSOR_H
 
 #include "LJpegDecompressor.h"
+#include "BitPumpMSB.h"
 /* 
     RawSpeed - RAW file decoder.
 
@@ -26,20 +27,39 @@
 
 namespace RawSpeed {
 
-class BitPumpMSB;
-
+class NikonCurve;
+
 class NikonDecompressor :
   public LJpegDecompressor
 {
 public:
-  NikonDecompressor(FileMap* file, RawImage img );
+  NikonDecompressor(FileMap* file, const RawImage& img );
+  virtual ~NikonDecompressor(void);
 public:
   void DecompressNikon(ByteStream *meta, uint32 w, uint32 h, uint32 bitsPS, uint32 offset, uint32 size);
+  /* Deletes the cached curves that are not in use */
+  static void flushCurves();
   bool uncorrectedRawValues;
+  /* Decode rows without the curve, and apply it to each row after it is decoded, */
+  /* with AVX2 gathers if available. The result is the same. Off by default, as it */
+  /* is only faster on CPUs with fast gathers. Set by the nikon_curve_after_rows hint. */
+  bool curveAfterRows;
 private:
-  void initTable(uint32 huffSelect);
-  int HuffDecodeNikon(BitPumpMSB& bits);
-  ushort16 curve[0x8000];
+  /* Sets huff[n] to one of the nikon_tree tables */
+  void initTable(uint32 huffSelect, uint32 n);
+  int HuffDecodeNikon(BitPumpMSB& bits, HuffmanTable *dctbl1);
+  HuffmanTable* getTable(uint32 y) {return (split && y >= split) ? huff[1] : huff[0];}
+  /* Decode from "s" to the start of row "endY" */
+  void decodeRows(MSBRowState *s, uint32 endY);
+  void scanRows(MSBRowState *s, uint32 endY);
+  /* Replaces the first "n" values of "pix" with their curve value */
+  void applyCurve(ushort16* pix, uint32 n);
+  void applyCurveAVX2(ushort16* pix, uint32 n);
+  const ushort16* curve;  // 0x8000 values, shared with other decoders
+  NikonCurve* curveEntry; // Cache entry of "curve"
+  uint32 split;   // First row decoded with the second table, 0 if none
+  uint32 cw;      // Pixel pairs per row
+  uint32 h;
 };
 
 static const uchar8 nikon_tree[][32] = {
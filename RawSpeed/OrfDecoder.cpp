@@ -64,7 +64,7 @@ RawImage OrfDecoder::decodeRawInternal() {
   uint32 height = raw->getEntry(IMAGELENGTH)->getInt();
   uint32 bps = raw->getEntry(BITSPERSAMPLE)->getInt();
 
-  if (!mFile->isValid(offsets->getInt() + counts->getInt()))
+  if (!mFile->isValid(offsets->getInt(), counts->getInt()))
     ThrowRDE("ORF Decoder: Truncated file");
 
   mRaw->dim = iPoint2D(width, height);
@@ -91,11 +91,11 @@ RawImage OrfDecoder::decodeRawInternal() {
     ThrowRDE("ORF Decoder: Unable to parse makernote");
   }
 
-  // We add 3 bytes slack, since the bitpump might be a few bytes ahead.
-  ByteStream s(mFile->getData(offsets->getInt()), counts->getInt() + 3);
+  // The bit pump reads zeros after the strip, so no slack is needed
+  ByteStream s(mFile->getData(offsets->getInt(), counts->getInt()), counts->getInt());
 
   if ((hints.find(string("force_uncompressed")) != hints.end())) {
-    ByteStream in(mFile->getData(offsets->getInt()), counts->getInt() + 3);
+    ByteStream in(mFile->getData(offsets->getInt(), counts->getInt()), counts->getInt());
     iPoint2D size(width, height),pos(0,0);
     readUncompressedRaw(in, size, pos, width*bps/8,bps, BitOrder_Jpeg32);
     return mRaw;
@@ -110,147 +110,282 @@ RawImage OrfDecoder::decodeRawInternal() {
 
   return mRaw;
 }
-/* This is probably the slowest decoder of them all.
- * I cannot see any way to effectively speed up the prediction
- * phase, which is by far the slowest part of this algorithm.
- * Also there is no way to multithread this code, since prediction
- * is based on the output of all previous pixel (bar the first four)
- */
-
-void OrfDecoder::decodeCompressed(ByteStream& s, uint32 w, uint32 h) {
-  int nbits, sign, low, high, i, left0, up, nw0, left1, nw1;
-  int acarry0[3], acarry1[3], pred, diff;
+/* Number of leading zeros of 12 bit values, 12 for 0 */
+static char orf_bittable[4096];
+static pthread_once_t orf_bittable_once = PTHREAD_ONCE_INIT;
 
-  uchar8* data = mRaw->getData();
-  int pitch = mRaw->pitch;
-
-  /* Build a table to quickly look up "high" value */
-  char bittable[4096];
-  for (i = 0; i < 4096; i++) {
-    int b = i;
+static void createBitTable() {
+  for (int i = 0; i < 4096; i++) {
+    int high;
     for (high = 0; high < 12; high++)
-      if ((b>>(11-high))&1)
+      if ((i>>(11-high))&1)
         break;
-      bittable[i] = high;
+    orf_bittable[i] = high;
   }
-  left0 = nw0 = left1 = nw1 = 0;
+}
+
+/* Decodes one difference, with its carries. The number of bits is the same as */
+/* for (nbits = 2 + i; (ushort16) acarry[0] >> (nbits + i); nbits++); */
+/* but found from the bit length of acarry[0]. */
+static inline int decodeOrfDifference(BitPumpMSB &bits, int *acarry) {
+  bits.checkPos();
+  bits.fill();
+  int i = 2 * (acarry[2] < 3);
+  uint32 carry = (ushort16)acarry[0];
+  int length = carry >> 4 ? 16 - orf_bittable[carry >> 4] : 12 - orf_bittable[carry];
+  int nbits = max(2 + i, length - i);
+
+  int b = bits.peekBitsNoFill(15);
+  int sign = (b >> 14) * -1;
+  int low  = (b >> 12) & 3;
+  int high = orf_bittable[b&4095];
+  // Skip bits used above.
+  bits.skipBitsNoFill(min(12+3, high + 1 + 3));
+
+  if (high == 12)
+    high = bits.getBits(16 - nbits) >> 1;
+
+  acarry[0] = (high << nbits) | bits.getBits(nbits);
+  int diff = (acarry[0] ^ sign) + acarry[1];
+  acarry[1] = (diff * 3 + acarry[1]) >> 5;
+  acarry[2] = acarry[0] > 16 ? 0 : acarry[2] + 1;
+  return (diff << 2) | low;
+}
+
+/* Prediction is based on the output of all previous pixels (bar the first four),
+ * so it cannot be split into parts. Instead the bits are decoded to differences
+ * first, which only depends on the previous bits, as the carries are reset for
+ * each row. The predicted values are added after that. The values are 16 bit,
+ * so adding the prediction to the stored 16 bit difference gives the same result.
+ */
+
+void OrfDecoder::decodeCompressed(ByteStream& s, uint32 w, uint32 h) {
+  pthread_once(&orf_bittable_once, createBitTable);
 
   s.skipBytes(7);
   BitPumpMSB bits(&s);
 
-  for (uint32 y = 0; y < h; y++) {
-    memset(acarry0, 0, sizeof acarry0);
-    memset(acarry1, 0, sizeof acarry1);
-    ushort16* dest = (ushort16*) & data[y*pitch];
-    bool y_border = y < 2;
-    bool border = TRUE;
-    for (uint32 x = 0; x < w; x++) {
-      bits.checkPos();
-      bits.fill();
-      i = 2 * (acarry0[2] < 3);
-      for (nbits = 2 + i; (ushort16) acarry0[0] >> (nbits + i); nbits++);
-
-      int b = bits.peekBitsNoFill(15);
-      sign = (b >> 14) * -1;
-      low  = (b >> 12) & 3;
-      high = bittable[b&4095];
-      // Skip bits used above.
-      bits.skipBitsNoFill(min(12+3, high + 1 + 3));
-
-      if (high == 12)
-        high = bits.getBits(16 - nbits) >> 1;
-
-      acarry0[0] = (high << nbits) | bits.getBits(nbits);
-      diff = (acarry0[0] ^ sign) + acarry0[1];
-      acarry0[1] = (diff * 3 + acarry0[1]) >> 5;
-      acarry0[2] = acarry0[0] > 16 ? 0 : acarry0[2] + 1;
-
-      if (border) {
-        if (y_border && x < 2)  
-          pred = 0;
-        else if (y_border) 
-          pred = left0;
-        else { 
-          pred = dest[-pitch+((int)x)];
-          nw0 = pred;
-        }
-        dest[x] = pred + ((diff << 2) | low);
-        // Set predictor
-        left0 = dest[x];
-      } else {
-        up  = dest[-pitch+((int)x)];
-        int leftMinusNw = left0 - nw0;
-        int upMinusNw = up - nw0;
-        // Check if sign is different, and one is not zero
-        if (leftMinusNw * upMinusNw < 0) {
-          if (other_abs(leftMinusNw) > 32 || other_abs(upMinusNw) > 32)
-            pred = left0 + upMinusNw;
-          else 
-            pred = (left0 + up) >> 1;
-        } else 
-          pred = other_abs(leftMinusNw) > other_abs(upMinusNw) ? left0 : up;
-
-        dest[x] = pred + ((diff << 2) | low);
-        // Set predictors
-        left0 = dest[x];
-        nw0 = up;
+  // Odd widths write a pixel after the row, that may be the next row
+  if (ThreadPool::getPool()->getSize() > 1 && !(w & 1) && h > 1) {
+    decodeCompressedThreaded(bits, w, h);
+  } else {
+    for (uint32 y = 0; y < h; y++) {
+      uint32 x = 0;
+      try {
+        decodeDifferences(bits, y, w, &x);
+      } catch (...) {
+        predictRow(y, x);
+        throw;
       }
-      
-      // ODD PIXELS
-      x += 1;
-      bits.checkPos();
-      bits.fill();
-      i = 2 * (acarry1[2] < 3);
-      for (nbits = 2 + i; (ushort16) acarry1[0] >> (nbits + i); nbits++);
-      b = bits.peekBitsNoFill(15);
-      sign = (b >> 14) * -1;
-      low  = (b >> 12) & 3;
-      high = bittable[b&4095];
-      // Skip bits used above.
-      bits.skipBitsNoFill(min(12+3, high + 1 + 3));
-
-      if (high == 12)
-        high = bits.getBits(16 - nbits) >> 1;
-
-      acarry1[0] = (high << nbits) | bits.getBits(nbits);
-      diff = (acarry1[0] ^ sign) + acarry1[1];
-      acarry1[1] = (diff * 3 + acarry1[1]) >> 5;
-      acarry1[2] = acarry1[0] > 16 ? 0 : acarry1[2] + 1;
-
-      if (border) {
-        if (y_border && x < 2)  
-          pred = 0;
-        else if (y_border) 
-          pred = left1;
-        else { 
-          pred = dest[-pitch+((int)x)];
-          nw1 = pred;
-        }
-        dest[x] = pred + ((diff << 2) | low);
-        // Set predictor
-        left1 = dest[x];
-      } else {
-        up  = dest[-pitch+((int)x)];
-        int leftMinusNw = left1 - nw1;
-        int upMinusNw = up - nw1;
-
-        // Check if sign is different, and one is not zero
-        if (leftMinusNw * upMinusNw < 0) {
-          if (other_abs(leftMinusNw) > 32 || other_abs(upMinusNw) > 32)
-            pred = left1 + upMinusNw;
-          else 
-            pred = (left1 + up) >> 1;
-        } else 
-          pred = other_abs(leftMinusNw) > other_abs(upMinusNw) ? left1 : up;
-
-        dest[x] = pred + ((diff << 2) | low);
-
-        // Set predictors
-        left1 = dest[x];
-        nw1 = up;
+      predictRow(y, x);
+    }
+  }
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, bits.getOffset());
+}
+
+void OrfDecoder::decodeDifferences(BitPumpMSB &bits, uint32 y, uint32 w, uint32 *x) {
+  int acarry0[3] = {0, 0, 0};
+  int acarry1[3] = {0, 0, 0};
+  ushort16* dest = (ushort16*) & mRaw->getData()[y*mRaw->pitch];
+  uint32 &i = *x;
+  for (i = 0; i < w;) {
+    dest[i] = decodeOrfDifference(bits, acarry0);
+    i++;
+    dest[i] = decodeOrfDifference(bits, acarry1);
+    i++;
+  }
+}
+
+void OrfDecoder::predictRow(uint32 y, uint32 n) {
+  int left0, nw0, left1, nw1, up, pred;
+  int pitch = mRaw->pitch;
+  ushort16* dest = (ushort16*) & mRaw->getData()[y*pitch];
+  left0 = nw0 = left1 = nw1 = 0;
+  bool y_border = y < 2;
+  bool border = TRUE;
+  for (uint32 x = 0; x < n; x++) {
+    if (border) {
+      if (y_border && x < 2)  
+        pred = 0;
+      else if (y_border) 
+        pred = left0;
+      else { 
+        pred = dest[-pitch+((int)x)];
+        nw0 = pred;
+      }
+      dest[x] = pred + dest[x];
+      // Set predictor
+      left0 = dest[x];
+    } else {
+      up  = dest[-pitch+((int)x)];
+      int leftMinusNw = left0 - nw0;
+      int upMinusNw = up - nw0;
+      // Check if sign is different, and one is not zero
+      if (leftMinusNw * upMinusNw < 0) {
+        if (other_abs(leftMinusNw) > 32 || other_abs(upMinusNw) > 32)
+          pred = left0 + upMinusNw;
+        else 
+          pred = (left0 + up) >> 1;
+      } else 
+        pred = other_abs(leftMinusNw) > other_abs(upMinusNw) ? left0 : up;
+
+      dest[x] = pred + dest[x];
+      // Set predictors
+      left0 = dest[x];
+      nw0 = up;
+    }
+
+    // ODD PIXELS
+    x += 1;
+    if (x >= n)
+      break;
+    if (border) {
+      if (y_border && x < 2)  
+        pred = 0;
+      else if (y_border) 
+        pred = left1;
+      else { 
+        pred = dest[-pitch+((int)x)];
+        nw1 = pred;
       }
-	  border = y_border;
+      dest[x] = pred + dest[x];
+      // Set predictor
+      left1 = dest[x];
+    } else {
+      up  = dest[-pitch+((int)x)];
+      int leftMinusNw = left1 - nw1;
+      int upMinusNw = up - nw1;
+
+      // Check if sign is different, and one is not zero
+      if (leftMinusNw * upMinusNw < 0) {
+        if (other_abs(leftMinusNw) > 32 || other_abs(upMinusNw) > 32)
+          pred = left1 + upMinusNw;
+        else 
+          pred = (left1 + up) >> 1;
+      } else 
+        pred = other_abs(leftMinusNw) > other_abs(upMinusNw) ? left1 : up;
+
+      dest[x] = pred + dest[x];
+
+      // Set predictors
+      left1 = dest[x];
+      nw1 = up;
+    }
+    border = y_border;
+  }
+}
+
+/**
+*  Threaded decoding:
+*  One job decodes the differences of each row, while another job adds the
+*  predicted values to the rows, that have been decoded. As the predictions depend
+*  on the row above, rows are handled in order, but the two stages run concurrently.
+**/
+
+/* Shared by the jobs of one decodeCompressedThreaded() call */
+class OrfDecodeState
+{
+public:
+  OrfDecodeState() : rows(0), failX(0), done(false), ioError(false) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+  }
+  ~OrfDecodeState() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+  BitPumpMSB *bits;
+  uint32 w, h;
+  uint32 rows;      // Number of rows with decoded differences
+  uint32 failX;     // Differences decoded in row "rows", if decoding failed
+  bool done;        // No more rows will be decoded
+  string error;     // Error of decoding, empty if none
+  bool ioError;     // The error was an IOException
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;  // Signalled when rows are decoded, and when decoding ends
+};
+
+class OrfDecodeJob
+{
+public:
+  OrfDecoder* parent;
+  OrfDecodeState* state;
+  uint32 n;   // 0 decodes differences, 1 adds predictions
+};
+
+void *OrfDecodeThread(void *_this) {
+  OrfDecodeJob* me = (OrfDecodeJob*)_this;
+  me->parent->decodeCompressedJob(me);
+  return NULL;
+}
+
+void OrfDecoder::decodeCompressedThreaded(BitPumpMSB &bits, uint32 w, uint32 h) {
+  OrfDecodeState state;
+  state.bits = &bits;
+  state.w = w;
+  state.h = h;
+
+  OrfDecodeJob jobs[2];
+  void *args[2];
+  for (uint32 i = 0; i < 2; i++) {
+    jobs[i].parent = this;
+    jobs[i].state = &state;
+    jobs[i].n = i;
+    args[i] = &jobs[i];
+  }
+  // Jobs are started in order, so the differences are always being decoded,
+  // when predictions wait for them.
+  ThreadPool::getPool()->run(OrfDecodeThread, args, 2);
+
+  if (!state.error.empty()) {
+    if (state.ioError)
+      throw IOException(state.error);
+    throw RawDecoderException(state.error);
+  }
+}
+
+void OrfDecoder::decodeCompressedJob(OrfDecodeJob *job) {
+  JobTimer timer(mRaw->stats);
+  OrfDecodeState *st = job->state;
+  if (job->n == 0) {
+    uint32 x = 0;
+    try {
+      for (uint32 y = 0; y < st->h; y++) {
+        decodeDifferences(*st->bits, y, st->w, &x);
+        pthread_mutex_lock(&st->mutex);
+        st->rows = y + 1;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->mutex);
+      }
+    } catch (RawDecoderException &e) {
+      st->error = e.what();
+    } catch (IOException &e) {
+      st->error = e.what();
+      st->ioError = true;
+    }
+    pthread_mutex_lock(&st->mutex);
+    st->failX = x;
+    st->done = true;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+  } else {
+    uint32 y = 0;
+    while (true) {
+      pthread_mutex_lock(&st->mutex);
+      while (st->rows <= y && !st->done)
+        pthread_cond_wait(&st->cond, &st->mutex);
+      uint32 rows = st->rows;
+      bool done = st->done;
+      pthread_mutex_unlock(&st->mutex);
+      for (; y < rows; y++)
+        predictRow(y, st->w);
+      if (done)
+        break;
     }
+    // The part of the failed row that was decoded
+    if (y < st->h)
+      predictRow(y, st->failX);
   }
 }
 
@@ -308,7 +443,7 @@ void OrfDecoder::decodeMetaDataInternal(CameraMetaData *meta) {
 
           // It seems like Olympus doesn't mind data pointing out of the makernote, 
           // so we give it the entire remaining file
-          FileMap makermap2((uchar8*)&makernote[0], mFile->getSize()-makernoteEntry->getDataOffset());
+          FileMap makermap2(mFile, makernoteEntry->getDataOffset(), mFile->getSize()-makernoteEntry->getDataOffset());
           if (makertiff.getHostEndian() == makertiff.tiff_endian)
             ImageProcessing = new TiffIFD(&makermap2, offset);
           else
@@ -30,6 +30,8 @@
 
 namespace RawSpeed {
 
+class OrfDecodeJob;
+
 class OrfDecoder :
   public RawDecoder
 {
@@ -40,8 +42,16 @@ public:
   virtual void decodeMetaDataInternal(CameraMetaData *meta);
   virtual void checkSupportInternal(CameraMetaData *meta);
   virtual TiffIFD* getRootIFD() {return mRootIFD;}
+  /* Internal: runs a part of decodeCompressedThreaded() on the thread pool */
+  void decodeCompressedJob(OrfDecodeJob *job);
 private:
   void decodeCompressed(ByteStream& s,uint32 w, uint32 h);
+  void decodeCompressedThreaded(BitPumpMSB &bits, uint32 w, uint32 h);
+  /* Decodes row "y" to the differences from the predicted values, which are */
+  /* stored in the row. "x" is the number of pixels stored, also if it fails. */
+  void decodeDifferences(BitPumpMSB &bits, uint32 y, uint32 w, uint32 *x);
+  /* Adds the predicted values to the first "n" differences of row "y" */
+  void predictRow(uint32 y, uint32 n);
   TiffIFD *mRootIFD;
 };
 
@@ -62,7 +62,7 @@ RawImage PefDecoder::decodeRawInternal() {
   if (counts->count != offsets->count) {
     ThrowRDE("PEF Decoder: Byte count number does not match strip size: count:%u, strips:%u ", counts->count, offsets->count);
   }
-  if (!mFile->isValid(offsets->getInt() + counts->getInt()))
+  if (!mFile->isValid(offsets->getInt(), counts->getInt()))
     ThrowRDE("PEF Decoder: Truncated file.");
 
   uint32 width = raw->getEntry(IMAGEWIDTH)->getInt();
@@ -72,6 +72,7 @@ RawImage PefDecoder::decodeRawInternal() {
   mRaw->createData();
   try {
     PentaxDecompressor l(mFile, mRaw);
+    l.mUseThreads = true;
     l.decodePentax(mRootIFD, offsets->getInt(), counts->getInt());
   } catch (IOException &e) {
     mRaw->setError(e.what());
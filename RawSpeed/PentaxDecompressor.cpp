@@ -1,5 +1,6 @@
 #include "StdAfx.h"
 #include "PentaxDecompressor.h"
+#include "RowCheckpointScan.h"
 /*
     RawSpeed - RAW file decoder.
 
@@ -24,7 +25,7 @@
 
 namespace RawSpeed {
 
-PentaxDecompressor::PentaxDecompressor(FileMap* file, RawImage img) :
+PentaxDecompressor::PentaxDecompressor(FileMap* file, const RawImage& img) :
     LJpegDecompressor(file, img) {
   pentaxBits = 0;
 }
@@ -36,20 +37,25 @@ PentaxDecompressor::~PentaxDecompressor(void) {
 }
 
 
-void PentaxDecompressor::decodePentax(TiffIFD *root, uint32 offset, uint32 size) {
+void PentaxDecompressor::initTable(TiffIFD *root) {
   // Prepare huffmann table              0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 = 16 entries
   static const uchar8 pentax_tree[] =  { 0, 2, 3, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0,
                                          3, 4, 2, 5, 1, 6, 0, 7, 8, 9, 10, 11, 12
                                        };
   //                                     0 1 2 3 4 5 6 7 8 9  0  1  2 = 13 entries
-  HuffmanTable *dctbl1 = &huff[0];
+  HuffmanTable table;
+  HuffmanTable *dctbl1 = &table;
 
   /* Attempt to read huffman table, if found in makernote */
   if (root->hasEntryRecursive((TiffTag)0x220)) {
     TiffEntry *t = root->getEntryRecursive((TiffTag)0x220);
     if (t->type == TIFF_UNDEFINED) {
       const uchar8* data = t->getData();
+      if (t->count < 2)
+        ThrowRDE("PentaxDecompressor: Huffman table too short");
       uint32 depth = (data[1]+12)&0xf;
+      if (t->count < 14 + depth * 3)
+        ThrowRDE("PentaxDecompressor: Huffman table too short");
       data +=14;
       uint32 v0[16];
       uint32 v1[16];
@@ -58,8 +64,11 @@ void PentaxDecompressor::decodePentax(TiffIFD *root, uint32 offset, uint32 size)
          v0[i] = (uint32)(data[i*2])<<8 | (uint32)(data[i*2+1]);
       data+=depth*2;
 
-      for (uint32 i = 0; i < depth; i++)
+      for (uint32 i = 0; i < depth; i++) {
         v1[i] = data[i];
+        if (v1[i] < 1 || v1[i] > 12)
+          ThrowRDE("PentaxDecompressor: Invalid Huffman code length: %u", v1[i]);
+      }
 
       /* Reset bits */
       for (uint32 i = 0; i < 17; i++)
@@ -101,34 +110,81 @@ void PentaxDecompressor::decodePentax(TiffIFD *root, uint32 offset, uint32 size)
     }
   }
   mUseBigtable = true;
-  createHuffmanTable(dctbl1);
+  // The table is shared with other decoders using the same table, and by all jobs
+  setHuffmanTable(0, new HuffmanTable(table));
+}
+
+void PentaxDecompressor::decodePentax(TiffIFD *root, uint32 offset, uint32 size) {
+  initTable(root);
+
+  pentaxBits = new BitPumpMSB(mFile->getData(offset, size), size);
+  uint32 h = mRaw->dim.y;
+
+  MSBRowState s;
+  s.bits = pentaxBits;
+  s.y = 0;
+  for (int i = 0; i < 2; i++)
+    s.pUp1[i] = s.pUp2[i] = 0;
+
+  uint32 parts = 1;
+  if (mUseThreads)
+    parts = ThreadPool::getPool()->getPartCount(h, 64);
+  if (parts > 1) {
+    RowCheckpointScan<PentaxDecompressor, MSBRowState> scan(this, &PentaxDecompressor::scanRows, &PentaxDecompressor::decodeRows, mRaw->stats);
+    scan.run(&s, h, parts);
+  } else {
+    decodeRows(&s, h);
+  }
 
-  pentaxBits = new BitPumpMSB(mFile->getData(offset), size);
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, pentaxBits->getOffset());
+}
+
+void PentaxDecompressor::decodeRows(MSBRowState *s, uint32 endY) {
+  BitPumpMSB *bits = s->bits;
   uchar8 *draw = mRaw->getData();
   ushort16 *dest;
   uint32 w = mRaw->dim.x;
-  uint32 h = mRaw->dim.y;
-  int pUp1[2] = {0, 0};
-  int pUp2[2] = {0, 0};
   int pLeft1 = 0;
   int pLeft2 = 0;
 
-  for (uint32 y = 0;y < h;y++) {
-    pentaxBits->checkPos();
+  for (uint32 y = s->y; y < endY; y++) {
+    bits->checkPos();
     dest = (ushort16*) & draw[y*mRaw->pitch];  // Adjust destination
-    pUp1[y&1] += HuffDecodePentax();
-    pUp2[y&1] += HuffDecodePentax();
-    dest[0] = pLeft1 = pUp1[y&1];
-    dest[1] = pLeft2 = pUp2[y&1];
+    s->pUp1[y&1] += HuffDecodePentax(bits);
+    s->pUp2[y&1] += HuffDecodePentax(bits);
+    dest[0] = pLeft1 = s->pUp1[y&1];
+    dest[1] = pLeft2 = s->pUp2[y&1];
     for (uint32 x = 2; x < w ; x += 2) {
-      pLeft1 += HuffDecodePentax();
-      pLeft2 += HuffDecodePentax();
+      pLeft1 += HuffDecodePentax(bits);
+      pLeft2 += HuffDecodePentax(bits);
       dest[x] =  pLeft1;
       dest[x+1] =  pLeft2;
       _ASSERTE(pLeft1 >= 0 && pLeft1 <= (65536));
       _ASSERTE(pLeft2 >= 0 && pLeft2 <= (65536));
     }
   }
+  s->y = endY;
+}
+
+/* Moves "s" to the start of row "endY", reading the same bits as decodeRows(), */
+/* but only decoding the first pixels of each row, as they update the predictors. */
+void PentaxDecompressor::scanRows(MSBRowState *s, uint32 endY) {
+  BitPumpMSB *bits = s->bits;
+  HuffmanTable *dctbl1 = huff[0];
+  uint32 w = mRaw->dim.x;
+
+  for (uint32 y = s->y; y < endY; y++) {
+    bits->checkPos();
+    s->pUp1[y&1] += HuffDecodePentax(bits);
+    s->pUp2[y&1] += HuffDecodePentax(bits);
+    for (uint32 x = 2; x < w ; x += 2) {
+      for (int i = 0; i < 2; i++)
+        if (!skipBigTableCode(dctbl1, bits))
+          HuffDecodePentax(bits);
+    }
+  }
+  s->y = endY;
 }
 
 /*
@@ -148,36 +204,40 @@ void PentaxDecompressor::decodePentax(TiffIFD *root, uint32 offset, uint32 size)
 *--------------------------------------------------------------
 */
 int PentaxDecompressor::HuffDecodePentax() {
+  return HuffDecodePentax(pentaxBits);
+}
+
+int PentaxDecompressor::HuffDecodePentax(BitPumpMSB *bits) {
   int rv;
   int l, temp;
   int code, val;
 
-  HuffmanTable *dctbl1 = &huff[0];
+  HuffmanTable *dctbl1 = huff[0];
   /*
   * If the huffman code is less than 8 bits, we can use the fast
   * table lookup to get its value.  It's more than 8 bits about
   * 3-4% of the time.
   */
-  pentaxBits->fill();
-  code = pentaxBits->peekBitsNoFill(14);
+  bits->fill();
+  code = bits->peekBitsNoFill(14);
   val = dctbl1->bigTable[code];
   if ((val&0xff) !=  0xff) {
-    pentaxBits->skipBitsNoFill(val&0xff);
+    bits->skipBitsNoFill(val&0xff);
     return val >> 8;
   }
 
   rv = 0;
-  code = pentaxBits->peekByteNoFill();
+  code = bits->peekByteNoFill();
   val = dctbl1->numbits[code];
   l = val & 15;
   if (l) {
-    pentaxBits->skipBitsNoFill(l);
+    bits->skipBitsNoFill(l);
     rv = val >> 4;
   }  else {
-    pentaxBits->skipBits(8);
+    bits->skipBits(8);
     l = 8;
     while (code > dctbl1->maxcode[l]) {
-      temp = pentaxBits->getBitNoFill();
+      temp = bits->getBitNoFill();
       code = (code << 1) | temp;
       l++;
     }
@@ -203,7 +263,7 @@ int PentaxDecompressor::HuffDecodePentax() {
   */
 
   if (rv) {
-    int x = pentaxBits->getBits(rv);
+    int x = bits->getBits(rv);
     if ((x & (1 << (rv - 1))) == 0)
       x -= (1 << rv) - 1;
     return x;
@@ -33,11 +33,18 @@ class PentaxDecompressor :
   public LJpegDecompressor
 {
 public:
-  PentaxDecompressor(FileMap* file, RawImage img);
+  PentaxDecompressor(FileMap* file, const RawImage& img);
   virtual ~PentaxDecompressor(void);
   int HuffDecodePentax();
+  int HuffDecodePentax(BitPumpMSB *bits);
   void decodePentax(TiffIFD *root, uint32 offset, uint32 size);
   BitPumpMSB *pentaxBits;
+private:
+  /* Sets huff[0] to the table in the makernote, or the default table */
+  void initTable(TiffIFD *root);
+  /* Decode from "s" to the start of row "endY" */
+  void decodeRows(MSBRowState *s, uint32 endY);
+  void scanRows(MSBRowState *s, uint32 endY);
 };
 
 } // namespace RawSpeed
@@ -26,6 +26,10 @@ namespace RawSpeed {
 
 	RawDecoder::RawDecoder(FileMap* file) : mRaw(RawImage::create()), mFile(file) {
   decoderVersion = 0;
+  mOutputBuffer = NULL;
+  mOutputBufferSize = 0;
+  mOutputPitch = 0;
+  mStats = NULL;
   failOnUnknown = FALSE;
   interpolateBadPixels = TRUE;
   applyStage1DngOpcodes = TRUE;
@@ -38,6 +42,12 @@ RawDecoder::~RawDecoder(void) {
     delete(*i);
   }
   ownedObjects.clear();
+  if (mStats) {
+    // The image may outlive the decoder
+    if (mRaw->stats == mStats)
+      mRaw->stats = NULL;
+    delete mStats;
+  }
 }
 
 void RawDecoder::decodeUncompressed(TiffIFD *rawIFD, BitOrder order) {
@@ -63,13 +73,16 @@ void RawDecoder::decodeUncompressed(TiffIFD *rawIFD, BitOrder order) {
 
     offY += yPerSlice;
 
-    if (mFile->isValid(slice.offset + slice.count)) // Only decode if size is valid
+    if (mFile->isValid(slice.offset, slice.count)) // Only decode if size is valid
       slices.push_back(slice);
   }
 
   if (0 == slices.size())
     ThrowRDE("RAW Decoder: No valid slices found. File probably truncated.");
 
+  for (uint32 i = 0; i < slices.size(); i++)
+    mFile->prefetch(slices[i].offset, slices[i].count);
+
   mRaw->dim = iPoint2D(width, offY);
   mRaw->createData();
   mRaw->whitePoint = (1<<bitPerPixel)-1;
@@ -77,12 +90,14 @@ void RawDecoder::decodeUncompressed(TiffIFD *rawIFD, BitOrder order) {
   offY = 0;
   for (uint32 i = 0; i < slices.size(); i++) {
     RawSlice slice = slices[i];
-    ByteStream in(mFile->getData(slice.offset), slice.count);
+    ByteStream in(mFile->getData(slice.offset, slice.count), slice.count);
     iPoint2D size(width, slice.h);
     iPoint2D pos(0, offY);
     bitPerPixel = (int)((uint64)(slice.count * 8) / (slice.h * width));
     try {
       readUncompressedRaw(in, size, pos, width*bitPerPixel / 8, bitPerPixel, order);
+      if (mStats)
+        mStats->addCount(COUNTER_SLICES);
     } catch (RawDecoderException &e) {
       if (i>0)
         mRaw->setError(e.what());
@@ -98,6 +113,20 @@ void RawDecoder::decodeUncompressed(TiffIFD *rawIFD, BitOrder order) {
   }
 }
 
+/* Unpacks lines y to h-1 for readUncompressedRaw(). The same for all bit orders, */
+/* so it is instantiated for each bit pump. */
+template <class BitPumpType>
+static void readUncompressedLines(BitPumpType& bits, uchar8* data, uint32 outPitch, uint32 w, uint32 y, uint32 h, uint32 bitPerPixel, uint32 skipBits) {
+  for (; y < h; y++) {
+    ushort16* dest = (ushort16*) & data[y*outPitch];
+    bits.checkPos();
+    for (uint32 x = 0 ; x < w; x++) {
+      dest[x] = bits.getBits(bitPerPixel);
+    }
+    bits.skipBits(skipBits);
+  }
+}
+
 void RawDecoder::readUncompressedRaw(ByteStream &input, iPoint2D& size, iPoint2D& offset, int inputPitch, int bitPerPixel, BitOrder order) {
   uchar8* data = mRaw->getData();
   uint32 outPitch = mRaw->pitch;
@@ -122,6 +151,8 @@ void RawDecoder::readUncompressedRaw(ByteStream &input, iPoint2D& size, iPoint2D
 
   uint32 y = offset.y;
   h = MIN(h + (uint32)offset.y, (uint32)mRaw->dim.y);
+  if (mStats)
+    mStats->addCount(COUNTER_BYTES, (uint64)inputPitch * (h - y));
 
   if (mRaw->getDataType() == TYPE_FLOAT32)
   {
@@ -132,31 +163,13 @@ void RawDecoder::readUncompressedRaw(ByteStream &input, iPoint2D& size, iPoint2D
     return;
   }
 
+  uchar8* dest = &data[offset.x*sizeof(ushort16)*cpp];
   if (BitOrder_Jpeg == order) {
     BitPumpMSB bits(&input);
-    w *= cpp;
-    for (; y < h; y++) {
-      ushort16* dest = (ushort16*) & data[offset.x*sizeof(ushort16)*cpp+y*outPitch];
-      bits.checkPos();
-      for (uint32 x = 0 ; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
+    readUncompressedLines(bits, dest, outPitch, w*cpp, y, h, bitPerPixel, skipBits);
   } else if (BitOrder_Jpeg32 == order) {
-      BitPumpMSB32 bits(&input);
-      w *= cpp;
-      for (; y < h; y++) {
-        ushort16* dest = (ushort16*) & data[offset.x*sizeof(ushort16)*cpp+y*outPitch];
-        bits.checkPos();
-        for (uint32 x = 0 ; x < w; x++) {
-          uint32 b = bits.getBits(bitPerPixel);
-          dest[x] = b;
-        }
-        bits.skipBits(skipBits);
-      }
-
+    BitPumpMSB32 bits(&input);
+    readUncompressedLines(bits, dest, outPitch, w*cpp, y, h, bitPerPixel, skipBits);
   } else {
 
     if (bitPerPixel == 16 && getHostEndianness() == little)  {
@@ -169,16 +182,7 @@ void RawDecoder::readUncompressedRaw(ByteStream &input, iPoint2D& size, iPoint2D
       return;
     }
     BitPumpPlain bits(&input);
-    w *= cpp;
-    for (; y < h; y++) {
-      ushort16* dest = (ushort16*) & data[offset.x*sizeof(ushort16)+y*outPitch];
-      bits.checkPos();
-      for (uint32 x = 0 ; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
+    readUncompressedLines(bits, dest, outPitch, w*cpp, y, h, bitPerPixel, skipBits);
   }
 }
 
@@ -281,6 +285,7 @@ void RawDecoder::setMetaData(CameraMetaData *meta, string make, string model, st
 
 void *RawDecoderDecodeThread(void *_this) {
   RawDecoderThread* me = (RawDecoderThread*)_this;
+  JobTimer timer(me->parent->getStats());
   try {
     if (me->taskNo >= 0)
       me->parent->decodeThreaded(me);
@@ -291,58 +296,69 @@ void *RawDecoderDecodeThread(void *_this) {
   } catch (IOException &ex) {
     me->parent->mRaw->setError(ex.what());
   }
-
-  pthread_exit(NULL);
   return 0;
 }
 
 void RawDecoder::startThreads() {
-  uint32 threads;
-  threads = getThreadCount(); 
+  ThreadPool* pool = ThreadPool::getPool();
+  // Split into more parts than threads, so the load is balanced while decoding.
+  uint32 parts = pool->getPartCount(mRaw->dim.y, 16);
   int y_offset = 0;
-  int y_per_thread = (mRaw->dim.y + threads - 1) / threads;
-  RawDecoderThread *t = new RawDecoderThread[threads];
-
-  pthread_attr_t attr;
+  int y_per_part = (mRaw->dim.y + parts - 1) / parts;
+  RawDecoderThread *t = new RawDecoderThread[parts];
+  void **args = new void*[parts];
 
-  /* Initialize and set thread detached attribute */
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-  for (uint32 i = 0; i < threads; i++) {
+  for (uint32 i = 0; i < parts; i++) {
     t[i].start_y = y_offset;
-    t[i].end_y = MIN(y_offset + y_per_thread, mRaw->dim.y);
+    t[i].end_y = MIN(y_offset + y_per_part, mRaw->dim.y);
     t[i].parent = this;
-    pthread_create(&t[i].threadid, &attr, RawDecoderDecodeThread, &t[i]);
+    args[i] = &t[i];
     y_offset = t[i].end_y;
   }
 
-  void *status;
-  for (uint32 i = 0; i < threads; i++) {
-    pthread_join(t[i].threadid, &status);
-  }
-  if (mRaw->errors.size() >= threads)
-    ThrowRDE("RawDecoder::startThreads: All threads reported errors. Cannot load image.");
-
+  pool->run(RawDecoderDecodeThread, args, parts);
+  delete[] args;
   delete[] t;
+
+  if (mRaw->errors.size() >= parts)
+    ThrowRDE("RawDecoder::startThreads: All threads reported errors. Cannot load image.");
 }
 
 void RawDecoder::decodeThreaded(RawDecoderThread * t) {
   ThrowRDE("Internal Error: This class does not support threaded decoding");
 }
 
+void RawDecoder::setOutputBuffer(uchar8* buffer, uint64 size, uint32 pitch) {
+  mRaw->setExternalData(buffer, size, pitch);
+  mOutputBuffer = buffer;
+  mOutputBufferSize = size;
+  mOutputPitch = pitch;
+}
+
 RawSpeed::RawImage RawDecoder::decodeRaw()
 {
   try {
-    RawImage raw = decodeRawInternal();
+    RawImage raw(mRaw);
+    {
+      StageTimer timer(mStats, STAGE_DECODE);
+      raw = decodeRawInternal();
+    }
+    // Decoders may have replaced the image
+    raw->stats = mStats;
     if (interpolateBadPixels)
       raw->fixBadPixels();
     return raw;
   } catch (TiffParserException &e) {
+    countError();
     ThrowRDE("%s", e.what());
   } catch (FileIOException &e) {
+    countError();
     ThrowRDE("%s", e.what());
+  } catch (RawDecoderException &) {
+    countError();
+    throw;
   } catch (IOException &e) {
+    countError();
     ThrowRDE("%s", e.what());
   }
   return NULL;
@@ -350,6 +366,7 @@ RawSpeed::RawImage RawDecoder::decodeRaw()
 
 void RawDecoder::decodeMetaData(CameraMetaData *meta)
 {
+  StageTimer timer(mStats, STAGE_METADATA);
   try {
     return decodeMetaDataInternal(meta);
   } catch (TiffParserException &e) {
@@ -374,36 +391,46 @@ void RawDecoder::checkSupport(CameraMetaData *meta)
   }
 }
 
+void RawDecoder::enableStats()
+{
+  if (!mStats) {
+    mStats = new RawDecoderStats();
+    if (mParseTime.count)
+      mStats->addStage(STAGE_PARSE, mParseTime.wallTime, mParseTime.cpuTime);
+  }
+  mRaw->stats = mStats;
+}
+
+void RawDecoder::setParseTime(double wallTime, double cpuTime)
+{
+  mParseTime.wallTime = wallTime;
+  mParseTime.cpuTime = cpuTime;
+  mParseTime.count = 1;
+}
+
+void RawDecoder::countError()
+{
+  if (mStats)
+    mStats->addCount(COUNTER_ERRORS);
+}
+
 void RawDecoder::startTasks( uint32 tasks )
 {
-  uint32 threads;
-  threads = min(tasks, getThreadCount()); 
-  int ctask = 0;
-  RawDecoderThread *t = new RawDecoderThread[threads];
-
-  pthread_attr_t attr;
-
-  /* Initialize and set thread detached attribute */
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-  /* TODO: Create a way to re-use threads */
-  void *status;
-  while ((uint32)ctask < tasks) {
-    for (uint32 i = 0; i < threads && (uint32)ctask < tasks; i++) {
-      t[i].taskNo = ctask++;
-      t[i].parent = this;
-      pthread_create(&t[i].threadid, &attr, RawDecoderDecodeThread, &t[i]);
-    }
-    for (uint32 i = 0; i < threads; i++) {
-      pthread_join(t[i].threadid, &status);
-    }
-  } 
+  RawDecoderThread *t = new RawDecoderThread[tasks];
+  void **args = new void*[tasks];
 
-  if (mRaw->errors.size() >= tasks)
-    ThrowRDE("RawDecoder::startThreads: All threads reported errors. Cannot load image.");
+  for (uint32 i = 0; i < tasks; i++) {
+    t[i].taskNo = i;
+    t[i].parent = this;
+    args[i] = &t[i];
+  }
 
+  ThreadPool::getPool()->run(RawDecoderDecodeThread, args, tasks);
+  delete[] args;
   delete[] t;
+
+  if (mRaw->errors.size() >= tasks)
+    ThrowRDE("RawDecoder::startThreads: All threads reported errors. Cannot load image.");
 }
 
 } // namespace RawSpeed
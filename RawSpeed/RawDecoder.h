@@ -10,6 +10,7 @@
 #include "BitPumpPlain.h"
 #include "CameraMetaData.h"
 #include "TiffIFD.h"
+#include "ThreadPool.h"
 
 /* 
     RawSpeed - RAW file decoder.
@@ -45,7 +46,6 @@ class RawDecoderThread
     uint32 start_y;
     uint32 end_y;
     const char* error;
-    pthread_t threadid;
     RawDecoder* parent;
     uint32 taskNo;
 };
@@ -70,6 +70,12 @@ public:
   /* and there will not be any data in the mRaw image. */
   RawImage decodeRaw();
 
+  /* Decode into a caller owned buffer, instead of allocating the image. */
+  /* Must be called before decodeRaw(). See RawImageData::setExternalData() for */
+  /* the requirements. Decoders producing more than one image may only place */
+  /* the first in the buffer - check isExternalData() on the returned image. */
+  void setOutputBuffer(uchar8* buffer, uint64 size, uint32 pitch = 0);
+
   /* This will apply metadata information from the camera database, */
   /* such as crop, black+white level, etc. */
   /* This function is expected to use the protected "setMetaData" */
@@ -122,6 +128,18 @@ public:
   /* Returns NULL if unknown */
   virtual FileMap* getCompressedData() {return NULL;}
 
+  /* Collect time spent in each decoding stage and on each thread, and count */
+  /* bytes, slices, tiles and errors. Must be called before decodeRaw(). */
+  /* When not enabled, the instrumentation only costs a NULL pointer test. */
+  void enableStats();
+
+  /* The collected stats, or NULL if not enabled. Owned by the decoder. */
+  /* Use RawDecoderStats::getStats() for a copy that can be exported. */
+  RawDecoderStats* getStats() {return mStats;}
+
+  /* Set by RawParser - time spent parsing the file, before the decoder was created */
+  void setParseTime(double wallTime, double cpuTime);
+
 protected:
   /* Attempt to decode the image */
   /* A RawDecoderException will be thrown if the image cannot be decoded, */
@@ -131,13 +149,15 @@ protected:
   virtual void decodeMetaDataInternal(CameraMetaData *meta) = 0;
   virtual void checkSupportInternal(CameraMetaData *meta) = 0;
 
-  /* Helper function for decoders - splits the image vertically and starts of decoder threads */
-  /* The function returns when all threads are done */
+  /* Helper function for decoders - splits the image vertically and runs the parts on the thread pool */
+  /* The image is split into several parts per thread, so decodeThreaded() must */
+  /* handle any start_y/end_y range. The function returns when all parts are done */
   /* All errors are silently pushed into the "errors" array.*/
-  /* If all threads report an error an exception will be thrown*/
+  /* If all parts report an error an exception will be thrown*/
   void startThreads();
 
-  /* Helper function for decoders -  */
+  /* Helper function for decoders - runs "tasks" decodeThreaded() calls on the thread pool, */
+  /* with taskNo set from 0 to tasks-1 */
   /* The function returns when all tasks are done */
   /* All errors are silently pushed into the "errors" array.*/
   /* If all threads report an error an exception will be thrown*/
@@ -168,6 +188,9 @@ protected:
   /* order: Order of the bits - see Common.h for possibilities. */
   void decodeUncompressed(TiffIFD *rawIFD, BitOrder order);
 
+  /* Adds a thrown error to the stats, if enabled */
+  void countError();
+
   /* The Raw input file to be decoded */
   FileMap *mFile; 
 
@@ -178,6 +201,16 @@ protected:
   /* Higher number in code than xml: Image will be decoded. */
   int decoderVersion;
 
+  /* Caller owned output buffer, set with setOutputBuffer(). Decoders that */
+  /* replace mRaw must call mRaw->setExternalData() with these. */
+  uchar8* mOutputBuffer;
+  uint64 mOutputBufferSize;
+  uint32 mOutputPitch;
+
+  /* Stats, if enabled with enableStats() */
+  RawDecoderStats* mStats;
+  DecoderTiming mParseTime;
+
   /* Hints set for the camera after checkCameraSupported has been called from the implementation*/
    map<string,string> hints;
 };
@@ -187,7 +220,7 @@ public:
   RawSlice() { h = offset = count = 0;};
   ~RawSlice() {};
   uint32 h;
-  uint32 offset;
+  uint64 offset;
   uint32 count;
 };
 
@@ -0,0 +1,148 @@
+#include "StdAfx.h"
+#include "RawDecoderStats.h"
+#include "ThreadPool.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+DecoderStats::DecoderStats() {
+  for (int i = 0; i < COUNTER_COUNT; i++)
+    counters[i] = 0;
+}
+
+const char* DecoderStats::getStageName(DecoderStage stage) {
+  switch (stage) {
+    case STAGE_PARSE: return "parse";
+    case STAGE_DECODE: return "decode";
+    case STAGE_SRAW_INTERPOLATE: return "sraw_interpolate";
+    case STAGE_BAD_PIXELS: return "bad_pixels";
+    case STAGE_SCALE_BLACK_WHITE: return "scale_black_white";
+    case STAGE_DNG_OPCODES: return "dng_opcodes";
+    case STAGE_METADATA: return "metadata";
+    default: break;
+  }
+  return "unknown";
+}
+
+const char* DecoderStats::getCounterName(DecoderCounter counter) {
+  switch (counter) {
+    case COUNTER_BYTES: return "bytes";
+    case COUNTER_SLICES: return "slices";
+    case COUNTER_TILES: return "tiles";
+    case COUNTER_ERRORS: return "errors";
+    default: break;
+  }
+  return "unknown";
+}
+
+RawDecoderStats::RawDecoderStats() {
+  pthread_mutex_init(&mMutex, NULL);
+}
+
+RawDecoderStats::~RawDecoderStats(void) {
+  pthread_mutex_destroy(&mMutex);
+}
+
+void RawDecoderStats::addStage(DecoderStage stage, double wallTime, double cpuTime) {
+  pthread_mutex_lock(&mMutex);
+  DecoderTiming& t = mStats.stages[stage];
+  t.wallTime += wallTime;
+  t.cpuTime += cpuTime;
+  t.count++;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void RawDecoderStats::addJob(uint32 thread, double wallTime, double cpuTime) {
+  pthread_mutex_lock(&mMutex);
+  if (mStats.threads.size() <= thread)
+    mStats.threads.resize(thread + 1);
+  DecoderTiming& t = mStats.threads[thread];
+  t.wallTime += wallTime;
+  t.cpuTime += cpuTime;
+  t.count++;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void RawDecoderStats::addCount(DecoderCounter counter, uint64 n) {
+  pthread_mutex_lock(&mMutex);
+  mStats.counters[counter] += n;
+  pthread_mutex_unlock(&mMutex);
+}
+
+DecoderStats RawDecoderStats::getStats() {
+  pthread_mutex_lock(&mMutex);
+  DecoderStats s = mStats;
+  pthread_mutex_unlock(&mMutex);
+  return s;
+}
+
+void RawDecoderStats::reset() {
+  pthread_mutex_lock(&mMutex);
+  mStats = DecoderStats();
+  pthread_mutex_unlock(&mMutex);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+void RawDecoderStats::getTime(double* wallTime, double* cpuTime) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  *wallTime = t.tv_sec + t.tv_nsec * 1e-9;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  *cpuTime = t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#else
+
+void RawDecoderStats::getTime(double* wallTime, double* cpuTime) {
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  *wallTime = (double)counter.QuadPart / (double)frequency.QuadPart;
+
+  // Kernel and user time, in 100 ns units
+  FILETIME creation, exit_time, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &creation, &exit_time, &kernel, &user);
+  uint64 k = ((uint64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+  uint64 u = ((uint64)user.dwHighDateTime << 32) | user.dwLowDateTime;
+  *cpuTime = (k + u) * 1e-7;
+}
+
+#endif
+
+void StageTimer::stop() {
+  double wall, cpu;
+  RawDecoderStats::getTime(&wall, &cpu);
+  stats->addStage(stage, wall - startWall, cpu - startCpu);
+}
+
+void JobTimer::stop() {
+  double wall, cpu;
+  RawDecoderStats::getTime(&wall, &cpu);
+  stats->addJob(ThreadPool::getThreadNumber(), wall - startWall, cpu - startCpu);
+}
+
+} // namespace RawSpeed
@@ -0,0 +1,143 @@
+#ifndef RAW_DECODER_STATS_H
+#define RAW_DECODER_STATS_H
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/* Stages timed while decoding. */
+/* Stages may be nested - sRaw interpolation and DNG opcodes run within STAGE_DECODE */
+typedef enum {
+  STAGE_PARSE,              // Parsing the TIFF structure, in RawParser
+  STAGE_DECODE,             // decodeRaw() - decompression, including Huffman decoding
+  STAGE_SRAW_INTERPOLATE,   // Canon sRaw/mRaw chroma interpolation
+  STAGE_BAD_PIXELS,         // Bad pixel interpolation
+  STAGE_SCALE_BLACK_WHITE,  // RawImageData::scaleBlackWhite()
+  STAGE_DNG_OPCODES,        // DNG opcode lists
+  STAGE_METADATA,           // decodeMetaData(), including crop
+  STAGE_COUNT
+} DecoderStage;
+
+typedef enum {
+  COUNTER_BYTES,    // Bytes of image data consumed by the decompressors
+  COUNTER_SLICES,   // Strips or slices decoded
+  COUNTER_TILES,    // Tiles decoded
+  COUNTER_ERRORS,   // Errors - both those added to RawImageData::errors and thrown ones
+  COUNTER_COUNT
+} DecoderCounter;
+
+/* Accumulated time, in seconds */
+class DecoderTiming
+{
+public:
+  DecoderTiming() : wallTime(0), cpuTime(0), count(0) {};
+  double wallTime;
+  double cpuTime;   // CPU time of the thread doing the work
+  uint32 count;     // Number of times the stage was run, or jobs run by a thread
+};
+
+/* The collected values. A plain copy, that can be kept after the decoder is deleted */
+class DecoderStats
+{
+public:
+  DecoderStats();
+  static const char* getStageName(DecoderStage stage);
+  static const char* getCounterName(DecoderCounter counter);
+  DecoderTiming stages[STAGE_COUNT];
+  uint64 counters[COUNTER_COUNT];
+  /* Jobs run on the thread pool, indexed by ThreadPool::getThreadNumber(). */
+  /* Entry 0 is the thread that submitted the work. Jobs it runs are therefore */
+  /* also included in the CPU time of the stage. */
+  vector<DecoderTiming> threads;
+};
+
+/*************************************************************************
+ * Collects timing and counters for one decoder
+ *
+ * Enabled with RawDecoder::enableStats(). When not enabled, no object is
+ * created, and the timers below only test for a NULL pointer.
+ * Thread safe - stages and counters may be added from any thread.
+ *
+ *****************************/
+class RawDecoderStats
+{
+public:
+  RawDecoderStats();
+  virtual ~RawDecoderStats(void);
+  void addStage(DecoderStage stage, double wallTime, double cpuTime);
+  void addJob(uint32 thread, double wallTime, double cpuTime);
+  void addCount(DecoderCounter counter, uint64 n = 1);
+  /* Returns a copy of the values collected so far */
+  DecoderStats getStats();
+  void reset();
+  /* Current wall clock time and CPU time of the calling thread, in seconds */
+  static void getTime(double* wallTime, double* cpuTime);
+private:
+  pthread_mutex_t mMutex;
+  DecoderStats mStats;
+};
+
+/* Times a stage, from construction until it goes out of scope. */
+/* Does nothing if "stats" is NULL */
+class StageTimer
+{
+public:
+  StageTimer(RawDecoderStats* _stats, DecoderStage _stage) : stats(_stats), stage(_stage) {
+    if (stats)
+      RawDecoderStats::getTime(&startWall, &startCpu);
+  }
+  ~StageTimer() {
+    if (stats)
+      stop();
+  }
+private:
+  void stop();
+  RawDecoderStats* stats;
+  DecoderStage stage;
+  double startWall;
+  double startCpu;
+};
+
+/* Times a job run on the thread pool, and adds it to the current thread. */
+/* Does nothing if "stats" is NULL */
+class JobTimer
+{
+public:
+  JobTimer(RawDecoderStats* _stats) : stats(_stats) {
+    if (stats)
+      RawDecoderStats::getTime(&startWall, &startCpu);
+  }
+  ~JobTimer() {
+    if (stats)
+      stop();
+  }
+private:
+  void stop();
+  RawDecoderStats* stats;
+  double startWall;
+  double startCpu;
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -31,13 +31,14 @@ namespace RawSpeed {
 RawImageData::RawImageData(void):
     dim(0, 0), isCFA(true),
     blackLevel(-1), whitePoint(65536),
-    dataRefCount(0), data(0), cpp(1), bpp(0),
+    dataRefCount(0), data(0), dataSize(0),
+    externalData(0), externalSize(0), externalPitch(0), cpp(1), bpp(0),
     uncropped_dim(0, 0) {
   blackLevelSeparate[0] = blackLevelSeparate[1] = blackLevelSeparate[2] = blackLevelSeparate[3] = -1;
-  pthread_mutex_init(&mymutex, NULL);
   subsampling.x = subsampling.y = 1;
   isoSpeed = 0;
   mBadPixelMap = NULL;
+  stats = NULL;
   pthread_mutex_init(&errMutex, NULL);
   pthread_mutex_init(&mBadPixelMutex, NULL);
 }
@@ -45,14 +46,15 @@ RawImageData::RawImageData(void):
 RawImageData::RawImageData(iPoint2D _dim, uint32 _bpc, uint32 _cpp) :
     dim(_dim),
     blackLevel(-1), whitePoint(65536),
-    dataRefCount(0), data(0), cpp(_cpp), bpp(_bpc * _cpp),
+    dataRefCount(0), data(0), dataSize(0),
+    externalData(0), externalSize(0), externalPitch(0), cpp(_cpp), bpp(_bpc * _cpp),
     uncropped_dim(0, 0) {
   blackLevelSeparate[0] = blackLevelSeparate[1] = blackLevelSeparate[2] = blackLevelSeparate[3] = -1;
   subsampling.x = subsampling.y = 1;
   isoSpeed = 0;
   mBadPixelMap = NULL;
+  stats = NULL;
   createData();
-  pthread_mutex_init(&mymutex, NULL);
   pthread_mutex_init(&errMutex, NULL);
   pthread_mutex_init(&mBadPixelMutex, NULL);
 }
@@ -60,7 +62,6 @@ RawImageData::RawImageData(iPoint2D _dim, uint32 _bpc, uint32 _cpp) :
 RawImageData::~RawImageData(void) {
   _ASSERTE(dataRefCount == 0);
   mOffset = iPoint2D(0, 0);
-  pthread_mutex_destroy(&mymutex);
   pthread_mutex_destroy(&errMutex);
   pthread_mutex_destroy(&mBadPixelMutex);
   for (uint32 i = 0 ; i < errors.size(); i++) {
@@ -79,15 +80,42 @@ void RawImageData::createData() {
   if (data)
     ThrowRDE("RawImageData: Duplicate data allocation in createData.");
   pitch = (((dim.x * bpp) + 15) / 16) * 16;
-  data = (uchar8*)_aligned_malloc(pitch * dim.y, 16);
+  if (externalData) {
+    if (externalPitch) {
+      if (externalPitch < pitch)
+        ThrowRDE("RawImageData::createData: External buffer pitch (%u) is smaller than image width (%u bytes).", externalPitch, dim.x * bpp);
+      pitch = externalPitch;
+    }
+    if ((uint64)pitch * dim.y > externalSize)
+      ThrowRDE("RawImageData::createData: Image (%dx%d) does not fit in external buffer.", dim.x, dim.y);
+    data = externalData;
+    uncropped_dim = dim;
+    return;
+  }
+  dataSize = (uint64)pitch * dim.y;
+  data = ImageBufferPool::getPool()->alloc(dataSize);
   if (!data)
     ThrowRDE("RawImageData::createData: Memory Allocation failed.");
   uncropped_dim = dim;
 }
 
-void RawImageData::destroyData() {
+void RawImageData::setExternalData(uchar8* buffer, uint64 size, uint32 _pitch) {
+  if (!buffer)
+    return;
   if (data)
-    _aligned_free(data);
+    ThrowRDE("RawImageData::setExternalData: Image data already allocated.");
+  if (((size_t)buffer) & 15)
+    ThrowRDE("RawImageData::setExternalData: Buffer must be aligned to 16 bytes.");
+  if (_pitch & 15)
+    ThrowRDE("RawImageData::setExternalData: Pitch must be a multiple of 16 bytes.");
+  externalData = buffer;
+  externalSize = size;
+  externalPitch = _pitch;
+}
+
+void RawImageData::destroyData() {
+  if (data && !externalData)
+    ImageBufferPool::getPool()->release(data, dataSize);
   if (mBadPixelMap)
     _aligned_free(mBadPixelMap);
   data = 0;
@@ -168,6 +196,8 @@ void RawImageData::setError( const char* err )
   pthread_mutex_lock(&errMutex);
   errors.push_back(_strdup(err));
   pthread_mutex_unlock(&errMutex);
+  if (stats)
+    stats->addCount(COUNTER_ERRORS);
 }
 
 void RawImageData::createBadPixelMap()
@@ -182,25 +212,18 @@ void RawImageData::createBadPixelMap()
 }
 
 RawImage::RawImage(RawImageData* p) : p_(p) {
-  pthread_mutex_lock(&p_->mymutex);
-  ++p_->dataRefCount;
-  pthread_mutex_unlock(&p_->mymutex);
+  atomicIncrement(&p_->dataRefCount);
 }
 
 RawImage::RawImage(const RawImage& p) : p_(p.p_) {
-  pthread_mutex_lock(&p_->mymutex);
-  ++p_->dataRefCount;
-  pthread_mutex_unlock(&p_->mymutex);
+  atomicIncrement(&p_->dataRefCount);
 }
 
 RawImage::~RawImage() {
-  pthread_mutex_lock(&p_->mymutex);
-  if (--p_->dataRefCount == 0) {
-    pthread_mutex_unlock(&p_->mymutex);
+  // The decrement is a full barrier, so all writes to the image by other
+  // owners are visible before it is deleted.
+  if (p_ && atomicDecrement(&p_->dataRefCount) == 0)
     delete p_;
-    return;
-  }
-  pthread_mutex_unlock(&p_->mymutex);
 }
 
 
@@ -223,6 +246,7 @@ void RawImageData::transferBadPixelsToMap()
 
 void RawImageData::fixBadPixels()
 {
+  StageTimer timer(stats, STAGE_BAD_PIXELS);
 #if !defined (EMULATE_DCRAW_BAD_PIXELS)
 
   /* Transfer if not already done */
@@ -271,29 +295,35 @@ void RawImageData::fixBadPixels()
 
 }
 
+void *RawImageWorkerThread(void *_this) {
+  RawImageWorker* me = (RawImageWorker*)_this;
+  me->performTask();
+  return 0;
+}
+
 void RawImageData::startWorker(RawImageWorker::RawImageWorkerTask task, bool cropped )
 {
   int height = cropped ? dim.y : uncropped_dim.y;
 
-  int threads = getThreadCount();
-  if (threads <= 1) {
+  ThreadPool* pool = ThreadPool::getPool();
+  int parts = pool->getPartCount(height, 16);
+  if (parts <= 1) {
     RawImageWorker worker(this, task, 0, height);
     worker.performTask();
     return;
   }
 
-  RawImageWorker **workers = new RawImageWorker*[threads];
+  RawImageWorker **workers = new RawImageWorker*[parts];
   int y_offset = 0;
-  int y_per_thread = (height + threads - 1) / threads;
+  int y_per_part = (height + parts - 1) / parts;
 
-  for (int i = 0; i < threads; i++) {
-    int y_end = MIN(y_offset + y_per_thread, height);
+  for (int i = 0; i < parts; i++) {
+    int y_end = MIN(y_offset + y_per_part, height);
     workers[i] = new RawImageWorker(this, task, y_offset, y_end);
-    workers[i]->startThread();
     y_offset = y_end;
   }
-  for (int i = 0; i < threads; i++) {
-    workers[i]->waitForThread();
+  pool->run(RawImageWorkerThread, (void**)workers, parts);
+  for (int i = 0; i < parts; i++) {
     delete workers[i];
   }
   delete[] workers;
@@ -320,7 +350,7 @@ void RawImageData::fixBadPixelsThread( int start_y, int end_y )
   }
 }
 
-void RawImageData::blitFrom(RawImage src, iPoint2D srcPos, iPoint2D size, iPoint2D destPos )
+void RawImageData::blitFrom(const RawImage& src, iPoint2D srcPos, iPoint2D size, iPoint2D destPos )
 {
   iRectangle2D src_rect(srcPos, size);
   iRectangle2D dest_rect(destPos, size);
@@ -382,40 +412,27 @@ void RawImageData::expandBorder(iRectangle2D validData)
   }
 }
 
-RawImageData* RawImage::operator->() {
+RawImageData* RawImage::operator->() const {
   return p_;
 }
 
-RawImageData& RawImage::operator*() {
+RawImageData& RawImage::operator*() const {
   return *p_;
 }
 
 RawImage& RawImage::operator=(const RawImage & p) {
-  if (this == &p)      // Same object?
-    return *this;      // Yes, so skip assignment, and just return *this.
-  pthread_mutex_lock(&p_->mymutex);
-  // Retain the old RawImageData before overwriting it
+  if (p_ == p.p_)      // Same data?
+    return *this;      // Yes, so refcount is unchanged.
+  // Increment use on new data, before the old data can be released
+  atomicIncrement(&p.p_->dataRefCount);
   RawImageData* const old = p_;
   p_ = p.p_;
-  // Increment use on new data
-  ++p_->dataRefCount;
   // If the RawImageData previously used by "this" is unused, delete it.
-  if (--old->dataRefCount == 0) {
-  	pthread_mutex_unlock(&(old->mymutex));
-  	delete old;
-  } else {
-  	pthread_mutex_unlock(&(old->mymutex));
-  }
+  if (old && atomicDecrement(&old->dataRefCount) == 0)
+    delete old;
   return *this;
 }
 
-void *RawImageWorkerThread(void *_this) {
-  RawImageWorker* me = (RawImageWorker*)_this;
-  me->performTask();
-  pthread_exit(NULL);
-  return 0;
-}
-
 RawImageWorker::RawImageWorker( RawImageData *_img, RawImageWorkerTask _task, int _start_y, int _end_y )
 {
   data = _img;
@@ -424,23 +441,9 @@ RawImageWorker::RawImageWorker( RawImageData *_img, RawImageWorkerTask _task, in
   task = _task;
 }
 
-void RawImageWorker::startThread()
-{
-  /* Initialize and set thread detached attribute */
-  pthread_attr_t attr;
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-  pthread_create(&threadid, &attr, RawImageWorkerThread, this);
-}
-
-void RawImageWorker::waitForThread()
-{
-  void *status;
-  pthread_join(threadid, &status);
-}
-
 void RawImageWorker::performTask()
 {
+  JobTimer timer(data->stats);
   try {
     switch(task)
     {
@@ -3,6 +3,8 @@
 
 #include "ColorFilterArray.h"
 #include "BlackArea.h"
+#include "ImageBufferPool.h"
+#include "RawDecoderStats.h"
 
 /* 
     RawSpeed - RAW file decoder.
@@ -36,11 +38,8 @@ class RawImageWorker {
 public:
   typedef enum {SCALE_VALUES, FIX_BAD_PIXELS} RawImageWorkerTask;
   RawImageWorker(RawImageData *img, RawImageWorkerTask task, int start_y, int end_y);
-  void startThread();
-  void waitForThread();
   void performTask();
 protected:
-  pthread_t threadid;
   RawImageData* data;
   RawImageWorkerTask task;
   int start_y;
@@ -57,7 +56,15 @@ public:
   void setCpp(uint32 val);
   virtual void createData();
   virtual void destroyData();
-  void blitFrom(const RawImage src, iPoint2D srcPos, iPoint2D size, iPoint2D destPos);
+  /* Use a caller owned buffer for the image data, instead of allocating it. */
+  /* Must be called before createData(). The buffer must be aligned to 16 bytes. */
+  /* pitch must be a multiple of 16 - 0 selects the smallest pitch for the image. */
+  /* Rows may be written up to the full pitch. createData() will throw, if */
+  /* the image does not fit in "size" bytes. A NULL buffer is ignored. */
+  /* The buffer is never freed, and must remain valid while the image exists. */
+  void setExternalData(uchar8* buffer, uint64 size, uint32 pitch = 0);
+  bool isExternalData() {return !!externalData;}
+  void blitFrom(const RawImage& src, iPoint2D srcPos, iPoint2D size, iPoint2D destPos);
   RawSpeed::RawImageType getDataType() const { return dataType; }
   uchar8* getData();
   uchar8* getData(uint32 x, uint32 y);    // Not super fast, but safe. Don't use per pixel.
@@ -95,6 +102,9 @@ public:
   pthread_mutex_t mBadPixelMutex;   // Mutex for above, must be used if more than 1 thread is accessing vector
   uchar8 *mBadPixelMap;
   uint32 mBadPixelMapPitch;
+  /* Timing and counters, if enabled with RawDecoder::enableStats(), otherwise NULL. */
+  /* Owned by the decoder, and reset to NULL when the decoder is deleted. */
+  RawDecoderStats* stats;
 
 protected:
   RawImageType dataType;
@@ -104,12 +114,15 @@ protected:
   virtual void fixBadPixel( uint32 x, uint32 y, int component = 0) = 0;
   void fixBadPixelsThread(int start_y, int end_y);
   void startWorker(RawImageWorker::RawImageWorkerTask task, bool cropped );
-  uint32 dataRefCount;
+  volatile int32 dataRefCount;   // Only modified through atomicIncrement/atomicDecrement
   uchar8* data;
+  uint64 dataSize; // Size of data allocation
+  uchar8* externalData;  // Caller owned buffer, or NULL
+  uint64 externalSize;
+  uint32 externalPitch;
   uint32 cpp;      // Components per pixel
   uint32 bpp;      // Bytes per pixel.
   friend class RawImage;
-  pthread_mutex_t mymutex;
   iPoint2D mOffset;
   iPoint2D uncropped_dim;
 };
@@ -119,10 +132,19 @@ class RawImageDataU16 : public RawImageData
 public:
   virtual void scaleBlackWhite();
   virtual void calculateBlackAreas();
+  /* Internal: adds a part of the black areas to "histogram", on the thread pool */
+  void histogramBlackAreas(int* histogram, uint32 start_row, uint32 end_row);
 
 protected:
   virtual void scaleValues(int start_y, int end_y);
   virtual void fixBadPixel( uint32 x, uint32 y, int component = 0);
+  /* Versions of scaleValues() for each instruction set, selected with CpuFeatures. */
+  /* All give the same result as scaleValuesRef(). */
+  void scaleValuesSSE2(int start_y, int end_y);
+  void scaleValuesAVX2(int start_y, int end_y);
+  void scaleValuesNEON(int start_y, int end_y);
+  void scaleValuesRef(int start_y, int end_y);
+  void getScaleWords(uint32 *words);
 
   RawImageDataU16(void);
   RawImageDataU16(iPoint2D dim, uint32 cpp=1);
@@ -147,15 +169,23 @@ protected:
  public:
    static RawImage create(RawImageType type = TYPE_USHORT16);
    static RawImage create(iPoint2D dim, RawImageType type = TYPE_USHORT16, uint32 componentsPerPixel = 1);
-   RawImageData* operator-> ();
-   RawImageData& operator* ();
+   RawImageData* operator-> () const;
+   RawImageData& operator* () const;
    RawImage(RawImageData* p);  // p must not be NULL
   ~RawImage();
    RawImage(const RawImage& p);
    RawImage& operator= (const RawImage& p);
+#ifdef HAS_RVALUE_REFERENCES
+   // Takes over the reference without touching the refcount.
+   // The moved-from object may only be destroyed or assigned to.
+   RawImage(RawImage&& p) : p_(p.p_) { p.p_ = NULL; }
+   RawImage& operator= (RawImage&& p) { swap(p); return *this; }
+#endif
+   // Exchange images with another RawImage - no refcount changes.
+   void swap(RawImage& p) { RawImageData* t = p_; p_ = p.p_; p.p_ = t; }
 
  private:
-   RawImageData* p_;    // p_ is never NULL
+   RawImageData* p_;    // p_ is only NULL in a moved-from object
  };
 
 inline RawImage RawImage::create(RawImageType type)  { 
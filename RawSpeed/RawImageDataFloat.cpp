@@ -103,6 +103,7 @@ namespace RawSpeed {
   }
 
   void RawImageDataFloat::scaleBlackWhite() {
+    StageTimer timer(stats, STAGE_SCALE_BLACK_WHITE);
     const int skipBorder = 150;
     int gw = (dim.x - skipBorder) * cpp;
     if ((blackAreas.empty() && blackLevelSeparate[0] < 0 && blackLevel < 0) || whitePoint == 65536) {  // Estimate
@@ -1,6 +1,8 @@
 #include "StdAfx.h"
 #include "RawImage.h"
 #include "RawDecoder.h"  // For exceptions
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
 /*
     RawSpeed - RAW file decoder.
 
@@ -25,6 +27,12 @@
 #if defined(__SSE2__)
 #include <emmintrin.h>
 #endif
+#ifdef RAWSPEED_AVX2
+#include <immintrin.h>
+#endif
+#ifdef RAWSPEED_NEON
+#include <arm_neon.h>
+#endif
 
 namespace RawSpeed {
 
@@ -41,54 +49,79 @@ RawImageData(_dim, 2, _cpp)
 }
 
 
+/* Histogram of a part of the black areas, computed on the thread pool */
+class BlackAreaJob
+{
+public:
+  RawImageDataU16* img;
+  uint32 start_row;   // Rows, counted through all black areas
+  uint32 end_row;
+  int* histogram;
+};
+
+void *BlackAreaJobThread(void *_this) {
+  BlackAreaJob* me = (BlackAreaJob*)_this;
+  JobTimer timer(me->img->stats);
+  me->img->histogramBlackAreas(me->histogram, me->start_row, me->end_row);
+  return NULL;
+}
+
 void RawImageDataU16::calculateBlackAreas() {
-  int* histogram = (int*)malloc(4*65536*sizeof(int));
-  memset(histogram, 0, 4*65536*sizeof(int));
   int totalpixels = 0;
+  uint32 rows = 0;
 
   for (uint32 i = 0; i < blackAreas.size(); i++) {
     BlackArea area = blackAreas[i];
-
-    /* Make sure area sizes are multiple of two, 
-       so we have the same amount of pixels for each CFA group */
     area.size = area.size - (area.size&1);
 
-    /* Process horizontal area */
     if (!area.isVertical) {
       if ((int)area.offset+(int)area.size > uncropped_dim.y)
         ThrowRDE("RawImageData::calculateBlackAreas: Offset + size is larger than height of image");
-      for (uint32 y = area.offset; y < area.offset+area.size; y++) {
-        ushort16 *pixel = (ushort16*)getDataUncropped(mOffset.x, y);
-        int* localhist = &histogram[(y&1)*(65536*2)];
-        for (int x = mOffset.x; x < dim.x+mOffset.x; x++) {
-          localhist[((x&1)<<16) + *pixel]++;
-        }
-      }
       totalpixels += area.size * dim.x;
-    }
-
-    /* Process vertical area */
-    if (area.isVertical) {
+      rows += area.size;
+    } else {
       if ((int)area.offset+(int)area.size > uncropped_dim.x)
         ThrowRDE("RawImageData::calculateBlackAreas: Offset + size is larger than width of image");
-      for (int y = mOffset.y; y < dim.y+mOffset.y; y++) {
-        ushort16 *pixel = (ushort16*)getDataUncropped(area.offset, y);
-        int* localhist = &histogram[(y&1)*(65536*2)];
-        for (uint32 x = area.offset; x < area.size+area.offset; x++) {
-          localhist[((x&1)<<16) + *pixel]++;
-        }
-      }
       totalpixels += area.size * dim.y;
+      rows += dim.y;
     }
   }
 
   if (!totalpixels) {
     for (int i = 0 ; i < 4; i++)
       blackLevelSeparate[i] = blackLevel;
-    free(histogram);
     return;
   }
 
+  // Each job has its own histogram, so at most one per thread.
+  ThreadPool* pool = ThreadPool::getPool();
+  uint32 parts = min(pool->getPartCount(rows, 16), pool->getSize());
+  uint32 rows_per_part = (rows + parts - 1) / parts;
+  parts = (rows + rows_per_part - 1) / rows_per_part;
+
+  BlackAreaJob *jobs = new BlackAreaJob[parts];
+  void **args = new void*[parts];
+  for (uint32 i = 0; i < parts; i++) {
+    jobs[i].img = this;
+    jobs[i].start_row = i * rows_per_part;
+    jobs[i].end_row = min((i + 1) * rows_per_part, rows);
+    jobs[i].histogram = (int*)calloc(4*65536, sizeof(int));
+    args[i] = &jobs[i];
+  }
+  if (parts > 1)
+    pool->run(BlackAreaJobThread, args, parts);
+  else
+    histogramBlackAreas(jobs[0].histogram, 0, rows);
+
+  int* histogram = jobs[0].histogram;
+  for (uint32 i = 1; i < parts; i++) {
+    for (int j = 0; j < 4*65536; j++)
+      histogram[j] += jobs[i].histogram[j];
+    free(jobs[i].histogram);
+  }
+  delete[] args;
+  delete[] jobs;
+
   /* Calculate median value of black areas for each component */
   /* Adjust the number of total pixels so it is the same as the median of each histogram */
   totalpixels /= 4*2;
@@ -115,7 +148,50 @@ void RawImageDataU16::calculateBlackAreas() {
   free(histogram);
 }
 
+/* Adds rows start_row to end_row of the black areas to the histogram. */
+/* Horizontal areas have area.size rows, vertical areas have a row for each line of the image. */
+void RawImageDataU16::histogramBlackAreas(int* histogram, uint32 start_row, uint32 end_row) {
+  uint32 row = 0;
+  for (uint32 i = 0; i < blackAreas.size() && row < end_row; i++) {
+    BlackArea area = blackAreas[i];
+
+    /* Make sure area sizes are multiple of two, 
+       so we have the same amount of pixels for each CFA group */
+    area.size = area.size - (area.size&1);
+
+    uint32 area_rows = area.isVertical ? dim.y : area.size;
+    uint32 first = max(start_row, row) - row;
+    uint32 end = min(end_row, row + area_rows) - row;
+    row += area_rows;
+    if (first >= end)
+      continue;
+
+    /* Process horizontal area */
+    if (!area.isVertical) {
+      for (uint32 y = area.offset + first; y < area.offset + end; y++) {
+        ushort16 *pixel = (ushort16*)getDataUncropped(mOffset.x, y);
+        int* localhist = &histogram[(y&1)*(65536*2)];
+        for (int x = mOffset.x; x < dim.x+mOffset.x; x++) {
+          localhist[((x&1)<<16) + *pixel]++;
+        }
+      }
+    }
+
+    /* Process vertical area */
+    if (area.isVertical) {
+      for (int y = mOffset.y + first; y < mOffset.y + (int)end; y++) {
+        ushort16 *pixel = (ushort16*)getDataUncropped(area.offset, y);
+        int* localhist = &histogram[(y&1)*(65536*2)];
+        for (uint32 x = area.offset; x < area.size+area.offset; x++) {
+          localhist[((x&1)<<16) + *pixel]++;
+        }
+      }
+    }
+  }
+}
+
 void RawImageDataU16::scaleBlackWhite() {
+  StageTimer timer(stats, STAGE_SCALE_BLACK_WHITE);
   const int skipBorder = 250;
   int gw = (dim.x - skipBorder) * cpp;
   if ((blackAreas.empty() && blackLevelSeparate[0] < 0 && blackLevel < 0) || whitePoint >= 65536) {  // Estimate
@@ -149,159 +225,37 @@ void RawImageDataU16::scaleBlackWhite() {
   startWorker(RawImageWorker::SCALE_VALUES, true);
 }
 
-#if _MSC_VER > 1399 || defined(__SSE2__)
-
 void RawImageDataU16::scaleValues(int start_y, int end_y) {
-  bool use_sse2;
-#ifdef _MSC_VER 
-  int info[4];
-  __cpuid(info, 1);
-  use_sse2 = !!(info[3]&(1 << 26));
-#else
-  use_sse2 = TRUE;
-#endif
-
   int depth_values = whitePoint - blackLevelSeparate[0];
   float app_scale = 65535.0f / depth_values;
 
-  // Scale in 30.2 fp
-  int full_scale_fp = (int)(app_scale * 4.0f);
-  // Half Scale in 18.14 fp
-  int half_scale_fp = (int)(app_scale * 4095.0f);
-
-  // Check SSE2
-  if (use_sse2 && app_scale < 63) {
-
-    __m128i sseround;
-    __m128i ssesub2;
-    __m128i ssesign;
-    __m128i rand_mul;
-    __m128i rand_mask;
-    __m128i sse_full_scale_fp;
-    __m128i sse_half_scale_fp;
-
-    uint32* sub_mul = (uint32*)_aligned_malloc(16*4*2, 16);
-    if (!sub_mul)
-	  ThrowRDE("Out of memory, failed to allocate 128 bytes");
-    uint32 gw = pitch / 16;
-    // 10 bit fraction
-    uint32 mul = (int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[mOffset.x&1]));  
-    mul |= ((int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[(mOffset.x+1)&1])))<<16;
-    uint32 b = blackLevelSeparate[mOffset.x&1] | (blackLevelSeparate[(mOffset.x+1)&1]<<16);
-
-    for (int i = 0; i< 4; i++) {
-      sub_mul[i] = b;     // Subtract even lines
-      sub_mul[4+i] = mul;   // Multiply even lines
-    }
-
-    mul = (int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[2+(mOffset.x&1)]));
-    mul |= ((int)(1024.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[2+((mOffset.x+1)&1)])))<<16;
-    b = blackLevelSeparate[2+(mOffset.x&1)] | (blackLevelSeparate[2+((mOffset.x+1)&1)]<<16);
-
-    for (int i = 0; i< 4; i++) {
-      sub_mul[8+i] = b;   // Subtract odd lines
-      sub_mul[12+i] = mul;  // Multiply odd lines
+  // The vector code multiplies by 16 bit scales with 10 bit fraction
+  if (app_scale < 63) {
+#ifdef RAWSPEED_AVX2
+    if (CpuFeatures::has(CPU_AVX2)) {
+      scaleValuesAVX2(start_y, end_y);
+      return;
     }
-
-    sseround = _mm_set_epi32(512, 512, 512, 512);
-    ssesub2 = _mm_set_epi32(32768, 32768, 32768, 32768);
-    ssesign = _mm_set_epi32(0x80008000, 0x80008000, 0x80008000, 0x80008000);
-    sse_full_scale_fp = _mm_set1_epi32(full_scale_fp|(full_scale_fp<<16));
-    sse_half_scale_fp = _mm_set1_epi32(half_scale_fp >> 4);
-
-    rand_mul = _mm_set1_epi32(0x4d9f1d32);
-    rand_mask = _mm_set1_epi32(0x00ff00ff);  // 8 random bits
-
-    for (int y = start_y; y < end_y; y++) {
-      __m128i sserandom = _mm_set_epi32(dim.x*1676+y*18000, dim.x*2342+y*34311, dim.x*4272+y*12123, dim.x*1234+y*23464);
-      __m128i* pixel = (__m128i*) & data[(mOffset.y+y)*pitch];
-      __m128i ssescale, ssesub;
-      if (((y+mOffset.y)&1) == 0) { 
-        ssesub = _mm_load_si128((__m128i*)&sub_mul[0]);
-        ssescale = _mm_load_si128((__m128i*)&sub_mul[4]);
-      } else {
-        ssesub = _mm_load_si128((__m128i*)&sub_mul[8]);
-        ssescale = _mm_load_si128((__m128i*)&sub_mul[12]);
-      }
-
-      for (uint32 x = 0 ; x < gw; x++) {
-        __m128i pix_high;
-        __m128i temp;
-        _mm_prefetch((char*)(pixel+1), _MM_HINT_T0);
-        __m128i pix_low = _mm_load_si128(pixel);
-        // Subtract black
-        pix_low = _mm_subs_epu16(pix_low, ssesub);
-        // Multiply the two unsigned shorts and combine it to 32 bit result
-        pix_high = _mm_mulhi_epu16(pix_low, ssescale);
-        temp = _mm_mullo_epi16(pix_low, ssescale);
-        pix_low = _mm_unpacklo_epi16(temp, pix_high);
-        pix_high = _mm_unpackhi_epi16(temp, pix_high);
-        // Add rounder
-        pix_low = _mm_add_epi32(pix_low, sseround);
-        pix_high = _mm_add_epi32(pix_high, sseround);
-
-        sserandom = _mm_xor_si128(_mm_mulhi_epi16(sserandom, rand_mul), _mm_mullo_epi16(sserandom, rand_mul));
-        __m128i rand_masked = _mm_and_si128(sserandom, rand_mask);  // Get 8 random bits
-        rand_masked = _mm_mullo_epi16(rand_masked, sse_full_scale_fp);
-        
-        __m128i zero = _mm_setzero_si128();
-        __m128i rand_lo = _mm_sub_epi32(sse_half_scale_fp, _mm_unpacklo_epi16(rand_masked,zero));
-        __m128i rand_hi = _mm_sub_epi32(sse_half_scale_fp, _mm_unpackhi_epi16(rand_masked,zero));
-
-        pix_low = _mm_add_epi32(pix_low, rand_lo);
-        pix_high = _mm_add_epi32(pix_high, rand_hi);
-
-        // Shift down
-        pix_low = _mm_srai_epi32(pix_low, 10);
-        pix_high = _mm_srai_epi32(pix_high, 10);
-        // Subtract to avoid clipping
-        pix_low = _mm_sub_epi32(pix_low, ssesub2);
-        pix_high = _mm_sub_epi32(pix_high, ssesub2);
-        // Pack
-        pix_low = _mm_packs_epi32(pix_low, pix_high);
-        // Shift sign off
-        pix_low = _mm_xor_si128(pix_low, ssesign);
-        _mm_store_si128(pixel, pix_low);
-        pixel++;
-      }
-    }
-    _aligned_free(sub_mul);
-  } else {
-    // Not SSE2
-    int gw = dim.x * cpp;
-    int mul[4];
-    int sub[4];
-    for (int i = 0; i < 4; i++) {
-      int v = i;
-      if ((mOffset.x&1) != 0)
-        v ^= 1;
-      if ((mOffset.y&1) != 0)
-        v ^= 2;
-      mul[i] = (int)(16384.0f * 65535.0f / (float)(whitePoint - blackLevelSeparate[v]));
-      sub[i] = blackLevelSeparate[v];
+#endif
+#ifdef RAWSPEED_SSE2
+    if (CpuFeatures::has(CPU_SSE2)) {
+      scaleValuesSSE2(start_y, end_y);
+      return;
     }
-    for (int y = start_y; y < end_y; y++) {
-      int v = dim.x + y * 36969;
-      ushort16 *pixel = (ushort16*)getData(0, y);
-      int *mul_local = &mul[2*(y&1)];
-      int *sub_local = &sub[2*(y&1)];
-      for (int x = 0 ; x < gw; x++) {
-        v = 18000 *(v & 65535) + (v >> 16);
-        int rand = half_scale_fp - (full_scale_fp * (v&2047));
-        pixel[x] = clampbits(((pixel[x] - sub_local[x&1]) * mul_local[x&1] + 8192 + rand) >> 14, 16);
-      }
+#endif
+#ifdef RAWSPEED_NEON
+    if (CpuFeatures::has(CPU_NEON)) {
+      scaleValuesNEON(start_y, end_y);
+      return;
     }
+#endif
+    scaleValuesRef(start_y, end_y);
+    return;
   }
-}
 
-#else
-
-void RawImageDataU16::scaleValues(int start_y, int end_y) {
   int gw = dim.x * cpp;
   int mul[4];
   int sub[4];
-  int depth_values = whitePoint - blackLevelSeparate[0];
-  float app_scale = 65535.0f / depth_values;
 
   // Scale in 30.2 fp
   int full_scale_fp = (int)(app_scale * 4.0f);
@@ -330,7 +284,328 @@ void RawImageDataU16::scaleValues(int start_y, int end_y) {
   }
 }
 
-#endif
+/*
+ * The vector versions of scaleValues() below, and scaleValuesRef(), give the same result.
+ * They process whole rows of the uncropped image, 8 pixels at the time, as 16 bit
+ * lanes. Even and odd lanes have their own black level and scale.
+ * The dither is a 16 bit random number per lane, that is updated before every 8 pixels.
+ */
+
+/* Black levels and scales of even and odd lanes, packed as in the vector registers: */
+/* black and scale of even lines, then black and scale of odd lines */
+void RawImageDataU16::getScaleWords(uint32 *words) {
+  for (int i = 0; i < 2; i++) {
+    int *black = &blackLevelSeparate[2*i];
+    // 10 bit fraction
+    uint32 mul = (int)(1024.0f * 65535.0f / (float)(whitePoint - black[mOffset.x&1]));
+    mul |= ((int)(1024.0f * 65535.0f / (float)(whitePoint - black[(mOffset.x+1)&1])))<<16;
+    words[2*i] = black[mOffset.x&1] | (black[(mOffset.x+1)&1]<<16);
+    words[2*i+1] = mul;
+  }
+}
+
+/* Initial random numbers of a row, as 4 pairs of lanes */
+static void getRandomSeed(uint32 *seed, int w, int y) {
+  seed[0] = (uint32)w*1234+(uint32)y*23464;
+  seed[1] = (uint32)w*4272+(uint32)y*12123;
+  seed[2] = (uint32)w*2342+(uint32)y*34311;
+  seed[3] = (uint32)w*1676+(uint32)y*18000;
+}
+
+void RawImageDataU16::scaleValuesRef(int start_y, int end_y) {
+  int depth_values = whitePoint - blackLevelSeparate[0];
+  float app_scale = 65535.0f / depth_values;
+  // Scale in 30.2 fp
+  int full_scale_fp = (int)(app_scale * 4.0f);
+  // Half Scale in 18.14 fp
+  int half_scale_fp = (int)(app_scale * 4095.0f);
+
+  uint32 words[4];
+  getScaleWords(words);
+  uint32 full_scale_word = full_scale_fp|(full_scale_fp<<16);
+  uint32 gw = pitch / 16;
+
+  for (int y = start_y; y < end_y; y++) {
+    uint32 seed[4];
+    getRandomSeed(seed, dim.x, y);
+    ushort16 random[8];
+    for (int i = 0; i < 8; i++)
+      random[i] = (ushort16)(seed[i>>1] >> (16*(i&1)));
+    ushort16 *pixel = (ushort16*)&data[(mOffset.y+y)*pitch];
+    uint32 sub = words[((y+mOffset.y)&1) * 2];
+    uint32 mul = words[((y+mOffset.y)&1) * 2 + 1];
+
+    for (uint32 x = 0 ; x < gw; x++) {
+      for (int i = 0; i < 8; i++) {
+        int shift = 16 * (i&1);
+        int r = (short)random[i] * ((i&1) ? 0x4d9f : 0x1d32);
+        random[i] = (ushort16)((r >> 16) ^ r);
+        ushort16 s = (ushort16)(sub >> shift);
+        uint32 p = pixel[i] > s ? pixel[i] - s : 0;
+        ushort16 rand = (ushort16)((random[i] & 0xff) * (ushort16)(full_scale_word >> shift));
+        // 32 bit wraparound and arithmetic shift, as the vector code
+        int v = (int)(p * (ushort16)(mul >> shift) + 512 + (uint32)((half_scale_fp >> 4) - rand));
+        pixel[i] = clampbits(v >> 10, 16);
+      }
+      pixel += 8;
+    }
+  }
+}
+
+#ifdef RAWSPEED_SSE2
+
+void RawImageDataU16::scaleValuesSSE2(int start_y, int end_y) {
+  int depth_values = whitePoint - blackLevelSeparate[0];
+  float app_scale = 65535.0f / depth_values;
+
+  // Scale in 30.2 fp
+  int full_scale_fp = (int)(app_scale * 4.0f);
+  // Half Scale in 18.14 fp
+  int half_scale_fp = (int)(app_scale * 4095.0f);
+
+  __m128i sseround;
+  __m128i ssesub2;
+  __m128i ssesign;
+  __m128i rand_mul;
+  __m128i rand_mask;
+  __m128i sse_full_scale_fp;
+  __m128i sse_half_scale_fp;
+
+  uint32* sub_mul = (uint32*)_aligned_malloc(16*4*2, 16);
+  if (!sub_mul)
+    ThrowRDE("Out of memory, failed to allocate 128 bytes");
+  uint32 gw = pitch / 16;
+  uint32 words[4];
+  getScaleWords(words);
+
+  for (int i = 0; i< 4; i++) {
+    sub_mul[i] = words[0];     // Subtract even lines
+    sub_mul[4+i] = words[1];   // Multiply even lines
+    sub_mul[8+i] = words[2];   // Subtract odd lines
+    sub_mul[12+i] = words[3];  // Multiply odd lines
+  }
+
+  sseround = _mm_set_epi32(512, 512, 512, 512);
+  ssesub2 = _mm_set_epi32(32768, 32768, 32768, 32768);
+  ssesign = _mm_set_epi32(0x80008000, 0x80008000, 0x80008000, 0x80008000);
+  sse_full_scale_fp = _mm_set1_epi32(full_scale_fp|(full_scale_fp<<16));
+  sse_half_scale_fp = _mm_set1_epi32(half_scale_fp >> 4);
+
+  rand_mul = _mm_set1_epi32(0x4d9f1d32);
+  rand_mask = _mm_set1_epi32(0x00ff00ff);  // 8 random bits
+
+  for (int y = start_y; y < end_y; y++) {
+    uint32 seed[4];
+    getRandomSeed(seed, dim.x, y);
+    __m128i sserandom = _mm_set_epi32(seed[3], seed[2], seed[1], seed[0]);
+    __m128i* pixel = (__m128i*) & data[(mOffset.y+y)*pitch];
+    __m128i ssescale, ssesub;
+    if (((y+mOffset.y)&1) == 0) {
+      ssesub = _mm_load_si128((__m128i*)&sub_mul[0]);
+      ssescale = _mm_load_si128((__m128i*)&sub_mul[4]);
+    } else {
+      ssesub = _mm_load_si128((__m128i*)&sub_mul[8]);
+      ssescale = _mm_load_si128((__m128i*)&sub_mul[12]);
+    }
+
+    for (uint32 x = 0 ; x < gw; x++) {
+      __m128i pix_high;
+      __m128i temp;
+      _mm_prefetch((char*)(pixel+1), _MM_HINT_T0);
+      __m128i pix_low = _mm_load_si128(pixel);
+      // Subtract black
+      pix_low = _mm_subs_epu16(pix_low, ssesub);
+      // Multiply the two unsigned shorts and combine it to 32 bit result
+      pix_high = _mm_mulhi_epu16(pix_low, ssescale);
+      temp = _mm_mullo_epi16(pix_low, ssescale);
+      pix_low = _mm_unpacklo_epi16(temp, pix_high);
+      pix_high = _mm_unpackhi_epi16(temp, pix_high);
+      // Add rounder
+      pix_low = _mm_add_epi32(pix_low, sseround);
+      pix_high = _mm_add_epi32(pix_high, sseround);
+
+      sserandom = _mm_xor_si128(_mm_mulhi_epi16(sserandom, rand_mul), _mm_mullo_epi16(sserandom, rand_mul));
+      __m128i rand_masked = _mm_and_si128(sserandom, rand_mask);  // Get 8 random bits
+      rand_masked = _mm_mullo_epi16(rand_masked, sse_full_scale_fp);
+
+      __m128i zero = _mm_setzero_si128();
+      __m128i rand_lo = _mm_sub_epi32(sse_half_scale_fp, _mm_unpacklo_epi16(rand_masked,zero));
+      __m128i rand_hi = _mm_sub_epi32(sse_half_scale_fp, _mm_unpackhi_epi16(rand_masked,zero));
+
+      pix_low = _mm_add_epi32(pix_low, rand_lo);
+      pix_high = _mm_add_epi32(pix_high, rand_hi);
+
+      // Shift down
+      pix_low = _mm_srai_epi32(pix_low, 10);
+      pix_high = _mm_srai_epi32(pix_high, 10);
+      // Subtract to avoid clipping
+      pix_low = _mm_sub_epi32(pix_low, ssesub2);
+      pix_high = _mm_sub_epi32(pix_high, ssesub2);
+      // Pack
+      pix_low = _mm_packs_epi32(pix_low, pix_high);
+      // Shift sign off
+      pix_low = _mm_xor_si128(pix_low, ssesign);
+      _mm_store_si128(pixel, pix_low);
+      pixel++;
+    }
+  }
+  _aligned_free(sub_mul);
+}
+
+#endif // RAWSPEED_SSE2
+
+#ifdef RAWSPEED_AVX2
+
+/* Updates the random numbers, as before every 8 pixels in the SSE2 version */
+RAWSPEED_TARGET_AVX2 static inline __m256i nextRandomAVX2(__m256i random, __m256i rand_mul) {
+  return _mm256_xor_si256(_mm256_mulhi_epi16(random, rand_mul), _mm256_mullo_epi16(random, rand_mul));
+}
+
+/* 16 pixels at the time. The 128 bit halves of AVX2 registers work like two SSE2 */
+/* registers, so this is the SSE2 version, with the first 8 pixels in the low half. */
+RAWSPEED_TARGET_AVX2 void RawImageDataU16::scaleValuesAVX2(int start_y, int end_y) {
+  int depth_values = whitePoint - blackLevelSeparate[0];
+  float app_scale = 65535.0f / depth_values;
+
+  // Scale in 30.2 fp
+  int full_scale_fp = (int)(app_scale * 4.0f);
+  // Half Scale in 18.14 fp
+  int half_scale_fp = (int)(app_scale * 4095.0f);
+
+  uint32 words[4];
+  getScaleWords(words);
+
+  __m256i round = _mm256_set1_epi32(512);
+  __m256i sub2 = _mm256_set1_epi32(32768);
+  __m256i sign = _mm256_set1_epi32(0x80008000);
+  __m256i full_scale = _mm256_set1_epi32(full_scale_fp|(full_scale_fp<<16));
+  __m256i half_scale = _mm256_set1_epi32(half_scale_fp >> 4);
+  __m256i rand_mul = _mm256_set1_epi32(0x4d9f1d32);
+  __m256i rand_mask = _mm256_set1_epi32(0x00ff00ff);  // 8 random bits
+  __m256i zero = _mm256_setzero_si256();
+
+  uint32 gw = pitch / 32;
+  bool odd = !!((pitch / 16) & 1);   // 8 pixels left at the end of the row
+
+  for (int y = start_y; y < end_y; y++) {
+    uint32 seed[4];
+    getRandomSeed(seed, dim.x, y);
+    __m256i random = _mm256_castsi128_si256(_mm_set_epi32(seed[3], seed[2], seed[1], seed[0]));
+    // The high half is 8 pixels ahead, so it is updated once more.
+    random = nextRandomAVX2(random, rand_mul);
+    random = _mm256_inserti128_si256(random, _mm256_castsi256_si128(nextRandomAVX2(random, rand_mul)), 1);
+
+    uchar8* row = &data[(mOffset.y+y)*pitch];
+    __m256i sub = _mm256_set1_epi32(words[((y+mOffset.y)&1) * 2]);
+    __m256i scale = _mm256_set1_epi32(words[((y+mOffset.y)&1) * 2 + 1]);
+
+    for (uint32 x = 0 ; x <= gw; x++) {
+      __m256i* pixel = (__m256i*)&row[x*32];
+      __m256i pix;
+      if (x < gw) {
+        pix = _mm256_loadu_si256(pixel);
+      } else if (odd) {
+        pix = _mm256_castsi128_si256(_mm_loadu_si128((__m128i*)pixel));  // Only the low half is stored
+      } else {
+        break;
+      }
+      // Subtract black
+      pix = _mm256_subs_epu16(pix, sub);
+      // Multiply the two unsigned shorts and combine it to 32 bit result
+      __m256i pix_high = _mm256_mulhi_epu16(pix, scale);
+      __m256i temp = _mm256_mullo_epi16(pix, scale);
+      __m256i pix_low = _mm256_unpacklo_epi16(temp, pix_high);
+      pix_high = _mm256_unpackhi_epi16(temp, pix_high);
+      // Add rounder
+      pix_low = _mm256_add_epi32(pix_low, round);
+      pix_high = _mm256_add_epi32(pix_high, round);
+
+      __m256i rand_masked = _mm256_and_si256(random, rand_mask);
+      rand_masked = _mm256_mullo_epi16(rand_masked, full_scale);
+      pix_low = _mm256_add_epi32(pix_low, _mm256_sub_epi32(half_scale, _mm256_unpacklo_epi16(rand_masked, zero)));
+      pix_high = _mm256_add_epi32(pix_high, _mm256_sub_epi32(half_scale, _mm256_unpackhi_epi16(rand_masked, zero)));
+      random = nextRandomAVX2(nextRandomAVX2(random, rand_mul), rand_mul);
+
+      // Shift down
+      pix_low = _mm256_srai_epi32(pix_low, 10);
+      pix_high = _mm256_srai_epi32(pix_high, 10);
+      // Subtract to avoid clipping
+      pix_low = _mm256_sub_epi32(pix_low, sub2);
+      pix_high = _mm256_sub_epi32(pix_high, sub2);
+      // Pack, and shift sign off
+      pix = _mm256_xor_si256(_mm256_packs_epi32(pix_low, pix_high), sign);
+      if (x < gw)
+        _mm256_storeu_si256(pixel, pix);
+      else
+        _mm_storeu_si128((__m128i*)pixel, _mm256_castsi256_si128(pix));
+    }
+  }
+}
+
+#endif // RAWSPEED_AVX2
+
+#ifdef RAWSPEED_NEON
+
+/* 8 pixels at the time, as the SSE2 version */
+void RawImageDataU16::scaleValuesNEON(int start_y, int end_y) {
+  int depth_values = whitePoint - blackLevelSeparate[0];
+  float app_scale = 65535.0f / depth_values;
+
+  // Scale in 30.2 fp
+  int full_scale_fp = (int)(app_scale * 4.0f);
+  // Half Scale in 18.14 fp
+  int half_scale_fp = (int)(app_scale * 4095.0f);
+
+  uint32 words[4];
+  getScaleWords(words);
+
+  int32x4_t round = vdupq_n_s32(512);
+  int32x4_t sub2 = vdupq_n_s32(32768);
+  uint16x8_t sign = vdupq_n_u16(0x8000);
+  uint16x8_t full_scale = vreinterpretq_u16_u32(vdupq_n_u32(full_scale_fp|(full_scale_fp<<16)));
+  int32x4_t half_scale = vdupq_n_s32(half_scale_fp >> 4);
+  int16x8_t rand_mul = vreinterpretq_s16_u32(vdupq_n_u32(0x4d9f1d32));
+  int16x4_t rand_mul_lo = vget_low_s16(rand_mul);
+  int16x4_t rand_mul_hi = vget_high_s16(rand_mul);
+  uint16x8_t rand_mask = vdupq_n_u16(0xff);  // 8 random bits
+
+  uint32 gw = pitch / 16;
+
+  for (int y = start_y; y < end_y; y++) {
+    uint32 seed[4];
+    getRandomSeed(seed, dim.x, y);
+    int16x8_t random = vreinterpretq_s16_u32(vld1q_u32(seed));
+    ushort16* pixel = (ushort16*)&data[(mOffset.y+y)*pitch];
+    uint16x8_t sub = vreinterpretq_u16_u32(vdupq_n_u32(words[((y+mOffset.y)&1) * 2]));
+    uint16x8_t scale = vreinterpretq_u16_u32(vdupq_n_u32(words[((y+mOffset.y)&1) * 2 + 1]));
+
+    for (uint32 x = 0 ; x < gw; x++) {
+      // Subtract black
+      uint16x8_t pix = vqsubq_u16(vld1q_u16(pixel), sub);
+      // Multiply to 32 bit, and add rounder
+      int32x4_t pix_low = vaddq_s32(vreinterpretq_s32_u32(vmull_u16(vget_low_u16(pix), vget_low_u16(scale))), round);
+      int32x4_t pix_high = vaddq_s32(vreinterpretq_s32_u32(vmull_u16(vget_high_u16(pix), vget_high_u16(scale))), round);
+
+      // High and low 16 bits of the signed products
+      int16x8_t rand_high = vcombine_s16(vshrn_n_s32(vmull_s16(vget_low_s16(random), rand_mul_lo), 16),
+                                         vshrn_n_s32(vmull_s16(vget_high_s16(random), rand_mul_hi), 16));
+      random = veorq_s16(rand_high, vmulq_s16(random, rand_mul));
+      uint16x8_t rand_masked = vmulq_u16(vandq_u16(vreinterpretq_u16_s16(random), rand_mask), full_scale);
+      pix_low = vaddq_s32(pix_low, vsubq_s32(half_scale, vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(rand_masked)))));
+      pix_high = vaddq_s32(pix_high, vsubq_s32(half_scale, vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(rand_masked)))));
+
+      // Shift down, and subtract to avoid clipping
+      pix_low = vsubq_s32(vshrq_n_s32(pix_low, 10), sub2);
+      pix_high = vsubq_s32(vshrq_n_s32(pix_high, 10), sub2);
+      // Pack, and shift sign off
+      int16x8_t packed = vcombine_s16(vqmovn_s32(pix_low), vqmovn_s32(pix_high));
+      vst1q_u16(pixel, veorq_u16(vreinterpretq_u16_s16(packed), sign));
+      pixel += 8;
+    }
+  }
+}
+
+#endif // RAWSPEED_NEON
 
 /* This performs a 4 way interpolated pixel */
 /* The value is interpolated from the 4 closest valid pixels in */
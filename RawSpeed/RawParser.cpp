@@ -37,9 +37,15 @@ RawParser::~RawParser(void) {
 
 RawDecoder* RawParser::getDecoder() {
   try {
+    // Parsing is always timed - the decoder doesn't exist yet, to tell if stats are wanted.
+    double startWall, startCpu, wall, cpu;
+    RawDecoderStats::getTime(&startWall, &startCpu);
     TiffParser p(mInput);
     p.parseData();
-    return p.getDecoder();
+    RawDecoder* decoder = p.getDecoder();
+    RawDecoderStats::getTime(&wall, &cpu);
+    decoder->setParseTime(wall - startWall, cpu - startCpu);
+    return decoder;
   } catch (TiffParserException) {}
   throw RawDecoderException("No decoder found. Sorry.");
   return NULL;
@@ -0,0 +1,151 @@
+#ifndef REF_COUNTED_CACHE_H
+#define REF_COUNTED_CACHE_H
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/*************************************************************************
+ * Thread safe cache of shared, reference counted entries
+ *
+ * Entries are found by a key. Each acquire() or insert() must be matched
+ * by a release(). Entries that are no longer used are kept, up to
+ * "maxUnused", and the least recently used are deleted.
+ *
+ * "Entry" has a member "refs", and matches(const Key&), which is true if
+ * it is the entry for the key. Entries are deleted with deleteEntry(),
+ * which may be overridden to free what they refer to.
+ *
+ * Process-wide caches should be created with new, and never deleted, as
+ * pool threads may still use them while static objects are destroyed.
+ * flush() frees the entries that are not in use.
+ *
+ *****************************/
+template <class Entry, class Key>
+class RefCountedCache
+{
+public:
+  RefCountedCache(uint32 _maxUnused) : maxUnused(_maxUnused) {
+    pthread_mutex_init(&mutex, NULL);
+  }
+  /* Entries are not deleted, as deleteEntry() cannot be overridden here. */
+  /* Call flush() first, when no entries are in use. */
+  virtual ~RefCountedCache() {
+    pthread_mutex_destroy(&mutex);
+  }
+
+  /* Returns the entry for "key", and marks it as used. NULL if none is cached. */
+  Entry* acquire(const Key& key) {
+    pthread_mutex_lock(&mutex);
+    Entry* e = find(key);
+    pthread_mutex_unlock(&mutex);
+    return e;
+  }
+
+  /* Adds "e", made by the caller for "key", and marks it as used. If another */
+  /* thread has added an entry for "key" meanwhile, "e" is deleted, and the */
+  /* cached entry returned. */
+  Entry* insert(Entry* e, const Key& key) {
+    pthread_mutex_lock(&mutex);
+    Entry* found = find(key);
+    if (found) {
+      deleteEntry(e);
+      e = found;
+    } else {
+      e->refs = 1;
+      entries.push_front(e);
+      trim();
+    }
+    pthread_mutex_unlock(&mutex);
+    return e;
+  }
+
+  /* Release an entry returned by acquire() or insert() */
+  void release(Entry* e) {
+    pthread_mutex_lock(&mutex);
+    _ASSERTE(e->refs);
+    if (!--e->refs)
+      trim();
+    pthread_mutex_unlock(&mutex);
+  }
+
+  /* Deletes all entries not in use */
+  void flush() {
+    pthread_mutex_lock(&mutex);
+    typename list<Entry*>::iterator i = entries.begin();
+    while (i != entries.end()) {
+      Entry* e = *i;
+      if (!e->refs) {
+        i = entries.erase(i);
+        deleteEntry(e);
+      } else {
+        ++i;
+      }
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+
+protected:
+  /* Called with the mutex locked, when "e" is no longer in "entries" */
+  virtual void deleteEntry(Entry* e) {delete e;}
+
+  list<Entry*> entries;   // Most recently used first
+  pthread_mutex_t mutex;
+
+private:
+  // Must be called with the mutex locked
+  Entry* find(const Key& key) {
+    for (typename list<Entry*>::iterator i = entries.begin(); i != entries.end(); ++i) {
+      Entry* e = *i;
+      if (e->matches(key)) {
+        e->refs++;
+        entries.erase(i);
+        entries.push_front(e);
+        return e;
+      }
+    }
+    return NULL;
+  }
+
+  // Must be called with the mutex locked. Deletes the least recently used entries,
+  // that are not in use, so at most maxUnused are left.
+  void trim() {
+    uint32 unused = 0;
+    typename list<Entry*>::iterator i = entries.begin();
+    while (i != entries.end()) {
+      Entry* e = *i;
+      if (!e->refs && ++unused > maxUnused) {
+        i = entries.erase(i);
+        deleteEntry(e);
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  uint32 maxUnused;
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef ROW_CHECKPOINT_SCAN_H
+#define ROW_CHECKPOINT_SCAN_H
+
+#include "ThreadPool.h"
+#include "RawDecoderStats.h"
+#include "IOException.h"
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/*************************************************************************
+ * Decodes the rows of a single bit stream on the thread pool
+ *
+ * A row can only be decoded when the bit position, where the previous row
+ * ended, is known. The decoder supplies scanRows(), which moves a State to
+ * the start of a later row by only reading the code lengths, and the values
+ * needed as predictors, which is considerably faster than decoding.
+ * One job scans all rows, and records a checkpoint at the first row of each
+ * part. The parts are decoded with decodeRows() by the other jobs, as soon
+ * as the scan has passed their first row.
+ * The result, and the error thrown, are identical to decoding on a single
+ * thread.
+ *
+ * "State" is the position at the start of a row. It has a member "bits",
+ * pointing to its bit pump, and checkpoint(), which returns a copy of the
+ * state with its own copy of the pump. The copies are deleted by the scan.
+ *
+ *****************************/
+template <class Decoder, class State>
+class RowCheckpointScan
+{
+public:
+  /* Moves "s" to the start of row "endY" */
+  typedef void (Decoder::*RowFunc)(State *s, uint32 endY);
+
+  RowCheckpointScan(Decoder* _decoder, RowFunc _scanRows, RowFunc _decodeRows, RawDecoderStats* _stats) :
+      decoder(_decoder), scanRows(_scanRows), decodeRows(_decodeRows), stats(_stats), ready(0), done(false) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+  }
+  ~RowCheckpointScan() {
+    for (uint32 i = 0; i < ready; i++)
+      delete states[i].bits;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  /* Decodes from "s" to row "h", in about "parts" parts. The pump of "s" is used */
+  /* by the scan, so it is left at the end, as after decoding. Call only once. */
+  void run(State *s, uint32 h, uint32 parts) {
+    start = *s;
+    endY = h;
+    rowsPerPart = (h + parts - 1) / parts;
+    parts = (h + rowsPerPart - 1) / rowsPerPart;
+    states.resize(parts);
+    errors.resize(parts + 1);
+    ioErrors.resize(parts + 1, 0);
+
+    RowCheckpointJob *jobs = new RowCheckpointJob[parts + 1];
+    void **args = new void*[parts + 1];
+    for (uint32 i = 0; i <= parts; i++) {
+      jobs[i].scan = this;
+      jobs[i].n = i;
+      args[i] = &jobs[i];
+    }
+    ThreadPool::getPool()->run(RowCheckpointThread, args, parts + 1);
+    delete[] args;
+    delete[] jobs;
+
+    // Report the error of the first failing part, as it would have been on a single thread.
+    // The scan fails in the same place, so its error is only used if no part failed.
+    for (uint32 j = 1; j <= parts + 1; j++) {
+      uint32 i = j % (parts + 1);
+      if (!errors[i].empty()) {
+        if (ioErrors[i])
+          throw IOException(errors[i]);
+        throw RawDecoderException(errors[i]);
+      }
+    }
+  }
+
+private:
+  class RowCheckpointJob
+  {
+  public:
+    RowCheckpointScan* scan;
+    uint32 n;   // 0 is the scan, others decode part n-1
+  };
+
+  static void *RowCheckpointThread(void *_this) {
+    RowCheckpointJob* me = (RowCheckpointJob*)_this;
+    me->scan->runJob(me->n);
+    return NULL;
+  }
+
+  void runJob(uint32 n) {
+    JobTimer timer(stats);
+    try {
+      if (n == 0) {
+        State s = start;
+        for (uint32 i = 0; i < states.size(); i++) {
+          (decoder->*scanRows)(&s, i * rowsPerPart);
+          State part = s.checkpoint();
+          pthread_mutex_lock(&mutex);
+          states[i] = part;
+          ready++;
+          pthread_cond_broadcast(&cond);
+          pthread_mutex_unlock(&mutex);
+        }
+        (decoder->*scanRows)(&s, endY);
+      } else {
+        uint32 i = n - 1;
+        pthread_mutex_lock(&mutex);
+        while (ready <= i && !done)
+          pthread_cond_wait(&cond, &mutex);
+        bool isReady = ready > i;
+        pthread_mutex_unlock(&mutex);
+
+        // If not ready, the scan failed before reaching this part, and so would decoding.
+        if (isReady) {
+          State s = states[i];
+          (decoder->*decodeRows)(&s, min(endY, (i + 1) * rowsPerPart));
+        }
+      }
+    } catch (RawDecoderException &e) {
+      errors[n] = e.what();
+    } catch (IOException &e) {
+      errors[n] = e.what();
+      ioErrors[n] = 1;
+    }
+    if (n == 0) {
+      pthread_mutex_lock(&mutex);
+      done = true;
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&mutex);
+    }
+  }
+
+  Decoder* decoder;
+  RowFunc scanRows;
+  RowFunc decodeRows;
+  RawDecoderStats* stats;
+  State start;              // Where the scan starts
+  uint32 endY;
+  uint32 rowsPerPart;
+  vector<State> states;     // Start of each part, set by the scan
+  uint32 ready;             // Number of states set
+  bool done;                // The scan has ended, no more states will be set
+  vector<string> errors;    // Error of each job, empty if none
+  vector<uchar8> ioErrors;  // The error was an IOException. Not a vector<bool>, as jobs set it concurrently.
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;      // Signalled when a state is set, and when the scan ends
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -70,12 +70,12 @@ RawImage Rw2Decoder::decodeRawInternal() {
     if (count != (int)(width*height*2))
       ThrowRDE("Panasonic RAW Decoder: Byte count is wrong.");
 
-    if (!mFile->isValid(off+count))
+    if (!mFile->isValid(off, count))
       ThrowRDE("Panasonic RAW Decoder: Invalid image data offset, cannot decode.");
       
     mRaw->dim = iPoint2D(width, height);
     mRaw->createData();
-    ByteStream input_start(mFile->getData(off), mFile->getSize() - off);
+    ByteStream input_start(mFile->getData(off, mFile->getSize() - off), mFile->getSize() - off);
     iPoint2D pos(0, 0);
     readUncompressedRaw(input_start, mRaw->dim,pos, width*2, 16, BitOrder_Plain);
 
@@ -95,7 +95,7 @@ RawImage Rw2Decoder::decodeRawInternal() {
     if (!mFile->isValid(off))
       ThrowRDE("RW2 Decoder: Invalid image data offset, cannot decode.");
 
-    input_start = new ByteStream(mFile->getData(off), mFile->getSize() - off);
+    input_start = new ByteStream(mFile->getData(off, mFile->getSize() - off), mFile->getSize() - off);
     DecodeRw2();
   }
   // Read blacklevels
@@ -178,6 +178,8 @@ void Rw2Decoder::decodeThreaded(RawDecoderThread * t) {
       }
     }
   }
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, (uint64)(t->end_y - t->start_y) * w * 16);
   if (zero_is_bad && !zero_pos.empty()) {
     pthread_mutex_lock(&mRaw->mBadPixelMutex);
     mRaw->mBadPixelPositions.insert(mRaw->mBadPixelPositions.end(), zero_pos.begin(), zero_pos.end());
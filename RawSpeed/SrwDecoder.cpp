@@ -2,6 +2,7 @@
 #include "SrwDecoder.h"
 #include "TiffParserOlympus.h"
 #include "ByteStreamSwap.h"
+#include "CpuFeatures.h"
 
 #if defined(__unix__) || defined(__APPLE__) 
 #include <stdlib.h>
@@ -27,6 +28,15 @@
 
     http://www.klauspost.com
 */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef RAWSPEED_AVX2
+#include <immintrin.h>
+#endif
+#ifdef RAWSPEED_NEON
+#include <arm_neon.h>
+#endif
 
 namespace RawSpeed {
 
@@ -90,6 +100,36 @@ RawImage SrwDecoder::decodeRawInternal() {
   return mRaw;
 }
 // Decoder for compressed srw files (NX300 and later)
+/* Decoding is split in two passes. First the bits of each row are decoded to the
+ * differences from the predicted values. Rows start at known offsets, and the
+ * bit lengths are reset for each row, so rows are decoded in parallel.
+ * Then the predicted values are added, in order, as rows are predicted from the
+ * rows above. The values are 16 bit, so adding the prediction to the stored 16 bit
+ * difference gives the same result as adding it to the difference.
+ */
+
+/* Shared by the jobs of one decodeCompressed() call */
+class SrwDecodeJob
+{
+public:
+  SrwDecoder* parent;
+  uint32 startY, endY;
+  const uint32 *offsets;  // Start of each row
+  const uint64 *ends;     // End of the data of each row
+  uchar8 *dirs;           // Direction of each group in the image
+  uint32 groups;          // Groups in each row
+  uint32 failY;           // First row that failed, endY if none
+  uint32 failGroups;      // Groups decoded in row failY
+  string error;
+  bool ioError;
+};
+
+void *SrwDecodeThread(void *_this) {
+  SrwDecodeJob* me = (SrwDecodeJob*)_this;
+  me->parent->decodeCompressedJob(me);
+  return NULL;
+}
+
 void SrwDecoder::decodeCompressed( TiffIFD* raw )
 {
   uint32 width = raw->getEntry(IMAGEWIDTH)->getInt();
@@ -98,82 +138,335 @@ void SrwDecoder::decodeCompressed( TiffIFD* raw )
   mRaw->createData();
   const uint32 offset = raw->getEntry(STRIPOFFSETS)->getInt();
   uint32 compressed_offset = raw->getEntry((TiffTag)40976)->getInt();
-  ByteStream *b;
-  if (getHostEndianness() == little)
-    b = new ByteStream(mFile->getData(0), mFile->getSize());
-  else
-    b = new ByteStreamSwap(mFile->getData(0), mFile->getSize());
-  b->setAbsoluteOffset(compressed_offset);
-
-  for (uint32 y = 0; y < height; y++) {
-    uint32 line_offset = offset + b->getInt();
-    if (line_offset >= mFile->getSize())
-      ThrowRDE("Srw decoder: Offset outside image file, file probably truncated.");
-    int len[4];
-    for (int i = 0; i < 4; i++)
-      len[i] = y < 2 ? 7 : 4;
-    BitPumpMSB32 bits(mFile->getData(line_offset),mFile->getSize() - line_offset);
-    int op[4];
-    ushort16* img = (ushort16*)mRaw->getData(0, y);
-    ushort16* img_up = (ushort16*)mRaw->getData(0, max(0, (int)y - 1));
-    ushort16* img_up2 = (ushort16*)mRaw->getData(0, max(0, (int)y - 2));
-    // Image is arranged in groups of 16 pixels horizontally
-    for (uint32 x = 0; x < width; x += 16) {
-      bool dir = !!bits.getBit();
-      for (int i = 0; i < 4; i++)
-        op[i] = bits.getBits(2);
-      for (int i = 0; i < 4; i++) {
-        switch (op[i]) {
-          case 3: len[i] = bits.getBits(4);
-            break;
-          case 2: len[i]--;
-            break;
-          case 1: len[i]++;
-        }
-        if (len[i] < 0)
-          ThrowRDE("Srw Decompressor: Bit length less than 0.");
-        if (len[i] > 16)
-          ThrowRDE("Srw Decompressor: Bit Length more than 16.");
+  uint64 fileSize = mFile->getSize();
+
+  // Read the offsets of all rows. If it fails, the rows before are still decoded.
+  // Only the offset table is read, so a lazily loaded file only loads that and the rows.
+  vector<uint32> offsets;
+  offsets.reserve(height);
+  string offsetError;
+  bool offsetIOError = false;
+  ByteStream *b = NULL;
+  try {
+    uint64 tableSize = compressed_offset < fileSize ? min((uint64)height * 4, fileSize - compressed_offset) : 0;
+    if (getHostEndianness() == little)
+      b = new ByteStream(mFile->getData(compressed_offset, tableSize), tableSize);
+    else
+      b = new ByteStreamSwap(mFile->getData(compressed_offset, tableSize), tableSize);
+    for (uint32 y = 0; y < height; y++) {
+      uint32 line_offset = offset + b->getInt();
+      if (line_offset >= fileSize)
+        ThrowRDE("Srw decoder: Offset outside image file, file probably truncated.");
+      offsets.push_back(line_offset);
+    }
+  } catch (RawDecoderException &e) {
+    offsetError = e.what();
+  } catch (IOException &e) {
+    offsetError = e.what();
+    offsetIOError = true;
+  }
+  delete b;
+  uint32 rows = (uint32)offsets.size();
+
+  // Each row ends where the next starts, and the last at the end of the strip
+  uint64 stripEnd = fileSize;
+  if (raw->hasEntry(STRIPBYTECOUNTS))
+    stripEnd = min(fileSize, (uint64)offset + raw->getEntry(STRIPBYTECOUNTS)->getInt());
+  vector<uint64> ends(rows);
+  for (uint32 y = 0; y < rows; y++) {
+    ends[y] = stripEnd;
+    if (y + 1 < rows && offsets[y + 1] > offsets[y])
+      ends[y] = offsets[y + 1];
+    if (ends[y] <= offsets[y])
+      ends[y] = fileSize;
+  }
+  uint32 groups = (width + 15) / 16;
+  vector<uchar8> dirs((size_t)max(rows, 1u) * groups);
+
+  if (!offsetError.empty() && !rows) {
+    if (offsetIOError)
+      throw IOException(offsetError);
+    throw RawDecoderException(offsetError);
+  }
+
+  // Rows that are not a multiple of 16 pixels overwrite the start of the next row,
+  // so they can only be decoded in order.
+  uint32 parts = 1;
+  if (!(width & 15))
+    parts = ThreadPool::getPool()->getPartCount(rows, 16);
+
+  if (parts <= 1) {
+    uint64 bytes = 0;
+    for (uint32 y = 0; y < rows; y++) {
+      uint32 done = 0;
+      try {
+        bytes += decodeDifferences(y, offsets[y], ends[y], &dirs[y * groups], &done);
+      } catch (...) {
+        predictRow(y, &dirs[y * groups], done);
+        clearAfter(y, done);
+        if (mRaw->stats)
+          mRaw->stats->addCount(COUNTER_BYTES, bytes);
+        throw;
       }
-      if (dir) {
-        // Upward prediction
-        // First we decode even pixels
-        for (int c = 0; c < 16; c += 2) {
-          int b = len[(c >> 3)];
-          int32 adj = ((int32) bits.getBits(b) << (32-b) >> (32-b));
-          img[c] = adj + img_up[c];
-        }
-        // Now we decode odd pixels
-        // Why on earth upward prediction only looks up 1 line above
-        // is beyond me, it will hurt compression a deal.
-        for (int c = 1; c < 16; c += 2) {
-          int b = len[2 | (c >> 3)];
-          int32 adj = ((int32) bits.getBits(b) << (32-b) >> (32-b));
-          img[c] = adj + img_up2[c];
-        }
-      } else {
-        // Left to right prediction
-        // First we decode even pixels
-        int pred_left = x ? img[-2] : 128;
-        for (int c = 0; c < 16; c += 2) {
-          int b = len[(c >> 3)];
-          int32 adj = ((int32) bits.getBits(b) << (32-b) >> (32-b));
-          img[c] = adj + pred_left;
-        }
-        // Now we decode odd pixels
-        pred_left = x ? img[-1] : 128;
-        for (int c = 1; c < 16; c += 2) {
-          int b = len[2 | (c >> 3)];
-          int32 adj = ((int32) bits.getBits(b) << (32-b) >> (32-b));
-          img[c] = adj + pred_left;
-        }
+      predictRow(y, &dirs[y * groups], done);
+    }
+    if (mRaw->stats)
+      mRaw->stats->addCount(COUNTER_BYTES, bytes);
+  } else {
+    uint32 rowsPerPart = (rows + parts - 1) / parts;
+    parts = (rows + rowsPerPart - 1) / rowsPerPart;
+    SrwDecodeJob *jobs = new SrwDecodeJob[parts];
+    void **args = new void*[parts];
+    for (uint32 i = 0; i < parts; i++) {
+      jobs[i].parent = this;
+      jobs[i].startY = i * rowsPerPart;
+      jobs[i].endY = min(rows, (i + 1) * rowsPerPart);
+      jobs[i].offsets = &offsets[0];
+      jobs[i].ends = &ends[0];
+      jobs[i].dirs = &dirs[0];
+      jobs[i].groups = groups;
+      jobs[i].failY = jobs[i].endY;
+      jobs[i].failGroups = 0;
+      jobs[i].ioError = false;
+      args[i] = &jobs[i];
+    }
+    ThreadPool::getPool()->run(SrwDecodeThread, args, parts);
+    delete[] args;
+
+    // Predict all rows up to the first that failed, as it would be on a single thread
+    for (uint32 i = 0; i < parts; i++) {
+      SrwDecodeJob &j = jobs[i];
+      for (uint32 y = j.startY; y < j.failY; y++)
+        predictRow(y, &dirs[y * groups], groups);
+      if (j.failY < j.endY) {
+        predictRow(j.failY, &dirs[j.failY * groups], j.failGroups);
+        // Rows after have been decoded to differences, as they would not have
+        // been decoded on a single thread.
+        clearAfter(j.failY, j.failGroups);
+        string error = j.error;
+        bool ioError = j.ioError;
+        delete[] jobs;
+        if (ioError)
+          throw IOException(error);
+        throw RawDecoderException(error);
       }
-      bits.checkPos();
-      img += 16;
-      img_up += 16;
-      img_up2 += 16;
     }
+    delete[] jobs;
   }
+  if (!offsetError.empty()) {
+    clearAfter(rows, 0);
+    if (offsetIOError)
+      throw IOException(offsetError);
+    throw RawDecoderException(offsetError);
+  }
+}
+
+void SrwDecoder::clearAfter(uint32 y, uint32 groups) {
+  uint32 width = mRaw->dim.x;
+  uint32 pixels = min(width, groups * 16);
+  ushort16* img = (ushort16*)mRaw->getData(0, y);
+  memset(&img[pixels], 0, (width - pixels) * 2);
+  for (y++; y < (uint32)mRaw->dim.y; y++)
+    memset(mRaw->getData(0, y), 0, width * 2);
+}
+
+void SrwDecoder::decodeCompressedJob(SrwDecodeJob *job) {
+  JobTimer timer(mRaw->stats);
+  uint32 y = job->startY;
+  uint32 done = 0;
+  uint64 bytes = 0;
+  try {
+    for (; y < job->endY; y++)
+      bytes += decodeDifferences(y, job->offsets[y], job->ends[y], &job->dirs[y * job->groups], &done);
+  } catch (RawDecoderException &e) {
+    job->error = e.what();
+  } catch (IOException &e) {
+    job->error = e.what();
+    job->ioError = true;
+  }
+  job->failY = y;
+  job->failGroups = done;
+  if (mRaw->stats)
+    mRaw->stats->addCount(COUNTER_BYTES, bytes);
+}
+
+uint32 SrwDecoder::decodeDifferences(uint32 y, uint32 line_offset, uint64 line_end, uchar8 *dirs, uint32 *groups) {
+  uint32 width = mRaw->dim.x;
+  int len[4];
+  for (int i = 0; i < 4; i++)
+    len[i] = y < 2 ? 7 : 4;
+  uint32 line_size = (uint32)min(line_end - line_offset, (uint64)BITPUMP_MAX_SIZE);
+  BitPumpMSB32 bits(mFile->getData(line_offset, line_size), line_size);
+  int op[4];
+  ushort16* img = (ushort16*)mRaw->getData(0, y);
+  uint32 &g = *groups;
+  g = 0;
+  // Image is arranged in groups of 16 pixels horizontally
+  for (uint32 x = 0; x < width; x += 16) {
+    bool dir = !!bits.getBit();
+    for (int i = 0; i < 4; i++)
+      op[i] = bits.getBits(2);
+    for (int i = 0; i < 4; i++) {
+      switch (op[i]) {
+        case 3: len[i] = bits.getBits(4);
+          break;
+        case 2: len[i]--;
+          break;
+        case 1: len[i]++;
+      }
+      if (len[i] < 0)
+        ThrowRDE("Srw Decompressor: Bit length less than 0.");
+      if (len[i] > 16)
+        ThrowRDE("Srw Decompressor: Bit Length more than 16.");
+    }
+    dirs[g] = dir;
+    // First we decode even pixels
+    // A length of 0 would shift by 32, so it is handled separately.
+    for (int c = 0; c < 16; c += 2) {
+      int b = len[(c >> 3)];
+      img[c] = b ? ((int32) bits.getBits(b) << (32-b) >> (32-b)) : 0;
+    }
+    // Now we decode odd pixels
+    for (int c = 1; c < 16; c += 2) {
+      int b = len[2 | (c >> 3)];
+      img[c] = b ? ((int32) bits.getBits(b) << (32-b) >> (32-b)) : 0;
+    }
+    g++;
+    bits.checkPos();
+    img += 16;
+  }
+  return bits.getOffset();
+}
+
+/* Upward prediction uses the pixel above for even pixels, and two rows above */
+/* for odd pixels. Left to right prediction uses the last even and odd pixel of */
+/* the group to the left, or 128 for the first group. */
+
+static void predictSrwRowRef(ushort16* img, const ushort16* img_up, const ushort16* img_up2, const uchar8 *dirs, uint32 groups) {
+  for (uint32 g = 0; g < groups; g++) {
+    if (dirs[g]) {
+      for (int c = 0; c < 16; c += 2)
+        img[c] = img[c] + img_up[c];
+      for (int c = 1; c < 16; c += 2)
+        img[c] = img[c] + img_up2[c];
+    } else {
+      int pred_left = g ? img[-2] : 128;
+      for (int c = 0; c < 16; c += 2)
+        img[c] = img[c] + pred_left;
+      pred_left = g ? img[-1] : 128;
+      for (int c = 1; c < 16; c += 2)
+        img[c] = img[c] + pred_left;
+    }
+    img += 16;
+    img_up += 16;
+    img_up2 += 16;
+  }
+}
+
+#ifdef RAWSPEED_SSE2
+static void predictSrwRowSSE2(ushort16* img, const ushort16* img_up, const ushort16* img_up2, const uchar8 *dirs, uint32 groups) {
+  __m128i odd = _mm_set1_epi32(0xffff0000);
+  for (uint32 g = 0; g < groups; g++) {
+    __m128i pred_lo, pred_hi;
+    if (dirs[g]) {
+      __m128i up_lo = _mm_loadu_si128((__m128i*)img_up);
+      __m128i up_hi = _mm_loadu_si128((__m128i*)&img_up[8]);
+      __m128i up2_lo = _mm_loadu_si128((__m128i*)img_up2);
+      __m128i up2_hi = _mm_loadu_si128((__m128i*)&img_up2[8]);
+      pred_lo = _mm_or_si128(_mm_andnot_si128(odd, up_lo), _mm_and_si128(odd, up2_lo));
+      pred_hi = _mm_or_si128(_mm_andnot_si128(odd, up_hi), _mm_and_si128(odd, up2_hi));
+    } else {
+      uint32 left = g ? (img[-2] | (img[-1] << 16)) : (128 | (128 << 16));
+      pred_lo = pred_hi = _mm_set1_epi32(left);
+    }
+    __m128i lo = _mm_loadu_si128((__m128i*)img);
+    __m128i hi = _mm_loadu_si128((__m128i*)&img[8]);
+    _mm_storeu_si128((__m128i*)img, _mm_add_epi16(lo, pred_lo));
+    _mm_storeu_si128((__m128i*)&img[8], _mm_add_epi16(hi, pred_hi));
+    img += 16;
+    img_up += 16;
+    img_up2 += 16;
+  }
+}
+#endif
+
+#ifdef RAWSPEED_AVX2
+/* A group is one AVX2 register */
+RAWSPEED_TARGET_AVX2 static void predictSrwRowAVX2(ushort16* img, const ushort16* img_up, const ushort16* img_up2, const uchar8 *dirs, uint32 groups) {
+  for (uint32 g = 0; g < groups; g++) {
+    __m256i pred;
+    if (dirs[g]) {
+      __m256i up = _mm256_loadu_si256((__m256i*)img_up);
+      __m256i up2 = _mm256_loadu_si256((__m256i*)img_up2);
+      pred = _mm256_blend_epi16(up, up2, 0xaa);
+    } else {
+      uint32 left = g ? (img[-2] | (img[-1] << 16)) : (128 | (128 << 16));
+      pred = _mm256_set1_epi32(left);
+    }
+    __m256i v = _mm256_loadu_si256((__m256i*)img);
+    _mm256_storeu_si256((__m256i*)img, _mm256_add_epi16(v, pred));
+    img += 16;
+    img_up += 16;
+    img_up2 += 16;
+  }
+}
+#endif
+
+#ifdef RAWSPEED_NEON
+static void predictSrwRowNEON(ushort16* img, const ushort16* img_up, const ushort16* img_up2, const uchar8 *dirs, uint32 groups) {
+  uint16x8_t odd = vreinterpretq_u16_u32(vdupq_n_u32(0xffff0000));
+  for (uint32 g = 0; g < groups; g++) {
+    uint16x8_t pred_lo, pred_hi;
+    if (dirs[g]) {
+      pred_lo = vbslq_u16(odd, vld1q_u16(img_up2), vld1q_u16(img_up));
+      pred_hi = vbslq_u16(odd, vld1q_u16(&img_up2[8]), vld1q_u16(&img_up[8]));
+    } else {
+      uint32 left = g ? (img[-2] | (img[-1] << 16)) : (128 | (128 << 16));
+      pred_lo = pred_hi = vreinterpretq_u16_u32(vdupq_n_u32(left));
+    }
+    vst1q_u16(img, vaddq_u16(vld1q_u16(img), pred_lo));
+    vst1q_u16(&img[8], vaddq_u16(vld1q_u16(&img[8]), pred_hi));
+    img += 16;
+    img_up += 16;
+    img_up2 += 16;
+  }
+}
+#endif
+
+void SrwDecoder::predictRow(uint32 y, const uchar8 *dirs, uint32 groups) {
+  ushort16* img = (ushort16*)mRaw->getData(0, y);
+  const ushort16* img_up = (ushort16*)mRaw->getData(0, max(0, (int)y - 1));
+  const ushort16* img_up2 = (ushort16*)mRaw->getData(0, max(0, (int)y - 2));
+  // There is no row above the first row, so upward prediction adds 0
+  vector<ushort16> zero;
+  if (!y) {
+    zero.resize(groups * 16 + 16, 0);
+    img_up = img_up2 = &zero[0];
+  }
+  // The last group may be outside the image, if the width is not a multiple of 16
+  if (groups * 16 > (uint32)mRaw->dim.x) {
+    predictSrwRowRef(img, img_up, img_up2, dirs, groups);
+    return;
+  }
+#ifdef RAWSPEED_AVX2
+  if (CpuFeatures::has(CPU_AVX2)) {
+    predictSrwRowAVX2(img, img_up, img_up2, dirs, groups);
+    return;
+  }
+#endif
+#ifdef RAWSPEED_SSE2
+  if (CpuFeatures::has(CPU_SSE2)) {
+    predictSrwRowSSE2(img, img_up, img_up2, dirs, groups);
+    return;
+  }
+#endif
+#ifdef RAWSPEED_NEON
+  if (CpuFeatures::has(CPU_NEON)) {
+    predictSrwRowNEON(img, img_up, img_up2, dirs, groups);
+    return;
+  }
+#endif
+  predictSrwRowRef(img, img_up, img_up2, dirs, groups);
 }
 
 
@@ -30,6 +30,8 @@
 
 namespace RawSpeed {
 
+class SrwDecodeJob;
+
 class SrwDecoder :
   public RawDecoder
 {
@@ -40,8 +42,20 @@ public:
   virtual void decodeMetaDataInternal(CameraMetaData *meta);
   virtual void checkSupportInternal(CameraMetaData *meta);
   virtual TiffIFD* getRootIFD() {return mRootIFD;}
+  /* Internal: decodes a part of the rows on the thread pool */
+  void decodeCompressedJob(SrwDecodeJob *job);
 private:
   void decodeCompressed( TiffIFD* raw);
+  /* Decodes row "y" to the differences from the predicted values, which are stored */
+  /* in the row, and the direction of each group of 16 pixels, stored in "dirs". */
+  /* The data of the row is from "line_offset" to "line_end". */
+  /* "groups" is the number of groups stored, also if it fails. */
+  /* Returns the number of bytes read. */
+  uint32 decodeDifferences(uint32 y, uint32 line_offset, uint64 line_end, uchar8 *dirs, uint32 *groups);
+  /* Adds the predicted values to the first "groups" groups of row "y" */
+  void predictRow(uint32 y, const uchar8 *dirs, uint32 groups);
+  /* Clears the pixels after the first "groups" groups of row "y", and the rows below */
+  void clearAfter(uint32 y, uint32 groups);
   TiffIFD *mRootIFD;
 };
 
@@ -0,0 +1,258 @@
+#include "StdAfx.h"
+#include "ThreadPool.h"
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/* A set of jobs submitted by one call to ThreadPool::run() */
+class ThreadPoolBatch
+{
+public:
+  ThreadPoolBatch(ThreadPoolJob _job, void** _args, uint32 _count) :
+      job(_job), args(_args), count(_count), next(0), done(0) {};
+  ThreadPoolJob job;
+  void** args;
+  uint32 count;
+  uint32 next;    // Next job to hand out
+  uint32 done;    // Number of completed jobs
+};
+
+static ThreadPool* pool_instance = NULL;
+static uint32 pool_size = 0;
+static pthread_mutex_t pool_instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t pool_thread_key;
+static pthread_once_t pool_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void createThreadKey() {
+  pthread_key_create(&pool_thread_key, NULL);
+}
+
+void *ThreadPoolWorkerThread(void *_this) {
+  ThreadPool* me = (ThreadPool*)_this;
+  me->workerLoop();
+  return NULL;
+}
+
+ThreadPool::ThreadPool(void) : mSize(1), mStarted(0), mStop(false), mRunning(false) {
+  pthread_once(&pool_thread_key_once, createThreadKey);
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_mutex_init(&mResizeMutex, NULL);
+  pthread_cond_init(&mWorkCond, NULL);
+  pthread_cond_init(&mDoneCond, NULL);
+}
+
+ThreadPool::~ThreadPool(void) {
+  stop();
+  pthread_cond_destroy(&mDoneCond);
+  pthread_cond_destroy(&mWorkCond);
+  pthread_mutex_destroy(&mResizeMutex);
+  pthread_mutex_destroy(&mMutex);
+}
+
+ThreadPool* ThreadPool::getPool() {
+  // The pool is never deleted, as other threads may hold on to it.
+  pthread_mutex_lock(&pool_instance_mutex);
+  if (!pool_instance)
+    pool_instance = new ThreadPool();
+  ThreadPool* p = pool_instance;
+  pthread_mutex_unlock(&pool_instance_mutex);
+  p->start();
+  return p;
+}
+
+void ThreadPool::setSize(uint32 threads) {
+  pthread_mutex_lock(&pool_instance_mutex);
+  pool_size = threads;
+  pthread_mutex_unlock(&pool_instance_mutex);
+  shutdown();
+}
+
+void ThreadPool::shutdown() {
+  pthread_mutex_lock(&pool_instance_mutex);
+  ThreadPool* p = pool_instance;
+  pthread_mutex_unlock(&pool_instance_mutex);
+  if (p)
+    p->stop();
+}
+
+/* Number of threads set with setSize(), or the number of cores */
+static uint32 getPoolSize() {
+  pthread_mutex_lock(&pool_instance_mutex);
+  uint32 threads = pool_size;
+  pthread_mutex_unlock(&pool_instance_mutex);
+  if (!threads)
+    threads = getThreadCount();
+  return max(threads, 1u);
+}
+
+void ThreadPool::start() {
+  pthread_mutex_lock(&mMutex);
+  bool running = mRunning;
+  pthread_mutex_unlock(&mMutex);
+  if (running)
+    return;
+
+  uint32 threads = getPoolSize();
+  pthread_mutex_lock(&mResizeMutex);
+  pthread_mutex_lock(&mMutex);
+  if (!mRunning) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+    // The calling thread always takes part, so one thread less is needed.
+    // The workers wait for mMutex, before taking their thread number.
+    mStarted = 0;
+    for (uint32 i = 1; i < threads; i++) {
+      pthread_t t;
+      if (0 != pthread_create(&t, &attr, ThreadPoolWorkerThread, this))
+        break;
+      mThreads.push_back(t);
+    }
+    pthread_attr_destroy(&attr);
+    mSize = (uint32)mThreads.size() + 1;
+    mRunning = true;
+  }
+  pthread_mutex_unlock(&mMutex);
+  pthread_mutex_unlock(&mResizeMutex);
+}
+
+void ThreadPool::stop() {
+  pthread_mutex_lock(&mResizeMutex);
+  pthread_mutex_lock(&mMutex);
+  if (!mRunning) {
+    pthread_mutex_unlock(&mMutex);
+    pthread_mutex_unlock(&mResizeMutex);
+    return;
+  }
+  // mRunning stays set until the workers are joined, so a job calling getPool()
+  // meanwhile does not wait for mResizeMutex.
+  vector<pthread_t> threads = mThreads;
+  mStop = true;
+  pthread_cond_broadcast(&mWorkCond);
+  pthread_mutex_unlock(&mMutex);
+
+  void *status;
+  for (uint32 i = 0; i < threads.size(); i++)
+    pthread_join(threads[i], &status);
+
+  pthread_mutex_lock(&mMutex);
+  mThreads.clear();
+  mSize = 1;
+  mStop = false;
+  mRunning = false;
+  pthread_mutex_unlock(&mMutex);
+  pthread_mutex_unlock(&mResizeMutex);
+}
+
+uint32 ThreadPool::getThreadNumber() {
+  pthread_once(&pool_thread_key_once, createThreadKey);
+  return (uint32)(size_t)pthread_getspecific(pool_thread_key);
+}
+
+uint32 ThreadPool::getSize() {
+  pthread_mutex_lock(&mMutex);
+  uint32 size = mSize;
+  pthread_mutex_unlock(&mMutex);
+  return size;
+}
+
+uint32 ThreadPool::getPartCount(uint32 items, uint32 minItems) {
+  uint32 size = getSize();
+  if (size <= 1)
+    return 1;
+  uint32 parts = min(size * POOL_PARTS_PER_THREAD, items / max(minItems, 1u));
+  return max(parts, 1u);
+}
+
+/* Must be called with mMutex held */
+bool ThreadPool::takeJob(ThreadPoolBatch* b, uint32 *index) {
+  if (b->next >= b->count)
+    return false;
+  *index = b->next++;
+  if (b->next == b->count)
+    mQueue.remove(b);   // All jobs handed out
+  return true;
+}
+
+/* Must be called with mMutex held */
+void ThreadPool::finishJob(ThreadPoolBatch* b) {
+  if (++b->done == b->count)
+    pthread_cond_broadcast(&mDoneCond);
+}
+
+void ThreadPool::workerLoop() {
+  pthread_mutex_lock(&mMutex);
+  pthread_setspecific(pool_thread_key, (void*)(size_t)++mStarted);
+  while (true) {
+    while (mQueue.empty() && !mStop)
+      pthread_cond_wait(&mWorkCond, &mMutex);
+    if (mStop)
+      break;  // Jobs not handed out are run by the threads that submitted them
+
+    ThreadPoolBatch* b = mQueue.front();
+    uint32 i;
+    if (!takeJob(b, &i))
+      continue;
+    pthread_mutex_unlock(&mMutex);
+    b->job(b->args[i]);
+    pthread_mutex_lock(&mMutex);
+    finishJob(b);
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void ThreadPool::run(ThreadPoolJob job, void** args, uint32 count) {
+  if (!count)
+    return;
+
+  // Nothing to gain from handing a single job to another thread
+  pthread_mutex_lock(&mMutex);
+  if (count == 1 || mThreads.empty()) {
+    pthread_mutex_unlock(&mMutex);
+    for (uint32 i = 0; i < count; i++)
+      job(args[i]);
+    return;
+  }
+
+  // If the workers are being stopped, this thread runs the jobs they leave.
+  ThreadPoolBatch b(job, args, count);
+  mQueue.push_back(&b);
+  pthread_cond_broadcast(&mWorkCond);
+
+  // Help out, until all jobs are handed out, then wait for the rest.
+  while (b.done < b.count) {
+    uint32 i;
+    if (takeJob(&b, &i)) {
+      pthread_mutex_unlock(&mMutex);
+      job(args[i]);
+      pthread_mutex_lock(&mMutex);
+      finishJob(&b);
+    } else {
+      pthread_cond_wait(&mDoneCond, &mMutex);
+    }
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+} // namespace RawSpeed
@@ -0,0 +1,111 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2013 Klaus Post
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+    http://www.klauspost.com
+*/
+
+namespace RawSpeed {
+
+/* Function executed for each job. Same signature as a pthread start routine, */
+/* so existing thread functions can be submitted directly. */
+/* Jobs must not throw - catch exceptions and store them with setError() */
+typedef void* (*ThreadPoolJob)(void*);
+
+/* Number of parts per thread returned by ThreadPool::getPartCount() */
+#define POOL_PARTS_PER_THREAD 4
+
+class ThreadPoolBatch;
+
+/*************************************************************************
+ * Process-wide pool of decoder worker threads
+ *
+ * The pool is started the first time it is used, and is shared by all
+ * decoders, so no threads are created or joined per image.
+ * Jobs are handed out one at a time, in order, to whichever thread is
+ * idle, so work split into many parts is balanced dynamically.
+ * The thread submitting work also executes jobs while it waits, so
+ * the pool may be used from within a job without deadlocking.
+ * A pool size of 1 starts no threads - everything runs on the caller.
+ *
+ *****************************/
+class ThreadPool
+{
+public:
+  /* Returns the pool, starting the worker threads if needed */
+  static ThreadPool* getPool();
+
+  /* Set the number of threads that may run jobs concurrently. */
+  /* 0 (default) uses the number of processor cores. */
+  /* If the pool is running, its workers are stopped, and the new number */
+  /* is started on next use. */
+  static void setSize(uint32 threads);
+
+  /* Stops and joins all worker threads, after they finish their current job. */
+  /* Images being decoded meanwhile continue on the threads that submitted them. */
+  /* The pool object is kept, so pointers returned by getPool() stay valid. */
+  /* The workers are restarted on next call to getPool(). Must not be called from a job. */
+  static void shutdown();
+
+  /* Number of the calling thread: 1 and up for pool worker threads, */
+  /* 0 for all other threads, such as the one submitting work */
+  static uint32 getThreadNumber();
+
+  /* Number of jobs that may run concurrently */
+  uint32 getSize();
+
+  /* Number of parts "items" should be split into, when submitted with run(). */
+  /* Gives each thread several parts, so threads that finish early pick up */
+  /* the remaining work, instead of waiting for the slowest part. */
+  /* Each part will have at least minItems items. Returns 1 on a single thread pool. */
+  uint32 getPartCount(uint32 items, uint32 minItems = 1);
+
+  /* Runs job(args[i]) for all "count" args, and returns when all are done */
+  void run(ThreadPoolJob job, void** args, uint32 count);
+
+  /* Internal: main loop of the worker threads */
+  void workerLoop();
+
+private:
+  ThreadPool(void);
+  ~ThreadPool(void);
+  /* Starts the worker threads, if they are not running */
+  void start();
+  /* Joins the worker threads, if they are running */
+  void stop();
+  bool takeJob(ThreadPoolBatch* b, uint32 *index);
+  void finishJob(ThreadPoolBatch* b);
+
+  uint32 mSize;               // Worker threads running, plus the calling thread
+  vector<pthread_t> mThreads;
+  list<ThreadPoolBatch*> mQueue;
+  pthread_mutex_t mMutex;
+  pthread_cond_t mWorkCond;   // Signalled when jobs are queued
+  pthread_cond_t mDoneCond;   // Signalled when a batch is completed
+  uint32 mStarted;            // Number of worker threads started
+  bool mStop;
+  bool mRunning;              // The worker threads have been started
+  pthread_mutex_t mResizeMutex;  // Held while starting or stopping the workers
+};
+
+} // namespace RawSpeed
+
+#endif
@@ -35,13 +35,14 @@ TiffEntry::TiffEntry(FileMap* f, uint32 offset) {
   count = *(int*)f->getData(offset + 4);
   if (type > 13)
     ThrowTPE("Error reading TIFF structure. Unknown Type 0x%x encountered.", type);
-  uint32 bytesize = count << datashifts[type];
+  uint64 bytesize = (uint64)count << datashifts[type];
   if (bytesize <= 4) {
-    data = f->getDataWrt(offset + 8);
+    data_offset = offset + 8;
+    data = f->getData(offset + 8);
   } else { // offset
     data_offset = *(uint32*)f->getData(offset + 8);
     CHECKSIZE(data_offset + bytesize);
-    data = f->getDataWrt(data_offset);
+    data = f->getData(data_offset, bytesize);
   }
 #ifdef _DEBUG
   debug_intVal = 0xC0CAC01A;
@@ -121,8 +122,11 @@ float TiffEntry::getFloat() {
 string TiffEntry::getString() {
   if (type != TIFF_ASCII)
     ThrowTPE("TIFF, getString: Wrong type 0x%x encountered. Expected Ascii", type);
-  data[count-1] = 0;  // Ensure string is not larger than count defines
-  return string((char*)&data[0]);
+  // Ensure string is not larger than count defines, without modifying the file
+  uint32 len = 0;
+  while (len + 1 < count && data[len])
+    len++;
+  return string((const char*)&data[0], len);
 }
 
 int TiffEntry::getElementSize() {
@@ -81,12 +81,12 @@ public:
   TiffTag tag;
   TiffDataType type;
   uint32 count;
-  uint32 getDataOffset() const { return data_offset; }
+  uint64 getDataOffset() const { return data_offset; }
   bool isFloat();
   bool isInt();
 protected:
-  uchar8* data;
-  uint32 data_offset;
+  const uchar8* data;
+  uint64 data_offset;
 #ifdef _DEBUG
   int debug_intVal;
   float debug_floatVal;
@@ -24,9 +24,9 @@
 
 namespace RawSpeed {
 
-TiffEntryBE::TiffEntryBE(FileMap* f, uint32 offset) : mDataSwapped(false) {
+TiffEntryBE::TiffEntryBE(FileMap* f, uint32 offset) : mDataSwapped(false), mSwappedData(0) {
   type = TIFF_UNDEFINED;  // We set type to undefined to avoid debug assertion errors.
-  data = f->getDataWrt(offset);
+  data = f->getData(offset);
   tag = (TiffTag)getShort();
   data += 2;
   TiffDataType _type = (TiffDataType)getShort();
@@ -36,14 +36,15 @@ TiffEntryBE::TiffEntryBE(FileMap* f, uint32 offset) : mDataSwapped(false) {
 
   if (type > 13)
     ThrowTPE("Error reading TIFF structure. Unknown Type 0x%x encountered.", type);
-  uint32 bytesize = count << datashifts[type];
+  uint64 bytesize = (uint64)count << datashifts[type];
   if (bytesize <= 4) {
-    data = f->getDataWrt(offset + 8);
+    data_offset = offset + 8;
+    data = f->getData(offset + 8);
   } else { // offset
-    data = f->getDataWrt(offset + 8);
+    data = f->getData(offset + 8);
     data_offset = (unsigned int)data[0] << 24 | (unsigned int)data[1] << 16 | (unsigned int)data[2] << 8 | (unsigned int)data[3];
     CHECKSIZE(data_offset + bytesize);
-    data = f->getDataWrt(data_offset);
+    data = f->getData(data_offset, bytesize);
   }
 #ifdef _DEBUG
   debug_intVal = 0xC0CAC01A;
@@ -57,6 +58,9 @@ TiffEntryBE::TiffEntryBE(FileMap* f, uint32 offset) : mDataSwapped(false) {
 }
 
 TiffEntryBE::~TiffEntryBE(void) {
+  if (mSwappedData)
+    delete[] mSwappedData;
+  mSwappedData = 0;
 }
 
 unsigned int TiffEntryBE::getInt() {
@@ -84,11 +88,13 @@ const unsigned int* TiffEntryBE::getIntArray() {
   if (mDataSwapped)
     return (unsigned int*)&data[0];
 
-  unsigned int* d = (unsigned int*) & data[0];
   uint32 ncount = count * ((type == TIFF_RATIONAL ||  type == TIFF_SRATIONAL) ? 2 : 1);
+  mSwappedData = new uchar8[ncount * 4];
+  unsigned int* d = (unsigned int*) & mSwappedData[0];
   for (uint32 i = 0; i < ncount; i++) {
     d[i] = (unsigned int)data[i*4+0] << 24 | (unsigned int)data[i*4+1] << 16 | (unsigned int)data[i*4+2] << 8 | (unsigned int)data[i*4+3];
   }
+  data = mSwappedData;
   mDataSwapped = true;
   return d;
 }
@@ -101,10 +107,12 @@ const unsigned short* TiffEntryBE::getShortArray() {
   if (mDataSwapped)
     return (unsigned short*)&data[0];
 
-  unsigned short* d = (unsigned short*) & data[0];
+  mSwappedData = new uchar8[count * 2];
+  unsigned short* d = (unsigned short*) & mSwappedData[0];
   for (uint32 i = 0; i < count; i++) {
     d[i] = (unsigned short)data[i*2+0] << 8 | (unsigned short)data[i*2+1];
   }
+  data = mSwappedData;
   mDataSwapped = true;
   return d;
 }
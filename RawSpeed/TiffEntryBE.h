@@ -40,6 +40,7 @@ public:
   virtual const ushort16* getShortArray();
 private:
   bool mDataSwapped;
+  uchar8* mSwappedData;   // Byte swapped copy of the data, since the file is read only
 };
 
 } // namespace RawSpeed
@@ -37,7 +37,7 @@ TiffIFD::TiffIFD() {
 }
 
 TiffIFD::TiffIFD(FileMap* f, uint32 offset) {
-  uint32 size = f->getSize();
+  uint64 size = f->getSize();
   uint32 entries;
   endian = little;
   CHECKSIZE(offset);
@@ -155,8 +155,8 @@ TiffIFD* TiffIFD::parseDngPrivateData(TiffEntry *t) {
 /* This will attempt to parse makernotes and return it as an IFD */
 TiffIFD* TiffIFD::parseMakerNote(FileMap *f, uint32 offset, Endianness parent_end)
 {
-  uint32 size = f->getSize();
-  CHECKSIZE(offset + 20);
+  uint64 size = f->getSize();
+  CHECKSIZE((uint64)offset + 20);
   TiffIFD *maker_ifd = NULL;
   const uchar8* data = f->getData(offset);
 
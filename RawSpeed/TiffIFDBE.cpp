@@ -75,7 +75,7 @@ TiffIFDBE::TiffIFDBE(FileMap* f, uint32 offset) {
       mEntry[t->tag] = t;
     }
   }
-  data = f->getDataWrt(offset + 2 + entries * 12);
+  data = f->getData(offset + 2 + entries * 12);
   nextIFD = (unsigned int)data[0] << 24 | (unsigned int)data[1] << 16 | (unsigned int)data[2] << 8 | (unsigned int)data[3];
 }
 